@@ -12,8 +12,12 @@
 
 #define SW_MAJOR_VERSION 2
 #define SW_MINOR_VERSION 06
-#define STORED_VAR_VERSION 4 /* tells which version of stored variable is used for thisproject in case the stored var */
+#define STORED_VAR_VERSION 5 /* tells which version of stored variable is used for thisproject in case the stored var */
                              /* changes from previous SW release, please increase the STORED_VAR_VERSION by 1         */
+                             /* Fields added at the end of CarParam_type don't need it: see Storage_Load()             */
+#define STORED_VAR_BLOB_VERSION 4 /* Last version that stored everything in the single "user_param" key, converted at startup */
+#define STORED_VAR_BLOB_TAIL (sizeof(uint16_t) + 2 * sizeof(int16_t))  /* selectedCarNumber, min and max trigger after the cars in the blob */
+#define STORAGE_KEY_SYS "sys"    /* NVS key of the car selection and the calibration, the cars are "car0".."car9" */
 
 /* Last modified: 17/10/2024 */
 /*********************************************************************************************************************/
@@ -58,26 +62,63 @@ StoredVar_type g_storedVar;
 /* ESC internal variables gloabl instance */
 ESC_type g_escVar{
   .outputSpeed_pct = 0,
+  .outputSpeed_q16 = 0,
   .trigger_raw = 0,
-  .trigger_norm = 0,
+  .trigger_q16 = 0,
+  .triggerVel_q16 = 0,
+  .tractionTrim_q16 = THROTTLE_Q16_MAX,
+  .currLimit_q16 = THROTTLE_Q16_MAX,
+  .currLimited = false,
   .encoderPos = 1,
   .Vin_mV = 0,
+  .motorBemf_mV = 0,
+  .motorSpeed_pml = 0,
   .dualCurve = false
 };
 
 /* Main menu global instances */
+extern const MenuItem_type g_mainMenuItems[MENU_ITEMS_COUNT];
 Menu_type g_mainMenu{
+  .item = g_mainMenuItems,
   .lines = 3
 };
 
 /* Car menu global instances */
 Menu_type g_carMenu{
+  .item = NULL,
   .lines = 3
 };
 
 /* Preferences global instance (for storing NVM data, replace EEPROM library) */
 Preferences g_pref;
 
+/* NVS records of g_storedVar: one per car plus STORAGE_KEY_SYS, so a change is written only in its own key (see initStorage()) */
+StorageRecord_type g_storageRecords[CAR_MAX_COUNT + 1];
+
+/* Control parameters snapshot (see ControlParam_type). Task1 builds the buffer not in use, then swaps g_ctrlParamActive.
+   The control tick takes g_ctrlParamActive once at the start of every tick and reports it in g_ctrlParamInUse:
+   Task1 rebuilds a buffer only once the control tick moved away from it. Before the first build the curve is all 0 (no power) */
+static ControlParam_type g_ctrlParam[2];
+static const ControlParam_type *g_ctrlParamActive = &g_ctrlParam[0];
+static const ControlParam_type *g_ctrlParamInUse = &g_ctrlParam[0];
+
+static AntiSpinState_type g_antiSpinState;  /* Antispin ramp state, owned by the control tick */
+static TrigEstimator_type g_trigEstimator;  /* Trigger position/velocity estimator, owned by the control tick */
+static TractionState_type g_traction;       /* Traction control state, owned by the control tick */
+static CurrLimitState_type g_currLimit;     /* Motor current limiter state, owned by the control tick */
+
+/* Control tick timing statistics global instance */
+TickStats_type g_tickStats;
+
+/* Boot milestones, time to first PWM */
+BootStats_type g_bootStats;
+
+static TelemetrySample_type g_telemetryLast;    /* Newest telemetry sample drained by Task1 */
+static bool g_telemetryStream = false;          /* Telemetry samples are streamed on the serial port (toggled by 't') */
+
+static TimerHandle_t g_uiTimer = NULL;        /* Periodic UI_EVT_TIMER event for Task1 */
+static TimerHandle_t g_buttonTimer = NULL;    /* One shot UI_EVT_BUTTON event for Task1, DIAG_LONG_PRESS_MS after the button press */
+
 static uint32_t g_lastEncoderInteraction = 0;  /* tell how much time has passed since last time encoder whas rotated/pressed
                                                   so we can avoid keep printing the display menu and save CPU cycles */
 
@@ -85,6 +126,12 @@ static uint32_t g_lastEncoderInteraction = 0;  /* tell how much time has passed
 /*--------------------------------------------- Function Declaration----------------------------------------*/
 /*********************************************************************************************************************/
 void IRAM_ATTR readEncoderISR();
+void IRAM_ATTR buttonISR();
+/* Control tick and everything it calls: run in the control timer ISR, also while the flash cache is disabled */
+void IRAM_ATTR controlTick();
+void IRAM_ATTR updateTickStats(uint32_t period_uS);
+uint16_t IRAM_ATTR throttleCurve2(const ControlParam_type *param, uint16_t inputThrottleQ16);
+uint16_t IRAM_ATTR throttleAntiSpin3(const ControlParam_type *param, uint16_t requestedSpeed);
 
 
 /*********************************************************************************************************************/
@@ -102,6 +149,15 @@ void setup()
   HalfBridge_SetupFabio();
 
   /***** create a task that will be executed in the Task1code() and Task2code() funcitons, executed on core 0 and 1 *****/
+  /* TASK2: perform trigger reading, trigger conditioning, PWM output. First, so the control tick is up while Task1 reads the NVS */
+  xTaskCreatePinnedToCore(
+    Task2code, /* Task function. */
+    "Task2",   /* name of task. */
+    10000,     /* Stack size of task */
+    NULL,      /* parameter of the task */
+    2,         /* priority of the task */
+    &Task2,    /* Task handle to keep track of created task */
+    1);        /* pin task to core 1 */
   /* TASK1: slotESC state machine, managex OLED display and Encoder, low priority task */
   xTaskCreatePinnedToCore(
     Task1code, /* Task function. */
@@ -111,15 +167,6 @@ void setup()
     1,         /* priority of the task */
     &Task1,    /* Task handle to keep track of created task */
     0);        /* pin task to core 0 */
-  /* TASK2: perform trigger reading, trigger conditioning, PWM output */
-  xTaskCreatePinnedToCore(
-    Task2code, /* Task function. */
-    "Task2",   /* name of task. */
-    10000,     /* Stack size of task */
-    NULL,      /* parameter of the task */
-    2,         /* priority of the task */
-    &Task2,    /* Task handle to keep track of created task */
-    1);        /* pin task to core 1 */
 }
 
 
@@ -132,12 +179,22 @@ void setup()
  */
 void Task1code(void *pvParameters) 
 {
+  g_uiTimer = xTimerCreate("UiTimer", pdMS_TO_TICKS(UI_PERIOD_MS), pdTRUE, NULL, uiTimerCallback);
+  xTimerStart(g_uiTimer, portMAX_DELAY);
+  g_buttonTimer = xTimerCreate("BtnTimer", pdMS_TO_TICKS(DIAG_LONG_PRESS_MS + UI_PERIOD_MS), pdFALSE, NULL, buttonTimerCallback);
+
   for (;;) 
   {
     StateMachine_enum prevState = g_currState;  /* Keep track of the state at the previous loop */
-    static uint16_t prevFreqPWM = 0;            /* Keep track if the PWM freq has changed */
     static MenuState_enum menuState = ITEM_SELECTION;   /* State of the Main Menu */
     static uint8_t swMajVer, swMinVer, storedVarVersion;/* SW major version, minor version,  storedVariable version stored in the eeprom */
+    static uint32_t buttonPressedSince = 0;     /* Time when the encoder button was pressed, 0 if released (used for long press) */
+    static uint32_t welcomeSince_ms = 0;        /* Time the welcome screen was shown, 0 before */
+
+    if (g_currState != INIT)  /* Sleep until something happens (INIT runs straight away) */
+    {
+      waitUiEvent();
+    }
 
     g_escVar.Vin_mV = HAL_ReadVoltageDivider(AN_VIN_DIV, RVIFBL, RVIFBH); /* Read VIN */
 
@@ -151,21 +208,47 @@ void Task1code(void *pvParameters)
       case INIT:
 
         g_pref.begin("stored_var", false); /* Open the "stored" namespace in read/write mode. If it doesn't exist, it creates it */
+        initStorage();          /* Set the NVS records of the stored variables, in the same namespace */
+        initStoredVariables();  /* Defaults first: what is not found in the NVS keeps them */
         
-        if (g_pref.isKey("stored_var_ver") && g_pref.isKey("sw_maj_ver") && g_pref.isKey("sw_min_ver") && g_pref.isKey("user_param")) /* If all keys exists, then check their value */
+        if (g_pref.isKey("stored_var_ver") && g_pref.isKey("sw_maj_ver") && g_pref.isKey("sw_min_ver")) /* If all keys exists, then check their value */
         {
           /* Get the values of the sw version */
           swMajVer = g_pref.getUChar("sw_maj_ver");
           swMinVer = g_pref.getUChar("sw_min_ver");
           storedVarVersion = g_pref.getUChar("stored_var_ver");
 
-          if ((storedVarVersion == STORED_VAR_VERSION) ) /* If the storedVariable version keys is equal to the STORED_VAR MACRO, then the stored param are already initialized woh the proper format*/
+          if ((storedVarVersion == STORED_VAR_BLOB_VERSION) && g_pref.isKey("user_param")) /* Stored by a previous SW in a single key: convert it */
           {
-            g_pref.getBytes("user_param", &g_storedVar, sizeof(g_storedVar)); /* Get the value of the stored user_param */
-            initMenuItems();                                                  /* init menu items with EEPROM stored variables */
+            storedVarVersion = migrateStoredVarBlob() ? STORED_VAR_VERSION : storedVarVersion;
+          }
+
+          if ((storedVarVersion == STORED_VAR_VERSION) && g_pref.isKey(STORAGE_KEY_SYS)) /* If the storedVariable version keys is equal to the STORED_VAR MACRO, then the stored param are already initialized woh the proper format*/
+          {
+            /* Fast boot: read only the selection, the calibration and the selected car, and let the control tick drive the motor.
+               The other cars, display, encoder and sound come after */
+            Storage_LoadRecord(CAR_MAX_COUNT);
+            if (g_storedVar.selectedCarNumber >= CAR_MAX_COUNT)
+            {
+              g_storedVar.selectedCarNumber = 0;
+            }
+            g_carSel = g_storedVar.selectedCarNumber; /* now it is safe to address the proper car */
+            Storage_LoadRecord(g_carSel);
+            g_bootStats.paramsLoaded_uS = (uint32_t)esp_timer_get_time();
+
+            if (digitalRead(ENCODER_BUTTON_PIN) != BUTTON_PRESSED)
+            {
+              updateControlParams();
+              updatePwmFreq();
+              updateTriggerFilter();
+              g_bootStats.motorReady_uS = (uint32_t)esp_timer_get_time();
+              g_currState = WELCOME;    /* From here the control tick drives the motor */
+            }
+
+            Storage_Load(); /* Get the value of the other stored cars */
 
             /* If button is pressed at startup, go to CALIBRATION state */
-            if (digitalRead(ENCODER_BUTTON_PIN) == BUTTON_PRESSED) 
+            if (g_currState == INIT) 
             {
               g_currState = CALIBRATION;      /* Go to CALIBRATION state */
               /* Reset Min and Max to the opposite side, in order to have effective calibration */
@@ -181,13 +264,14 @@ void Task1code(void *pvParameters)
               }
               
               obdFill(&g_obd, OBD_WHITE, 1); /* Clear OLED */
+              Screen_Invalidate();
             }
-            else  /* If button is NOT pressed at startup, go to RUNNING state */
+            else  /* If button is NOT pressed at startup, the motor is already running: bring up the UI */
             {
-              g_currState = WELCOME;                    /* Go to WELCOME state */
-              g_carSel = g_storedVar.selectedCarNumber; /* now it is safe to address the proper car */
               initDisplayAndEncoder();  /* init and clear OLED and Encoder */
               onSound();                /* Play ON sound */
+              g_bootStats.uiReady_uS = (uint32_t)esp_timer_get_time();
+              printBootStats();
             }
 
             g_pref.end(); /* Close the namespace */
@@ -203,6 +287,7 @@ void Task1code(void *pvParameters)
         initDisplayAndEncoder();  /* init and clear OLED and Encoder */
                               
         g_pref.clear();           /* Clear all the keys in this namespace */
+        Storage_Invalidate();     /* The records are no longer in the NVS */
         /* Store the correct SW version */
         g_pref.putUChar("sw_maj_ver", SW_MAJOR_VERSION);
         g_pref.putUChar("sw_min_ver", SW_MINOR_VERSION);
@@ -217,6 +302,7 @@ void Task1code(void *pvParameters)
         calibSound();                   /* Play calibration sound */
         g_currState = CALIBRATION;      /* Go to CALIBRATION state */
         obdFill(&g_obd, OBD_WHITE, 1); /* Clear OLED */
+        Screen_Invalidate();
         /* Press and release button to go to CALIBRATION state */
         while (!g_rotaryEncoder.isEncoderButtonClicked()) /* Loop until button is pressed */
         {
@@ -234,8 +320,7 @@ void Task1code(void *pvParameters)
         if (g_rotaryEncoder.isEncoderButtonClicked())  /* exit calibration and save calibration data to EEPROM */
         {
           offSound();
-          initMenuItems();  /* Init Menu Items */
-          saveEEPROM(g_storedVar);  /* Save modified calibration values to EEPROM */
+          Storage_Flush();        /* Save modified calibration values to EEPROM, now */
           HalfBridge_Enable();    /* Enable HalfBridge */
           g_currState = WELCOME;  /* Go to WELCOME state */
         }
@@ -250,14 +335,63 @@ void Task1code(void *pvParameters)
 
           The user trigger input is being elaborated and the correct speed (PWM) output is being produced for the whole duration of the WELCOME state */
 
-        showScreenWelcome();    /* Show welcome screen */
-        delay(1500);            /* Wait one second */
-        g_currState = RUNNING;  /* Go to RUNNING state */
+        if (welcomeSince_ms == 0)
+        {
+          showScreenWelcome();  /* Show welcome screen */
+          welcomeSince_ms = millis();
+        }
+        else if (millis() - welcomeSince_ms >= WELCOME_SCREEN_MS)  /* Not blocking: Task1 keeps serving the storage and the serial port */
+        {
+          g_currState = RUNNING;  /* Go to RUNNING state */
+        }
         break;
 
 
       case RUNNING: /* when the global variable State is in RUNNING the Task2 will elaborate the trigger to produce the PWM out */
 
+        /* Open the hidden diagnostics page if the encoder button is held down long enough in the main menu */
+        if ((menuState == ITEM_SELECTION) && (digitalRead(ENCODER_BUTTON_PIN) == BUTTON_PRESSED))
+        {
+          if (buttonPressedSince == 0)
+          {
+            buttonPressedSince = millis();
+          }
+          else if (millis() - buttonPressedSince > DIAG_LONG_PRESS_MS)
+          {
+            showDiagnostics();
+            buttonPressedSince = 0;
+            g_lastEncoderInteraction = millis();  /* Redraw the menu */
+          }
+        }
+        else
+        {
+          buttonPressedSince = 0;
+        }
+
+        /* Serial commands: 'd' dumps the diagnostics, 'r' resets the profiler, 't' starts/stops the telemetry stream,
+           'w' rewrites all the NVS records now (to check that the control tick keeps its deadline during flash writes) */
+        if (Serial.available())
+        {
+          switch (Serial.read())
+          {
+            case 'd':
+              diagSerialDump();
+              break;
+            case 'r':
+              Profiler_RequestReset();
+              break;
+            case 't':
+              g_telemetryStream = !g_telemetryStream;
+              break;
+            case 'w':
+              Storage_Invalidate();
+              Storage_Flush();
+              break;
+            default:
+              break;
+          }
+        }
+
         /* Change menu state if encoder button is clicked */
         if (g_rotaryEncoder.isEncoderButtonClicked()) 
         {
@@ -286,15 +420,7 @@ void Task1code(void *pvParameters)
 
         /* Show Main Menu display */
         printMainMenu(menuState);
-        if (g_storedVar.carParam[g_carSel].freqPWM != prevFreqPWM)  /* if PWM freq parameter is changed, update motor PWM */
-        {
-          prevFreqPWM = g_storedVar.carParam[g_carSel].freqPWM;
-          ledcDetach(HB_IN_PIN);
-          ledcDetach(HB_INH_PIN);
-          uint16_t freqTmp = g_storedVar.carParam[g_carSel].freqPWM * 100;
-          ledcAttachChannel(HB_IN_PIN, freqTmp, THR_PWM_RES_BIT, THR_IN_PWM_CHAN);
-          ledcAttachChannel(HB_INH_PIN, freqTmp, THR_PWM_RES_BIT, THR_INH_PWM_CHAN);
-        }
+        Screen_Flush();   /* Send only what changed to the OLED */
         if (g_escVar.outputSpeed_pct == 100) /* indicate 100% throttle also on the internal ESP32 LED*/
           digitalWrite(LED_BUILTIN, 1);
         else
@@ -312,55 +438,197 @@ void Task1code(void *pvParameters)
         break;
     }
 
+    if (g_currState != INIT)  /* Rebuild the precomputed control parameters if the user changed the car or its parameters */
+    {
+      updateControlParams();
+      updatePwmFreq();
+      updateTriggerFilter();
+      Storage_Service();      /* Write the saved changes, once the user stopped changing things */
+    }
+
     if (g_currState != prevState) /* Every time FSM machine change state */
+    {
       obdFill(&g_obd, OBD_WHITE, 1);
+      Screen_Invalidate();
+    }
   }
 }
 
 /**
- * Task 2 performs trigger reading, trigger conditioning and set output PWM
+ * Task 2 starts the trigger acquisition and the control tick on core 1, then it is deleted.
+ * The control tick runs in the control timer ISR every ESC_PERIOD_US, allocated in IRAM: NVS writes disable the flash cache
+ * and stop all the tasks for some ms, the IRAM ISR (and so trigger conditioning and PWM output) keeps running.
  */
 void Task2code(void *pvParameters) {
-  static unsigned long prevCallTime_uS = 0, deltaTime_uS, currCallTime_uS;  /* Used to keep track of time between executions */
-  static unsigned long currTrigger_raw = 0, prevTrigger_raw = 0;            /* Used to keep track of current and previous trigger readings */
-
   HalfBridge_Enable();  /* TODO: verify if needed */
+  HAL_StartTriggerSampler(TRIG_SAMPLE_PERIOD_US);     /* Trigger acquisition task, on core 1 as well */
+  HAL_StartControlTimer(ESC_PERIOD_US, controlTick);  /* Started from here, so the timer ISR runs on the same core */
 
-  for (;;) 
+  vTaskDelete(NULL);
+}
+
+
+/**
+ * Control tick: trigger conditioning and PWM output. Called by the control timer ISR every ESC_PERIOD_US.
+ * The trigger is read by the acquisition task (HAL_StartTriggerSampler), here the newest sample is only copied.
+ * It also runs while the flash cache is disabled: everything called from here must be IRAM_ATTR (or inline / ROM)
+ * and use only RAM data. A flash access would stop the CPU with a "Cache disabled but cached memory region accessed" panic,
+ * so a flashOpTickCount growing (serial 'w' command) without a reset proves there is none.
+ */
+void IRAM_ATTR controlTick()
+{
+  static uint32_t prevCallTime_uS = 0;                                      /* Used to keep track of time between executions */
+  static uint32_t prevTriggerSeq = 0;                                       /* Sequence number of the trigger sample used in the previous tick */
+  static uint16_t trigGate_q16 = 0;                                         /* Trigger noise gate state */
+  uint32_t now_uS = (uint32_t)esp_timer_get_time();                         /* micros() is not IRAM */
+  BaseType_t higherPrioTaskWoken = pdFALSE;
+  TriggerSample_type trigSample;
+
+  uint32_t tickStart_cyc = Prof_Now(), stageStart_cyc;  /* CPU cycle counter at start of tick and of each stage, for profiling */
+  const ControlParam_type *param;                       /* Parameters used for the whole tick */
+  uint16_t ctrlTrigger_q16;                             /* Trigger position used by the pipeline, with the lead on snaps */
+  int16_t motorCurrent_mA;                              /* Motor current averaged over the PWM period, read once for the traction control and the telemetry */
+  int16_t motorOnCurrent_mA;                            /* Motor current in the PWM on-phase (bridge current), for the current limiter */
+  TelemetrySample_type telemetry;
+
+  updateTickStats(now_uS - prevCallTime_uS);
+  prevCallTime_uS = now_uS;
+  if (!spi_flash_cache_enabled())
   {
-    currCallTime_uS = micros();                         /* Get current time in uS */
-    deltaTime_uS = currCallTime_uS - prevCallTime_uS;   /* Calculate delta time between current and previous execution */
-    
-    if (deltaTime_uS > ESC_PERIOD_US) /* This condition ensure that the following code is executed every ESC_PERIOD_US */
+    g_tickStats.flashOpTickCount++;
+  }
+
+  /* Take the parameters snapshot: a car switch or a parameter change applies from a tick boundary */
+  param = __atomic_load_n(&g_ctrlParamActive, __ATOMIC_ACQUIRE);
+  __atomic_store_n(&g_ctrlParamInUse, param, __ATOMIC_RELEASE);
+
+  /* Trigger reading (filtered by the acquisition task) and first conditioning (normalize, deadband, noise gate) */
+  stageStart_cyc = Prof_Now();
+  HAL_GetTriggerSample(&trigSample);  /* Take the newest trigger sample from the acquisition task, no waiting on the I2C bus */
+  Profiler_Record(PROF_STAGE_GET_TRIGGER, stageStart_cyc);
+  if (trigSample.seq == prevTriggerSeq)   /* No new sample since last tick (sensor errors): go on with the last one */
+  {
+    g_tickStats.staleTriggerCount++;
+  }
+  prevTriggerSeq = trigSample.seq;
+  g_escVar.trigger_raw  = trigSample.filtered;   /* Filter selected by the FILT parameter of the car, see updateTriggerFilter() */
+  stageStart_cyc = Prof_Now();
+  g_escVar.trigger_q16 = Throttle_NormalizeQ16(g_escVar.trigger_raw, param->minTrigger_raw, param->maxTrigger_raw, THROTTLE_REV);  /* Get Raw trigger position and return throttle between 0 and THROTTLE_Q16_MAX */
+  Profiler_Record(PROF_STAGE_NORMALIZE, stageStart_cyc);
+  stageStart_cyc = Prof_Now();
+  g_escVar.trigger_q16 = Throttle_DeadBandQ16(g_escVar.trigger_q16, THROTTLE_DEADBAND_Q16); /* Account for deadband */
+  g_escVar.trigger_q16 = Throttle_NoiseGateQ16(&trigGate_q16, g_escVar.trigger_q16, THROTTLE_NOISE_Q16); /* Still trigger: keep the output (and the PWM registers) still */
+  Profiler_Record(PROF_STAGE_DEADBAND, stageStart_cyc);
+
+  /* Trigger velocity, and the position moved ahead along it on snaps (LEAD of the car, 0 is OFF): brake and throttle come earlier */
+  Throttle_EstimatorStep(&g_trigEstimator, g_escVar.trigger_q16);
+  g_escVar.triggerVel_q16 = Throttle_EstimatorVelocity(&g_trigEstimator);
+  ctrlTrigger_q16 = Throttle_EstimatorLead(&g_trigEstimator, g_escVar.trigger_q16, param->triggerLeadQ8);
+
+  /* Motor speed estimation, from the back EMF measured by the acquisition task */
+  g_escVar.motorBemf_mV = HAL_GetMotorBemf_mV();
+  g_escVar.motorSpeed_pml = Bemf_SpeedPermille(g_escVar.motorBemf_mV, g_escVar.Vin_mV);
+  motorCurrent_mA = HAL_GetMotorCurrent_mA();
+  motorOnCurrent_mA = HAL_GetMotorOnCurrent_mA();
+  
+  /* Check isf allowed to provide power  to the motor*/
+  if (!(g_currState == CALIBRATION || g_currState == INIT))           /* Do not apply power if in calibration or before initialization (TODO: would be better to have also variables init) */
+  {
+    if (g_bootStats.firstPwm_uS == 0)
     {
-      prevCallTime_uS = currCallTime_uS;                              /* update last call static memory */
-
-      /* Trigger reading and first conditioning (filtering, normalize, deadband) */
-      prevTrigger_raw = currTrigger_raw;
-      currTrigger_raw = HAL_ReadTriggerRaw();  /* Read raw trigger value */
-      g_escVar.trigger_raw  = (prevTrigger_raw + currTrigger_raw) / 2;   /* Take the average between current and previous trigger readings --> attenuate disturbs */
-      g_escVar.trigger_norm = normalizeAndClamp(g_escVar.trigger_raw, g_storedVar.minTrigger_raw, g_storedVar.maxTrigger_raw, THROTTLE_NORMALIZED, THROTTLE_REV);  /* Get Raw trigger position and return throttle between 0 and THROTTLE_NORMALIZED */
-      g_escVar.trigger_norm = addDeadBand(g_escVar.trigger_norm, 0, THROTTLE_NORMALIZED, THROTTLE_DEADBAND_NORM); /* Account for deadband */
-      
-      /* Check isf allowed to provide power  to the motor*/
-      if (!(g_currState == CALIBRATION || g_currState == INIT))           /* Do not apply power if in calibration or before initialization (TODO: would be better to have also variables init) */
-      {
-        if (g_escVar.trigger_norm == 0)                                   /* If the trigger is at 0 */
-        {
-          HalfBridge_SetPwmDrag(0, g_storedVar.carParam[g_carSel].brake); /* Apply brake only (and speed to 0) in case speed set is 0 */
-          g_escVar.outputSpeed_pct=0; // set outputSpeed_pct to 0 so the ramp starts from a 0 value after a brake
-          throttleAntiSpin3(0);       // keep on calling antispin with 0 as input to keep ramp delta time updated
-        }
-        else                                                              /* If the requested speed is > 0 */
-        {
-          /* Throttle -> Speed pipeline , perform time dependent adjustment */
-          g_escVar.outputSpeed_pct   = throttleCurve2(g_escVar.trigger_norm );   /* Map trigger(throttle) to speed (duty) */
-          g_escVar.outputSpeed_pct   = throttleAntiSpin3(g_escVar.outputSpeed_pct); /* Define actual speed output (apply antispin) */
-          HalfBridge_SetPwmDrag(g_escVar.outputSpeed_pct, 0);         /* Apply output speed (duty) */
-        }
-      }
+      g_bootStats.firstPwm_uS = now_uS;
     }
+    if (ctrlTrigger_q16 == 0)                                         /* If the trigger is at 0 */
+    {
+      stageStart_cyc = Prof_Now();
+      HalfBridge_SetPwmDragQ16(0, param->brakeQ16); /* Apply brake only (and speed to 0) in case speed set is 0 */
+      Profiler_Record(PROF_STAGE_SET_PWM, stageStart_cyc);
+      g_escVar.outputSpeed_q16 = 0; // set outputSpeed to 0 so the ramp starts from a 0 value after a brake
+      stageStart_cyc = Prof_Now();
+      throttleAntiSpin3(param, 0);  // keep on calling antispin with 0 as input to keep ramp delta time updated
+      Traction_Reset(&g_traction);  // next press starts with no trim
+      CurrLimit_Step(&g_currLimit, param->currentLimit_mA, 0, motorOnCurrent_mA);  // keep on tracking the current (limit events, recovery)
+      Profiler_Record(PROF_STAGE_ANTISPIN, stageStart_cyc);
+    }
+    else                                                              /* If the requested speed is > 0 */
+    {
+      /* Throttle -> Speed pipeline , perform time dependent adjustment */
+      stageStart_cyc = Prof_Now();
+      g_escVar.outputSpeed_q16   = throttleCurve2(param, ctrlTrigger_q16);         /* Map trigger(throttle) to speed (duty) */
+      Profiler_Record(PROF_STAGE_CURVE, stageStart_cyc);
+      stageStart_cyc = Prof_Now();
+      g_escVar.outputSpeed_q16   = throttleAntiSpin3(param, g_escVar.outputSpeed_q16); /* Define actual speed output (apply antispin) */
+      g_escVar.outputSpeed_q16   = Traction_Step(&g_traction, param->tractionDropQ16, g_escVar.outputSpeed_q16, motorCurrent_mA); /* Trim on wheel spin (TRAC of the car, 0 is OFF) */
+      Profiler_Record(PROF_STAGE_ANTISPIN, stageStart_cyc);
+      stageStart_cyc = Prof_Now();
+      g_escVar.outputSpeed_q16   = CurrLimit_Step(&g_currLimit, param->currentLimit_mA, g_escVar.outputSpeed_q16, motorOnCurrent_mA); /* Cut above ILIM of the car (0 is OFF) */
+      HalfBridge_SetPwmDragQ16(g_escVar.outputSpeed_q16, 0);      /* Apply output speed (duty) */
+      Profiler_Record(PROF_STAGE_SET_PWM, stageStart_cyc);
+    }
+    g_escVar.outputSpeed_pct = THROTTLE_Q16_TO_PCT(g_escVar.outputSpeed_q16);  /* For the display only */
+    g_escVar.tractionTrim_q16 = g_traction.trimQ16;
+    g_escVar.currLimit_q16 = g_currLimit.scaleQ16;
+    g_escVar.currLimited = g_currLimit.limiting;
+  }
+
+  /* Stream the tick to Task1 */
+  telemetry.timestamp_uS = now_uS;
+  telemetry.trigger_raw = g_escVar.trigger_raw;
+  telemetry.trigger_q16 = g_escVar.trigger_q16;
+  telemetry.triggerVel_q16 = g_escVar.triggerVel_q16;
+  telemetry.tractionTrim_q16 = g_escVar.tractionTrim_q16;
+  telemetry.currLimit_q16 = g_escVar.currLimit_q16;
+  telemetry.currLimited = g_escVar.currLimited;
+  telemetry.outputSpeed_q16 = g_escVar.outputSpeed_q16;
+  telemetry.Vin_mV = g_escVar.Vin_mV;
+  telemetry.motorCurrent_mA = motorCurrent_mA;
+  telemetry.motorBemf_mV = g_escVar.motorBemf_mV;
+  Telemetry_Push(&telemetry);
+  if ((Telemetry_Pending() == TELEMETRY_RING_SIZE / 2) && (Task1 != NULL))  /* Task1 is late: wake it up before the ring fills */
+  {
+    xTaskNotifyFromISR(Task1, UI_EVT_TELEMETRY, eSetBits, &higherPrioTaskWoken);
   }
+
+  Profiler_Record(PROF_STAGE_TICK, tickStart_cyc);
+  portYIELD_FROM_ISR(higherPrioTaskWoken);
+}
+
+
+/**
+ * Update the control tick timing statistics (jitter histogram, stalls, overruns). Called by the control tick (IRAM).
+ * 
+ * @param period_uS [uS] Measured time between the current and the previous tick
+ */
+void IRAM_ATTR updateTickStats(uint32_t period_uS)
+{
+  uint32_t jitter_uS, bin;
+
+  if (g_tickStats.tickCount++ == 0)   /* First tick: the period is not meaningful yet */
+  {
+    return;
+  }
+
+  if (period_uS >= ESC_PERIOD_US + ESC_PERIOD_US / 2)  /* Alarms that were not served (e.g. interrupts disabled) */
+  {
+    g_tickStats.missedCount += (period_uS + ESC_PERIOD_US / 2) / ESC_PERIOD_US - 1;
+  }
+
+  jitter_uS = (period_uS > ESC_PERIOD_US) ? (period_uS - ESC_PERIOD_US) : (ESC_PERIOD_US - period_uS);
+  if (jitter_uS > g_tickStats.maxJitter_uS)
+  {
+    g_tickStats.maxJitter_uS = jitter_uS;
+  }
+  if ((period_uS > ESC_PERIOD_US) && (jitter_uS > TICK_STALL_US))
+  {
+    g_tickStats.stallCount++;
+  }
+
+  bin = jitter_uS / TICK_JITTER_BIN_US;
+  if (bin >= TICK_JITTER_BINS)
+  {
+    bin = TICK_JITTER_BINS - 1;
+  }
+  g_tickStats.jitterHist[bin]++;
 }
 
 
@@ -384,6 +652,7 @@ void initDisplayAndEncoder()
   {
     obdSetBackBuffer(&g_obd, ucBackBuffer);
     obdFill(&g_obd, OBD_WHITE, 1);
+    Screen_Init(&g_obd, ucBackBuffer);
   } 
   else 
   {
@@ -393,6 +662,7 @@ void initDisplayAndEncoder()
   /***** Encoder Setup *****/
   g_rotaryEncoder.begin();
   g_rotaryEncoder.setup(readEncoderISR);
+  attachInterrupt(digitalPinToInterrupt(ENCODER_BUTTON_PIN), buttonISR, CHANGE);
   g_rotaryEncoder.setBoundaries(1, MENU_ITEMS_COUNT, false); /* minValue, maxValue, circleValues true|false (when max go to min and vice versa) */
   g_rotaryEncoder.setAcceleration(MENU_ACCELERATION);        /* Larger number = more accelearation; 0 or 1 means disabled acceleration */
 }
@@ -400,7 +670,115 @@ void initDisplayAndEncoder()
 
 /* Rotary Encoder ISR */
 void IRAM_ATTR readEncoderISR() {
+  BaseType_t higherPrioTaskWoken = pdFALSE;
+
   g_rotaryEncoder.readEncoder_ISR();
+  if (Task1 != NULL)
+  {
+    xTaskNotifyFromISR(Task1, UI_EVT_ENCODER, eSetBits, &higherPrioTaskWoken);  /* Wake up Task1 */
+    portYIELD_FROM_ISR(higherPrioTaskWoken);
+  }
+}
+
+
+/* Encoder button ISR, both edges: Task1 handles clicks and long presses as soon as they happen, not at the next UI_EVT_TIMER */
+void IRAM_ATTR buttonISR() {
+  BaseType_t higherPrioTaskWoken = pdFALSE;
+
+  if ((Task1 != NULL) && (g_buttonTimer != NULL))
+  {
+    if (digitalRead(ENCODER_BUTTON_PIN) == BUTTON_PRESSED)
+    {
+      xTimerResetFromISR(g_buttonTimer, &higherPrioTaskWoken);  /* Long press check */
+    }
+    else
+    {
+      xTimerStopFromISR(g_buttonTimer, &higherPrioTaskWoken);
+    }
+    xTaskNotifyFromISR(Task1, UI_EVT_BUTTON, eSetBits, &higherPrioTaskWoken);  /* Wake up Task1 */
+    portYIELD_FROM_ISR(higherPrioTaskWoken);
+  }
+}
+
+
+/* UI timer callback (timer service task): periodic wake up of Task1 */
+void uiTimerCallback(TimerHandle_t timer)
+{
+  xTaskNotify(Task1, UI_EVT_TIMER, eSetBits);
+}
+
+
+/* Button timer callback (timer service task): the button is still held DIAG_LONG_PRESS_MS after the press */
+void buttonTimerCallback(TimerHandle_t timer)
+{
+  xTaskNotify(Task1, UI_EVT_BUTTON, eSetBits);
+}
+
+
+/**
+ * Block Task1 until the next event: encoder rotation, encoder button, UI_PERIOD_MS timer, or telemetry ring half full.
+ * Every wait ends draining the telemetry ring, so also the menus that loop on their own keep it empty.
+ * 
+ * @return The UI_EVT_* bits received
+ */
+uint32_t waitUiEvent()
+{
+  uint32_t events = 0;
+
+  xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+  drainTelemetry();
+
+  return events;
+}
+
+
+/**
+ * Set the NVS records of the stored variables: one key per car ("car0".."car9") and STORAGE_KEY_SYS for
+   the selected car and the calibration. The records stay open for the whole run.
+ */
+void initStorage() {
+  static char carKey[CAR_MAX_COUNT][8];
+
+  for (int i = 0; i < CAR_MAX_COUNT; i++) {
+    sprintf(carKey[i], "car%d", i);
+    g_storageRecords[i] = { carKey[i], &g_storedVar.carParam[i], sizeof(CarParam_type) };
+  }
+  g_storageRecords[CAR_MAX_COUNT] = { STORAGE_KEY_SYS, &g_storedVar.selectedCarNumber, sizeof(StoredVar_type) - offsetof(StoredVar_type, selectedCarNumber) };
+
+  Storage_Begin("stored_var", g_storageRecords, CAR_MAX_COUNT + 1);
+}
+
+
+/**
+ * Convert the single "user_param" blob of STORED_VAR_BLOB_VERSION to the per car records.
+   The size of a car in the blob is found from the blob length, so the conversion still works once CarParam_type grows
+   (the new fields keep their defaults). The blob is removed only once the records and the new version are written.
+ * 
+ * @return true if converted
+ */
+bool migrateStoredVarBlob() {
+  size_t len = g_pref.getBytesLength("user_param");
+  size_t carSize = (len > STORED_VAR_BLOB_TAIL) ? (len - STORED_VAR_BLOB_TAIL) / CAR_MAX_COUNT : 0;
+  uint8_t *blob;
+
+  if ((carSize == 0) || (carSize * CAR_MAX_COUNT + STORED_VAR_BLOB_TAIL != len) || ((blob = (uint8_t *)malloc(len)) == NULL))
+  {
+    return false;
+  }
+
+  g_pref.getBytes("user_param", blob, len);
+  for (int i = 0; i < CAR_MAX_COUNT; i++) {
+    memcpy(&g_storedVar.carParam[i], &blob[i * carSize], min(carSize, sizeof(CarParam_type)));
+  }
+  memcpy(&g_storedVar.selectedCarNumber, &blob[CAR_MAX_COUNT * carSize], STORED_VAR_BLOB_TAIL);
+  free(blob);
+
+  Storage_Invalidate();
+  Storage_Flush();
+  g_pref.putUChar("stored_var_ver", STORED_VAR_VERSION);
+  g_pref.remove("user_param");
+
+  return true;
 }
 
 
@@ -417,6 +795,10 @@ void initStoredVariables() {
     g_storedVar.carParam[i].throttleCurveVertex = { THROTTLE_CURVE_INPUT_THROTTLE_DEFAULT, THROTTLE_CURVE_SPEED_DIFF_DEFAULT };
     g_storedVar.carParam[i].antiSpin = ANTISPIN_DEFAULT;
     g_storedVar.carParam[i].freqPWM = PWM_FREQ_DEFAULT;
+    g_storedVar.carParam[i].trigFilter = TRIG_FILTER_DEFAULT;
+    g_storedVar.carParam[i].trigLead = TRIG_LEAD_DEFAULT;
+    g_storedVar.carParam[i].tracLevel = TRACTION_DEFAULT;
+    g_storedVar.carParam[i].currLimit = CURR_LIMIT_DEFAULT;
     g_storedVar.carParam[i].carNumber = i;
     sprintf(g_storedVar.carParam[i].carName, "CAR%1d", i);
   }
@@ -427,79 +809,68 @@ void initStoredVariables() {
 
 
 /**
- * Initialize the menu items with the value from the stored variables.
-   Insert the items one by one in the main menu global instance.
-   Then insert the items (cars) in the car menu.
-   To add an item:
-    - update the value of MENU_ITEMS_COUNT to match the amount of items in the menu.
-    - update MAX_ITEMS so that it is greater or equal MENU_ITEMS_COUNT.
-    - Add the item here, in the desired position (check the comment in slot_ESC.h MenuItem_type to know more).
+ * SENSI can not go above LIMIT
+ */
+static void sensiBounds(const CarParam_type *car, uint16_t *minValue, uint16_t *maxValue)
+{
+  *maxValue = min((uint16_t)MIN_SPEED_MAX_VALUE, car->maxSpeed);
+}
+
+
+/**
+ * LIMIT must stay 5% above SENSI
  */
-void initMenuItems() {
-  int i = 0;
-  /* Init menu items */
-
-  sprintf(g_mainMenu.item[i].name, "BRAKE");
-  g_mainMenu.item[i].value = (void *)&g_storedVar.carParam[g_carSel].brake;
-  g_mainMenu.item[i].type = VALUE_TYPE_INTEGER;
-  g_mainMenu.item[i].unit = '%';
-  g_mainMenu.item[i].maxValue = BRAKE_MAX_VALUE;
-  g_mainMenu.item[i].minValue = 0;
-  g_mainMenu.item[i].callback = ITEM_NO_CALLBACK;
-
-  sprintf(g_mainMenu.item[++i].name, "SENSI");
-  g_mainMenu.item[i].value = (void *)&g_storedVar.carParam[g_carSel].minSpeed;
-  g_mainMenu.item[i].type = VALUE_TYPE_INTEGER;
-  g_mainMenu.item[i].unit = '%';
-  g_mainMenu.item[i].maxValue = min(MIN_SPEED_MAX_VALUE, (int)g_storedVar.carParam[g_carSel].maxSpeed);
-  g_mainMenu.item[i].minValue = 0;
-  g_mainMenu.item[i].callback = ITEM_NO_CALLBACK;
-
-  sprintf(g_mainMenu.item[++i].name, "ANTIS");
-  g_mainMenu.item[i].value = (void *)&g_storedVar.carParam[g_carSel].antiSpin;
-  g_mainMenu.item[i].type = VALUE_TYPE_INTEGER;
-  g_mainMenu.item[i].unit = 'm';
-  g_mainMenu.item[i].maxValue = ANTISPIN_MAX_VALUE;
-  g_mainMenu.item[i].minValue = 0;
-  g_mainMenu.item[i].callback = ITEM_NO_CALLBACK;
-
-  sprintf(g_mainMenu.item[++i].name, "CURVE");
-  g_mainMenu.item[i].value = (void *)&g_storedVar.carParam[g_carSel].throttleCurveVertex.curveSpeedDiff;
-  g_mainMenu.item[i].type = VALUE_TYPE_INTEGER;
-  g_mainMenu.item[i].unit = '%';
-  g_mainMenu.item[i].maxValue = THROTTLE_CURVE_SPEED_DIFF_MAX_VALUE;
-  g_mainMenu.item[i].minValue = THROTTLE_CURVE_SPEED_DIFF_MIN_VALUE;
-  g_mainMenu.item[i].callback = &showCurveSelection;
-
-  sprintf(g_mainMenu.item[++i].name, "PWM_F");
-  g_mainMenu.item[i].value = (void *)&g_storedVar.carParam[g_carSel].freqPWM;
-  g_mainMenu.item[i].type = VALUE_TYPE_DECIMAL;
-  g_mainMenu.item[i].unit = 'k';
-  g_mainMenu.item[i].maxValue = FREQ_MAX_VALUE / 100;
-  g_mainMenu.item[i].minValue = FREQ_MIN_VALUE / 100;
-  g_mainMenu.item[i].decimalPoint = 1;
-  g_mainMenu.item[i].callback = ITEM_NO_CALLBACK;
-
-  sprintf(g_mainMenu.item[++i].name, "LIMIT");
-  g_mainMenu.item[i].value = (void *)&g_storedVar.carParam[g_carSel].maxSpeed;
-  g_mainMenu.item[i].type = VALUE_TYPE_INTEGER;
-  g_mainMenu.item[i].unit = '%';
-  g_mainMenu.item[i].maxValue = MAX_SPEED_DEFAULT;
-  g_mainMenu.item[i].minValue = max(5, (int)g_storedVar.carParam[g_carSel].minSpeed + 5);
-  g_mainMenu.item[i].callback = ITEM_NO_CALLBACK;
-
-  sprintf(g_mainMenu.item[++i].name, "*CAR*");
-  g_mainMenu.item[i].value = (void *)&g_storedVar.carParam[g_carSel].carName;
-  g_mainMenu.item[i].type = VALUE_TYPE_STRING;
-  g_mainMenu.item[i].maxValue = CAR_MAX_COUNT - 1;  // so menu will scroll in the array (CAR_MAX_COUNT long)
-  g_mainMenu.item[i].minValue = 0;
-  g_mainMenu.item[i].callback = &showSelectRenameCar;
-
-  /* Init Car selection menu items */
-  for (uint8_t j = 0; j < CAR_MAX_COUNT; j++)
+static void limitBounds(const CarParam_type *car, uint16_t *minValue, uint16_t *maxValue)
+{
+  *minValue = max(5, (int)car->minSpeed + 5);
+}
+
+
+/* Main menu items table. The values are parameters of the selected car, the bounds that depend on other parameters
+   are computed only when the item is selected (see menuItemBounds()) */
+const MenuItem_type g_mainMenuItems[MENU_ITEMS_COUNT] = {
+  /* name     valueOffset                                                                 type                 maxValue                             minValue                              unit  dec  callback               bounds        */
+  { "BRAKE",  offsetof(CarParam_type, brake),                                             VALUE_TYPE_INTEGER,  BRAKE_MAX_VALUE,                     0,                                    '%',  0,   ITEM_NO_CALLBACK,      ITEM_NO_BOUNDS },
+  { "SENSI",  offsetof(CarParam_type, minSpeed),                                          VALUE_TYPE_INTEGER,  MIN_SPEED_MAX_VALUE,                 0,                                    '%',  0,   ITEM_NO_CALLBACK,      sensiBounds    },
+  { "ANTIS",  offsetof(CarParam_type, antiSpin),                                          VALUE_TYPE_INTEGER,  ANTISPIN_MAX_VALUE,                  0,                                    'm',  0,   ITEM_NO_CALLBACK,      ITEM_NO_BOUNDS },
+  { "CURVE",  offsetof(CarParam_type, throttleCurveVertex) + offsetof(ThrottleCurveVertex_type, curveSpeedDiff),
+                                                                                          VALUE_TYPE_INTEGER,  THROTTLE_CURVE_SPEED_DIFF_MAX_VALUE, THROTTLE_CURVE_SPEED_DIFF_MIN_VALUE,  '%',  0,   &showCurveSelection,   ITEM_NO_BOUNDS },
+  { "PWM_F",  offsetof(CarParam_type, freqPWM),                                           VALUE_TYPE_DECIMAL,  FREQ_MAX_VALUE / 100,                FREQ_MIN_VALUE / 100,                 'k',  1,   ITEM_NO_CALLBACK,      ITEM_NO_BOUNDS },
+  { "LIMIT",  offsetof(CarParam_type, maxSpeed),                                          VALUE_TYPE_INTEGER,  MAX_SPEED_DEFAULT,                   5,                                    '%',  0,   ITEM_NO_CALLBACK,      limitBounds    },
+  { "FILT",   offsetof(CarParam_type, trigFilter),                                        VALUE_TYPE_INTEGER,  TRIG_FILTER_COUNT - 1,               0,                                    ' ',  0,   ITEM_NO_CALLBACK,      ITEM_NO_BOUNDS },
+  { "LEAD",   offsetof(CarParam_type, trigLead),                                          VALUE_TYPE_DECIMAL,  TRIG_LEAD_MAX_VALUE,                 0,                                    'm',  1,   ITEM_NO_CALLBACK,      ITEM_NO_BOUNDS },
+  { "TRAC",   offsetof(CarParam_type, tracLevel),                                         VALUE_TYPE_INTEGER,  TRACTION_LEVEL_MAX,                  0,                                    ' ',  0,   ITEM_NO_CALLBACK,      ITEM_NO_BOUNDS },
+  { "ILIM",   offsetof(CarParam_type, currLimit),                                         VALUE_TYPE_DECIMAL,  CURR_LIMIT_MAX_VALUE,                0,                                    'A',  1,   ITEM_NO_CALLBACK,      ITEM_NO_BOUNDS },
+  { "*CAR*",  offsetof(CarParam_type, carName),                                           VALUE_TYPE_STRING,   CAR_MAX_COUNT - 1,                   0,                                    ' ',  0,   &showSelectRenameCar,  ITEM_NO_BOUNDS },
+};
+
+
+/**
+ * Resolve the value of a menu item on the selected car.
+ * 
+ * @param item The menu item
+ * @return Pointer to the value of the item in g_storedVar.carParam[g_carSel]
+ */
+void *menuItemValue(const MenuItem_type *item)
+{
+  return (uint8_t *)&g_storedVar.carParam[g_carSel] + item->valueOffset;
+}
+
+
+/**
+ * Get the min and max values of a menu item for the selected car.
+ * 
+ * @param item The menu item
+ * @param minValue [out] Min value
+ * @param maxValue [out] Max value
+ */
+void menuItemBounds(const MenuItem_type *item, uint16_t *minValue, uint16_t *maxValue)
+{
+  *minValue = item->minValue;
+  *maxValue = item->maxValue;
+  if (item->bounds != ITEM_NO_BOUNDS)
   {
-    sprintf(g_carMenu.item[j].name, (const char *)g_storedVar.carParam[j].carName);
-    g_carMenu.item[j].value = (void *)&g_storedVar.carParam[j].carNumber;
+    item->bounds(&g_storedVar.carParam[g_carSel], minValue, maxValue);
   }
 }
 
@@ -581,6 +952,11 @@ void showScreenCalibration(int16_t adcRaw)
 void printMainMenu(MenuState_enum currMenuState) 
 {
   static uint16_t tmp = 0;
+  const MenuItem_type *item;
+  static uint16_t shownSpeed_pct, shownVin_dV;  /* Values currently shown on the statistic line */
+  static bool shownDualCurve;
+  static bool firstCall = true;
+  bool redrawAll;                               /* The whole menu is redrawn in this call */
 
   /* "Frame" indicates which items are currently displayed.
      It consist of a lower and upper bound: only the items within this boundaries are displayed.
@@ -594,88 +970,296 @@ void printMainMenu(MenuState_enum currMenuState)
   {
     frameLower = g_encoderMainSelector;
     frameUpper = frameLower - g_mainMenu.lines + 1;
-    obdFill(&g_obd, OBD_WHITE, 1);
+    obdFill(&g_obd, OBD_WHITE, SCREEN_RENDER);
   } 
   else if (g_encoderMainSelector < frameUpper) 
   {
     frameUpper = g_encoderMainSelector;
     frameLower = frameUpper + g_mainMenu.lines - 1;
-    obdFill(&g_obd, OBD_WHITE, 1);
+    obdFill(&g_obd, OBD_WHITE, SCREEN_RENDER);
   }
 
   /* Print main menu only if there was an encoder interaction in the last 100 milliseconds */
-  if (millis() - g_lastEncoderInteraction < 100) 
+  redrawAll = (millis() - g_lastEncoderInteraction < 100) || firstCall;
+  firstCall = false;
+  if (redrawAll) 
   {
     for (uint8_t i = 0; i < g_mainMenu.lines; i++)
     {
+      item = &g_mainMenu.item[frameUpper - 1 + i];
+
       /* Print item name */
       /* Item color: WHITE if item is selected, black otherwise */
-      obdWriteString(&g_obd, 0, 0, i * HEIGHT12x16, g_mainMenu.item[frameUpper - 1 + i].name, FONT_12x16, (g_encoderMainSelector - frameUpper == i) ? OBD_WHITE : OBD_BLACK, 1);
+      obdWriteString(&g_obd, 0, 0, i * HEIGHT12x16, (char *)item->name, FONT_12x16, (g_encoderMainSelector - frameUpper == i) ? OBD_WHITE : OBD_BLACK, SCREEN_RENDER);
 
       /* Only print value if value != ITEM_NO_VALUE */
       /* Value color: WHITE if corresponding item is selected AND menu state is VALUE_SELECTION, black otherwise */
-      if (g_mainMenu.item[frameUpper - 1 + i].value != ITEM_NO_VALUE) 
+      if (item->valueOffset != ITEM_NO_VALUE) 
       {
         /* if the value is a number, cast to *(unit16_t *), then print number and unit */
-        if (g_mainMenu.item[frameUpper - 1 + i].type == VALUE_TYPE_INTEGER) 
+        if (item->type == VALUE_TYPE_INTEGER) 
         {
-          /* value is a generic pointer to void, so first cast to uint16_t pointer, then take the pointed value */
-          sprintf(msgStr, "%4d%c", *(uint16_t *)(g_mainMenu.item[frameUpper - 1 + i].value), g_mainMenu.item[frameUpper - 1 + i].unit);
-          obdWriteString(&g_obd, 0, OLED_WIDTH - 60, i * HEIGHT12x16, msgStr, FONT_12x16, (((g_encoderMainSelector - frameUpper == i) && (currMenuState == VALUE_SELECTION)) ? OBD_WHITE : OBD_BLACK), 1);
+          sprintf(msgStr, "%4d%c", *(uint16_t *)menuItemValue(item), item->unit);
+          obdWriteString(&g_obd, 0, OLED_WIDTH - 60, i * HEIGHT12x16, msgStr, FONT_12x16, (((g_encoderMainSelector - frameUpper == i) && (currMenuState == VALUE_SELECTION)) ? OBD_WHITE : OBD_BLACK), SCREEN_RENDER);
         }
         /* If the value is a decimal, cast to *(unit16_t *), divide by 10^decimalPoint then print number and unit */
-        else if (g_mainMenu.item[frameUpper - 1 + i].type == VALUE_TYPE_DECIMAL) 
+        else if (item->type == VALUE_TYPE_DECIMAL) 
         {
-          /* value is a generic pointer to void, so first cast to uint16_t pointer, then take the pointed value */
-          tmp = *(uint16_t *)(g_mainMenu.item[frameUpper - 1 + i].value);
-          sprintf(msgStr, " %d.%01d%c", tmp / 10, (tmp % 10), g_mainMenu.item[frameUpper - 1 + i].unit);
-          obdWriteString(&g_obd, 0, OLED_WIDTH - 60, i * HEIGHT12x16, msgStr, FONT_12x16, (((g_encoderMainSelector - frameUpper == i) && (currMenuState == VALUE_SELECTION)) ? OBD_WHITE : OBD_BLACK), 1);
+          tmp = *(uint16_t *)menuItemValue(item);
+          sprintf(msgStr, "%2d.%01d%c", tmp / 10, (tmp % 10), item->unit);  /* 5 chars up to 99.9 */
+          obdWriteString(&g_obd, 0, OLED_WIDTH - 60, i * HEIGHT12x16, msgStr, FONT_12x16, (((g_encoderMainSelector - frameUpper == i) && (currMenuState == VALUE_SELECTION)) ? OBD_WHITE : OBD_BLACK), SCREEN_RENDER);
         }
         /* If the value is a string, cast to (char *) then print the string */
-        else if (g_mainMenu.item[frameUpper - 1 + i].type == VALUE_TYPE_STRING) 
+        else if (item->type == VALUE_TYPE_STRING) 
         {
-          /* value is a generic pointer to void, so cast to string pointer */
-          sprintf(msgStr, "%s", (char *)(g_mainMenu.item[frameUpper - 1 + i].value));
-          obdWriteString(&g_obd, 0, OLED_WIDTH - (4 * WIDTH12x16), i * HEIGHT12x16, msgStr, FONT_12x16, (((g_encoderMainSelector - frameUpper == i) && (currMenuState == VALUE_SELECTION)) ? OBD_WHITE : OBD_BLACK), 1);
+          obdWriteString(&g_obd, 0, OLED_WIDTH - (4 * WIDTH12x16), i * HEIGHT12x16, (char *)menuItemValue(item), FONT_12x16, (((g_encoderMainSelector - frameUpper == i) && (currMenuState == VALUE_SELECTION)) ? OBD_WHITE : OBD_BLACK), SCREEN_RENDER);
         }
       }
     }
 
-    initMenuItems();  /* update menu items with the storedVar that could have been changed in previous for cycle */
     /* Print LIMITER warning if LIMIT is any value other than 100% */
     if (g_storedVar.carParam[g_carSel].maxSpeed < MAX_SPEED_DEFAULT) 
     {
-      obdWriteString(&g_obd, 0, WIDTH8x8, 3 * HEIGHT12x16, (char *)" - LIMITER - ", FONT_8x8, OBD_WHITE, 1);
+      obdWriteString(&g_obd, 0, WIDTH8x8, 3 * HEIGHT12x16, (char *)" - LIMITER - ", FONT_8x8, OBD_WHITE, SCREEN_RENDER);
     } 
     else 
     {
-      obdWriteString(&g_obd, 0, WIDTH8x8, 3 * HEIGHT12x16, (char *)"             ", FONT_8x8, OBD_BLACK, 1);
+      obdWriteString(&g_obd, 0, WIDTH8x8, 3 * HEIGHT12x16, (char *)"             ", FONT_8x8, OBD_BLACK, SCREEN_RENDER);
     }
   }
 
-  /* print analytic - statistic line */
-  /* Current Output speed */
-  sprintf(msgStr, "%3d%c", g_escVar.outputSpeed_pct, '%');  
-  obdWriteString(&g_obd, 0, 0, 3 * HEIGHT12x16 + HEIGHT8x8, msgStr, FONT_8x8, (g_escVar.outputSpeed_pct == 100) ? OBD_WHITE : OBD_BLACK, 1);
-  /* Current voltage */
-  sprintf(msgStr, " %d.%01dV ", g_escVar.Vin_mV / 1000, (g_escVar.Vin_mV % 1000) / 100);
-  obdWriteString(&g_obd, 0, 7 * WIDTH8x8, 3 * HEIGHT12x16 + HEIGHT8x8, msgStr, FONT_6x8, OBD_BLACK, 1);
+  /* print analytic - statistic line, only when a value changed (or the whole menu was redrawn) */
+  if (redrawAll || (g_escVar.outputSpeed_pct != shownSpeed_pct))
+  {
+    shownSpeed_pct = g_escVar.outputSpeed_pct;
+    /* Current Output speed */
+    sprintf(msgStr, "%3d%c", g_escVar.outputSpeed_pct, '%');  
+    obdWriteString(&g_obd, 0, 0, 3 * HEIGHT12x16 + HEIGHT8x8, msgStr, FONT_8x8, (g_escVar.outputSpeed_pct == 100) ? OBD_WHITE : OBD_BLACK, SCREEN_RENDER);
+  }
+  if (redrawAll || (g_escVar.Vin_mV / 100 != shownVin_dV))
+  {
+    shownVin_dV = g_escVar.Vin_mV / 100;
+    /* Current voltage */
+    sprintf(msgStr, " %d.%01dV ", g_escVar.Vin_mV / 1000, (g_escVar.Vin_mV % 1000) / 100);
+    obdWriteString(&g_obd, 0, 7 * WIDTH8x8, 3 * HEIGHT12x16 + HEIGHT8x8, msgStr, FONT_6x8, OBD_BLACK, SCREEN_RENDER);
+  }
 
   /* Show with a D if Drag Brake is higher than 100%-minSpeed forcing a dual curve when decelerating */
- if (g_storedVar.carParam[g_carSel].dragBrake > 100 - (uint16_t)g_storedVar.carParam[g_carSel].minSpeed )
- {  
-    g_escVar.dualCurve = true; // indicates a differnt curve is set when decelerating with high drag brake
-    sprintf(msgStr, "D", debug);
-    obdWriteString(&g_obd, 0, 12 * WIDTH8x8, 3 * HEIGHT12x16 + HEIGHT8x8, msgStr, FONT_6x8, OBD_BLACK, 1);
- }
- else/* delete the D if there is not a dual curve */
- {
-    g_escVar.dualCurve = false;
-    sprintf(msgStr, " ", debug);
-    obdWriteString(&g_obd, 0, 12 * WIDTH8x8, 3 * HEIGHT12x16 + HEIGHT8x8, msgStr, FONT_6x8, OBD_BLACK, 1);
- }
+  g_escVar.dualCurve = (g_storedVar.carParam[g_carSel].dragBrake > 100 - (uint16_t)g_storedVar.carParam[g_carSel].minSpeed); // indicates a differnt curve is set when decelerating with high drag brake
+  if (redrawAll || (g_escVar.dualCurve != shownDualCurve))
+  {
+    shownDualCurve = g_escVar.dualCurve;
+    obdWriteString(&g_obd, 0, 12 * WIDTH8x8, 3 * HEIGHT12x16 + HEIGHT8x8, (char *)(g_escVar.dualCurve ? "D" : " "), FONT_6x8, OBD_BLACK, SCREEN_RENDER); /* delete the D if there is not a dual curve */
+  }
+}
+
+/**
+ * Print one page of the diagnostics screen.
+ * 
+ * @param page The page to be printed (DIAG_PAGE_*)
+ */
+void printDiagnosticsPage(uint16_t page)
+{
+  static PwmWriteStats_type prevPwmStats;   /* PWM write counters at the previous refresh, for the rates */
+  static uint32_t prevPwmStats_ms = 0;
+  PwmWriteStats_type pwmStats;
+  uint32_t elapsed_ms;
+  ProfSummary_type sum;
+
+  switch (page)
+  {
+    case DIAG_PAGE_PROFILER:  /* Profiler: avg, p99 and max of every stage, in CPU cycles */
+      obdWriteString(&g_obd, 0, 0, 0, (char *)"STG   AVG   P99   MAX", FONT_6x8, OBD_WHITE, 1);
+      for (uint8_t i = 0; i < PROF_STAGE_COUNT; i++)
+      {
+        Profiler_GetSummary((ProfStage_enum)i, &sum);
+        sprintf(msgStr, "%s%6lu%6lu%6lu", Profiler_StageName((ProfStage_enum)i), sum.avg, sum.p99, sum.max);
+        obdWriteString(&g_obd, 0, 0, (i + 1) * HEIGHT8x8, msgStr, FONT_6x8, OBD_BLACK, 1);
+      }
+      break;
+
+    case DIAG_PAGE_TICK:      /* Control tick: jitter histogram, worst jitter and overruns */
+      sprintf(msgStr, "JIT max%4luus mis%4lu", g_tickStats.maxJitter_uS, g_tickStats.missedCount);
+      obdWriteString(&g_obd, 0, 0, 0, msgStr, FONT_6x8, OBD_WHITE, 1);
+      for (uint8_t i = 0; i < TICK_JITTER_BINS / 2; i++)
+      {
+        sprintf(msgStr, "%2u:%7lu %2u:%7lu", i * TICK_JITTER_BIN_US, g_tickStats.jitterHist[i],
+                (i + TICK_JITTER_BINS / 2) * TICK_JITTER_BIN_US, g_tickStats.jitterHist[i + TICK_JITTER_BINS / 2]);
+        obdWriteString(&g_obd, 0, 0, (i + 1) * HEIGHT8x8, msgStr, FONT_6x8, OBD_BLACK, 1);
+      }
+      break;
+
+    case DIAG_PAGE_PWM:       /* Motor PWM: duty register writes done and saved by the write coalescing, per second */
+      HAL_GetPwmWriteStats(&pwmStats);
+      elapsed_ms = millis() - prevPwmStats_ms;
+      if (elapsed_ms > 0)
+      {
+        sprintf(msgStr, "PWM WRITES  %4lums   ", elapsed_ms);
+        obdWriteString(&g_obd, 0, 0, 0, msgStr, FONT_6x8, OBD_WHITE, 1);
+        sprintf(msgStr, "written %7lu/s  ", ((pwmStats.writeCount - prevPwmStats.writeCount) * 1000UL) / elapsed_ms);
+        obdWriteString(&g_obd, 0, 0, 2 * HEIGHT8x8, msgStr, FONT_6x8, OBD_BLACK, 1);
+        sprintf(msgStr, "saved   %7lu/s  ", ((pwmStats.skipCount - prevPwmStats.skipCount) * 1000UL) / elapsed_ms);
+        obdWriteString(&g_obd, 0, 0, 3 * HEIGHT8x8, msgStr, FONT_6x8, OBD_BLACK, 1);
+      }
+      sprintf(msgStr, "total w %10lu", pwmStats.writeCount);
+      obdWriteString(&g_obd, 0, 0, 5 * HEIGHT8x8, msgStr, FONT_6x8, OBD_BLACK, 1);
+      sprintf(msgStr, "total s %10lu", pwmStats.skipCount);
+      obdWriteString(&g_obd, 0, 0, 6 * HEIGHT8x8, msgStr, FONT_6x8, OBD_BLACK, 1);
+      prevPwmStats = pwmStats;
+      prevPwmStats_ms = millis();
+      break;
+
+    default:
+      break;
+  }
+}
+
+
+/**
+ * Show the hidden diagnostics screen, opened by holding the encoder button in the main menu.
+ * Rotating the encoder changes page, a click exits. The diagnostics are also dumped on the serial port when the screen is opened.
+ */
+void showDiagnostics()
+{
+  uint16_t page = DIAG_PAGE_PROFILER;
+  uint32_t lastRefresh = 0;
+
+  diagSerialDump();
+
+  /* Set encoder to page selection */
+  g_rotaryEncoder.setAcceleration(MENU_ACCELERATION);
+  g_rotaryEncoder.setBoundaries(0, DIAG_PAGE_COUNT - 1, false);
+  g_rotaryEncoder.reset(page);
+  obdFill(&g_obd, OBD_WHITE, 1);
+  Screen_Invalidate();
+
+  /* Wait until the long press is released, so it's not taken as the exit click */
+  while (digitalRead(ENCODER_BUTTON_PIN) == BUTTON_PRESSED)
+  {
+    vTaskDelay(10);
+  }
+  g_rotaryEncoder.isEncoderButtonClicked();
+
+  /* Exit diagnostics when encoder is clicked */
+  while (!g_rotaryEncoder.isEncoderButtonClicked())
+  {
+    if (g_rotaryEncoder.encoderChanged())
+    {
+      page = g_rotaryEncoder.readEncoder();
+      obdFill(&g_obd, OBD_WHITE, 1);
+      Screen_Invalidate();
+      lastRefresh = 0;
+    }
+
+    /* Refresh page twice per second, values keep changing */
+    if ((lastRefresh == 0) || (millis() - lastRefresh > 500))
+    {
+      lastRefresh = millis();
+      printDiagnosticsPage(page);
+    }
+    waitUiEvent();
+  }
+
+  /* Reset encoder */
+  g_rotaryEncoder.setAcceleration(MENU_ACCELERATION);
+  g_rotaryEncoder.setBoundaries(1, MENU_ITEMS_COUNT, false);
+  g_rotaryEncoder.reset(g_encoderMainSelector);
+  g_escVar.encoderPos = g_encoderMainSelector;
+  obdFill(&g_obd, OBD_WHITE, 1);    /* Clear screen */
+  Screen_Invalidate();
+
+  return;
+}
+
+
+/**
+ * Dump all the diagnostics on the serial port
+ */
+void diagSerialDump()
+{
+  TriggerAcqStats_type acqStats;
+  ScreenStats_type screenStats;
+  StorageStats_type storageStats;
+  PwmWriteStats_type pwmStats;
+
+  Profiler_Dump(Serial);
+  printBootStats();
+
+  HAL_GetTriggerAcqStats(&acqStats);
+  Serial.printf("TRIGGER busErrors %lu shortReads %lu staleTicks %lu\n", acqStats.busErrorCount, acqStats.shortReadCount, g_tickStats.staleTriggerCount);
+  Serial.printf("TRIGGER read avg %luus max %luus, acquisition period %uus\n", acqStats.readCount ? (uint32_t)(acqStats.readSum_uS / acqStats.readCount) : 0,
+                acqStats.readMax_uS, TRIG_SAMPLE_PERIOD_US);
+  Serial.printf("TRIGGER filter %s delay now %luus\n", TrigFilter_Name(g_storedVar.carParam[g_carSel].trigFilter), HAL_GetTriggerFilterDelay_uS());
+  for (uint8_t i = 0; i < TRIG_FILTER_COUNT; i++)
+  {
+    Serial.printf("  FILT %u %-4s delay %luus (trigger still)\n", i, TrigFilter_Name(i), TrigFilter_StillDelay_uS(i, TRIG_SAMPLE_PERIOD_US));
+  }
+  Serial.printf("TELEMETRY dropped %lu\n", Telemetry_GetDropCount());
+  Serial.printf("TRACTION TRAC %u spins %lu trim now %u\n", g_storedVar.carParam[g_carSel].tracLevel, g_traction.spinCount, g_escVar.tractionTrim_q16);
+  Serial.printf("CURRENT ILIM %umA events %lu scale now %u, current now %dmA on-phase %dmA average\n", g_storedVar.carParam[g_carSel].currLimit * 100,
+                g_currLimit.eventCount, g_escVar.currLimit_q16, HAL_GetMotorOnCurrent_mA(), HAL_GetMotorCurrent_mA());
+  HAL_GetPwmWriteStats(&pwmStats);
+  Serial.printf("PWM dutyWrites %lu skipped %lu, saved %lu/s on average\n", pwmStats.writeCount, pwmStats.skipCount, (uint32_t)(((uint64_t)pwmStats.skipCount * 1000) / millis()));
+  Screen_GetStats(&screenStats);
+  Serial.printf("OLED flushes %lu pages %lu bytes %lu\n", screenStats.flushCount, screenStats.pageCount, screenStats.byteCount);
+  Storage_GetStats(&storageStats);
+  Serial.printf("NVS saves %lu unchanged %lu writes %lu bytes %lu errors %lu\n", storageStats.saveCount, storageStats.unchangedCount,
+                storageStats.writeCount, storageStats.byteCount, storageStats.errorCount);
+  for (uint8_t i = 0; i < CAR_MAX_COUNT + 1; i++)
+  {
+    Serial.printf("  %-4s writes %lu\n", g_storageRecords[i].key, storageStats.recordWriteCount[i]);
+  }
+
+#if (configGENERATE_RUN_TIME_STATS == 1) && (configUSE_STATS_FORMATTING_FUNCTIONS == 1)
+  static char runTimeStats[40 * 16];  /* About 40 chars per task */
+  vTaskGetRunTimeStats(runTimeStats);
+  Serial.printf("TASKS run time (IDLE0 is the time left free on core 0)\n%s", runTimeStats);
+#else
+  Serial.println("TASKS run time stats not available: enable configGENERATE_RUN_TIME_STATS and configUSE_STATS_FORMATTING_FUNCTIONS");
+#endif
+
+  Serial.printf("TICK period %uus count %lu missed %lu maxJitter %luus stalls(>%uus) %lu duringFlashOps %lu\n", ESC_PERIOD_US, g_tickStats.tickCount, g_tickStats.missedCount,
+                g_tickStats.maxJitter_uS, TICK_STALL_US, g_tickStats.stallCount, g_tickStats.flashOpTickCount);
+  for (uint8_t i = 0; i < TICK_JITTER_BINS; i++)
+  {
+    Serial.printf("  jitter %3u%s us: %lu\n", i * TICK_JITTER_BIN_US, (i == TICK_JITTER_BINS - 1) ? "+" : " ", g_tickStats.jitterHist[i]);
+  }
 }
 
+
+/**
+ * Print the boot milestones on the serial port, in uS from the start of the application (the bootloader time is not included).
+ * The line starts with "BOOT", to be picked up by boot time regression tests.
+ */
+void printBootStats()
+{
+  Serial.printf("BOOT paramsLoaded %lu motorReady %lu firstPwm %lu uiReady %lu us\n", g_bootStats.paramsLoaded_uS, g_bootStats.motorReady_uS,
+                g_bootStats.firstPwm_uS, g_bootStats.uiReady_uS);
+}
+
+
+/**
+ * Drain the telemetry ring filled by the control tick. Called at every Task1 wake up, so the ring never fills up in normal operation.
+ * Keeps the newest sample in g_telemetryLast and, if enabled, streams the samples on the serial port as CSV
+ * (time [uS], trigger raw, trigger [Q16], speed [Q16], Vin [mV], current [mA], back EMF [mV], trigger velocity [Q16/tick], traction trim [Q16],
+ * current limit scale [Q16], current above ILIM [0/1]), 1 every TELEMETRY_STREAM_DECIMATION.
+ */
+void drainTelemetry()
+{
+  static uint32_t streamCount = 0;
+
+  while (Telemetry_Pop(&g_telemetryLast))
+  {
+    if (g_telemetryStream && (streamCount++ % TELEMETRY_STREAM_DECIMATION == 0))
+    {
+      Serial.printf("%lu,%d,%u,%u,%u,%d,%u,%d,%u,%u,%u\n", g_telemetryLast.timestamp_uS, g_telemetryLast.trigger_raw, g_telemetryLast.trigger_q16,
+                    g_telemetryLast.outputSpeed_q16, g_telemetryLast.Vin_mV, g_telemetryLast.motorCurrent_mA, g_telemetryLast.motorBemf_mV,
+                    g_telemetryLast.triggerVel_q16, g_telemetryLast.tractionTrim_q16, g_telemetryLast.currLimit_q16, g_telemetryLast.currLimited);
+    }
+  }
+}
+
+
 uint16_t gammaCorrect(uint16_t value, float gamma) {
   float normalizedValue = (float)value / 1000.0f;
   float correctedValue = powf(normalizedValue, gamma);
@@ -683,8 +1267,6 @@ uint16_t gammaCorrect(uint16_t value, float gamma) {
 }
 
 
-#define ANTIS_SPEED_START_MIN 30 /*start anntispin only for throttle requests above ANTISPIN_PERC_START% */
-#define ANTIS_SPEED_START_MAX 65 /*start antispin only for throttle requests above ANTISPIN_PERC_START% */
  /**
  * Apply antispin calculation (according to antispin settings) applying a ramp to the output speed to prevent car drift
  * Antispin func. is called every 0,5ms. Input parameter is the requested Speed, which ranges from MinSpeed to MaxSpeed. 
@@ -698,147 +1280,120 @@ uint16_t gammaCorrect(uint16_t value, float gamma) {
  * AntispinPercStart has some variations too, it is not a fixed 40% value for instance, but it vary with the carParam[g_carSel].antiSpin user parameter
  * if the carParam[g_carSel].antiSpin setting is very high E.G. 200ms (powerful motor or slippery track), so also the antispinPercStart is low too 
  * if the carParam[g_carSel].antiSpin set is low, the traction is good, so antispinPercStart should be high, 
- * @param requestedSpeed [%] The requested outputSpeed at the end of the throttle -> speed pipeline
- * @return [%] The output speed closer to the requestedSpeed that respect the Antispin settings.
+ * The ramp itself is computed in fixed point by Throttle_AntiSpinStep(), with the coefficients precomputed by updateControlParams().
+ * @param param Control parameters snapshot of the current tick
+ * @param requestedSpeed [Q16] The requested outputSpeed at the end of the throttle -> speed pipeline
+ * @return [Q16] The output speed closer to the requestedSpeed that respect the Antispin settings.
  */
-uint16_t throttleAntiSpin3(uint16_t requestedSpeed) 
+uint16_t IRAM_ATTR throttleAntiSpin3(const ControlParam_type *param, uint16_t requestedSpeed) 
 {
-  static uint32_t lastOutputSpeedx1000 = 0, maxDeltaSpeedx1000, outputSpeedX1000;   /* To keep track of output speeds, in a larger scale to increase granularity */
-  static unsigned long prevCall_uS = 0, deltaTime_uS, currCall_uS;    /* To keep track of time between executions */
-  uint32_t outputSpeed;  
-  uint16_t antispinPercStart,minSpeedTmp;/* level at which the antispin starts to be effective (at lower trigger is just bypassed) */    
+  return Throttle_AntiSpinStep(&g_antiSpinState, &param->antiSpin, requestedSpeed, (uint32_t)esp_timer_get_time());
+}
 
-  currCall_uS = micros();                     /* Get current time in uS */
-  deltaTime_uS = currCall_uS - prevCall_uS;   /* Get delta time from last call of this function */
-  prevCall_uS = currCall_uS;                  /* Update last call static memory */
 
-  /* map(long x, long in_min, long in_max, long out_min, long out_max) */
-  antispinPercStart = map( (long)g_storedVar.carParam[g_carSel].antiSpin, 0 , (long)ANTISPIN_MAX_VALUE, (long)ANTIS_SPEED_START_MAX, (long)ANTIS_SPEED_START_MIN );
-  
+/**
+ * throttleCurve2: Map trigger position(throttle) to speed (duty) on a broken line curve, with midpoint set as throttleCurveVertex
+ * The curve of the selected car is precomputed by updateControlParams(), here it is just interpolated (see Throttle_CurveCalc() for the calculation)
+ * @param param Control parameters snapshot of the current tick
+ * @param inputThrottleQ16 [Q16] The input Trigger value, from 0 to THROTTLE_Q16_MAX
+ * @return [Q16] duty cyle to be applied at that specific thrigger position on the selected curve
+ */
+uint16_t IRAM_ATTR throttleCurve2(const ControlParam_type *param, uint16_t inputThrottleQ16)
+{
+  return Throttle_CurveLookup(param->curveLut, THROTTLE_NORMALIZED, inputThrottleQ16);
+}
+
 
-  /* Bypass calculation if antiSpin is 0 (OFF) and just return requestedSpeed */
-  if ((g_storedVar.carParam[g_carSel].antiSpin) == 0) 
+/**
+ * Rebuild the control parameters snapshot if the selected car, its BRAKE / SENSI / LIMIT / CURVE / ANTIS / LEAD / TRAC / ILIM parameters
+ * or the trigger calibration changed since last build.
+ * Called from Task1 (UI core): the new set is built in the buffer not used by the control tick, then published with an atomic pointer swap.
+ * A buffer is rebuilt only after the control tick took the newer one, so it is never written while in use.
+ */
+void updateControlParams()
+{
+  static uint16_t builtCarSel = UINT16_MAX, builtBrake, builtMinSpeed, builtMaxSpeed, builtVertexInput, builtCurveSpeedDiff, builtAntiSpin, builtTrigLead, builtTracLevel, builtCurrLimit;  /* Parameters of the active set */
+  static int16_t  builtMinTrigger_raw, builtMaxTrigger_raw;
+  static uint8_t  activeIdx = 0;
+  const CarParam_type *car = &g_storedVar.carParam[g_carSel];
+  ControlParam_type *param;
+
+  if ((builtCarSel == g_carSel) && (builtBrake == car->brake) && (builtMinSpeed == car->minSpeed) && (builtMaxSpeed == car->maxSpeed) && (builtAntiSpin == car->antiSpin) &&
+      (builtTrigLead == car->trigLead) && (builtTracLevel == car->tracLevel) && (builtCurrLimit == car->currLimit) &&
+      (builtVertexInput == car->throttleCurveVertex.inputThrottle) && (builtCurveSpeedDiff == car->throttleCurveVertex.curveSpeedDiff) &&
+      (builtMinTrigger_raw == g_storedVar.minTrigger_raw) && (builtMaxTrigger_raw == g_storedVar.maxTrigger_raw))
   {
-    outputSpeed = requestedSpeed;
-    lastOutputSpeedx1000 = g_storedVar.carParam[g_carSel].minSpeed; // keep last output speed to minspeed, so at next start I can 
-  } 
-  else 
+    return; /* Nothing changed */
+  }
+
+  if (__atomic_load_n(&g_ctrlParamInUse, __ATOMIC_ACQUIRE) != g_ctrlParamActive)  /* The control tick may still be reading the other buffer */
   {
-    if (requestedSpeed < antispinPercStart) /* if requested speed(duty) is low do not apply antispin, current will be low for sure, so just pass the value */
+    vTaskDelay(1);  /* One RTOS tick is longer than a control tick */
+    if (__atomic_load_n(&g_ctrlParamInUse, __ATOMIC_ACQUIRE) != g_ctrlParamActive)
     {
-      outputSpeed = requestedSpeed ;
-      lastOutputSpeedx1000 = outputSpeed * 1000;
-    }
-    else
-    {
-      if ((uint32_t)requestedSpeed * 1000 <= lastOutputSpeedx1000)  /* If requestSpeed is decreasing (car braking/slowing) => apply new speed immediately */
-      {
-        outputSpeed = requestedSpeed;
-        lastOutputSpeedx1000 = outputSpeed * 1000;
-      } 
-      else /* Requested speed is increasing (Car is RACING) here apply antispin */
-      {
-        /* minspeed could be overrided by the antispinPercStart, so keep the highest */
-        minSpeedTmp = max((uint16_t)g_storedVar.carParam[g_carSel].minSpeed, antispinPercStart);
-        /* calculate max delta speed  deltaSpeed = ((minSPeedTmp-MaxSpeed)* DeltaTime) / antiSpin (from min speed to max speed) */
-        maxDeltaSpeedx1000 = ((g_storedVar.carParam[g_carSel].maxSpeed - minSpeedTmp  ) * (deltaTime_uS)) / (g_storedVar.carParam[g_carSel].antiSpin);  
-        
-        /* Check if there is room to increase the lastOutputSpeed by a maxdeltaspeed or if the speed is too close to the requested speed*/
-        if (lastOutputSpeedx1000 < ((uint32_t)requestedSpeed * 1000 - maxDeltaSpeedx1000))  
-        {
-          outputSpeedX1000 = (lastOutputSpeedx1000 + maxDeltaSpeedx1000);
-        } 
-        else // we arrived at the target, so just assign the requested speed
-        {
-          outputSpeedX1000 = requestedSpeed * 1000;
-        }
-        
-        /* check in order to start the ramp from minspeed (and not from 0) */
-        if (outputSpeedX1000 < g_storedVar.carParam[g_carSel].minSpeed * 1000)  
-        {
-          outputSpeedX1000 = g_storedVar.carParam[g_carSel].minSpeed * 1000;
-        }
-
-        lastOutputSpeedx1000 = outputSpeedX1000;  /* save latest outspeed, so next iteration of this function can have only the defined delta */
-        outputSpeed = outputSpeedX1000 / 1000;
-      }
+      return; /* Retry at next call */
     }
   }
 
-  return outputSpeed;
+  builtCarSel = g_carSel;
+  builtBrake = car->brake;
+  builtMinSpeed = car->minSpeed;
+  builtMaxSpeed = car->maxSpeed;
+  builtVertexInput = car->throttleCurveVertex.inputThrottle;
+  builtCurveSpeedDiff = car->throttleCurveVertex.curveSpeedDiff;
+  builtAntiSpin = car->antiSpin;
+  builtTrigLead = car->trigLead;
+  builtTracLevel = car->tracLevel;
+  builtCurrLimit = car->currLimit;
+  builtMinTrigger_raw = g_storedVar.minTrigger_raw;
+  builtMaxTrigger_raw = g_storedVar.maxTrigger_raw;
+
+  activeIdx ^= 1;
+  param = &g_ctrlParam[activeIdx];
+  param->brakeQ16 = THROTTLE_PCT_TO_Q16(builtBrake);
+  param->triggerLeadQ8 = ((uint32_t)builtTrigLead * 100 * 256) / ESC_PERIOD_US;  /* [0.1ms] to control ticks */
+  param->tractionDropQ16 = Traction_DropQ16(builtTracLevel);
+  param->currentLimit_mA = builtCurrLimit * 100;  /* [0.1A] to mA */
+  param->minTrigger_raw = builtMinTrigger_raw;
+  param->maxTrigger_raw = builtMaxTrigger_raw;
+  Throttle_BuildCurveLut(param->curveLut, THROTTLE_NORMALIZED, builtMinSpeed, builtMaxSpeed, builtVertexInput, builtCurveSpeedDiff);
+  Throttle_AntiSpinSetup(&param->antiSpin, builtAntiSpin, ANTISPIN_MAX_VALUE, builtMinSpeed, builtMaxSpeed);
+  __atomic_store_n(&g_ctrlParamActive, param, __ATOMIC_RELEASE);
 }
 
 
 /**
- * Accounts for a deadband in an input value.
- * 
- * @param inputVal The input value
- * @param minVal The lower bound of the input value range
- * @param maxVal The upper bound of the input value range
- * @param deadBand The deadband as absolute value (not a percentage)
- * @return If the input value is less than the minVal + deadBand, it returns minVal.
-           If the input value is more than the maxVal - deadBand, it returns the maxVal.
-           Otherwise, it returns the inputVal, scaled in order to range from minVal to maxVal.
+ * Apply the PWM_F of the selected car if it changed (edited or other car selected).
+ * The HAL reprograms the PWM timer at the next period boundary, the output keeps running.
  */
-uint16_t addDeadBand(uint16_t inputVal, uint16_t minVal, uint16_t maxVal, uint16_t deadBand) 
+void updatePwmFreq()
 {
-  uint16_t retVal = 0;
+  static uint16_t prevFreqPWM = 0;  /* Keep track if the PWM freq has changed */
 
-  /* If the inputVal is less than deadBand_pct, return 0 */
-  if (inputVal < minVal + deadBand) 
+  if (g_storedVar.carParam[g_carSel].freqPWM != prevFreqPWM)
   {
-    retVal = 0;
-  } 
-  /* If the inputVal is more than maxValue - deadBand, return maxValue */
-  else if (inputVal > maxVal - deadBand) 
-  {
-    retVal = maxVal;
-  } 
-  else 
-  {
-    /* retVal = (THROTTLE_NORMALIZED * (inputVal - deadBand)) / (THROTTLE_NORMALIZED - 2 * deadBand); TODO: verify what this is suppose to do */
-    retVal = map(inputVal, deadBand, maxVal - deadBand, minVal, maxVal);  /* Scale the inputValue (which ranges from (minVal + deadBand) to (maxVal - deadBand))
-                                                                             so that it ranges from minVal to maxVal */
+    prevFreqPWM = g_storedVar.carParam[g_carSel].freqPWM;
+    HAL_SetPwmFreq(prevFreqPWM * 100);
   }
-
-  return retVal;
 }
 
+
 /**
- * throttleCurve2: Map trigger position(throttle) to speed (duty) on a broken line curve, with midpoint set as throttleCurveVertex
- * dual throttle curve: When decelerating , if dragB is higher than 100%-minSpeed, then set a lower minSpeed
- * @param inputThrottleNorm The input Trigger value, normalized between 0 and THROTTLE_NORMALIZED
- * @return duty cyle to be applied at that specific thrigger position on the selected curve
+ * Apply the FILT (trigger filter) of the selected car if it changed (edited or other car selected).
+ * The acquisition task restarts the filter from its next sample.
  */
-uint16_t throttleCurve2(uint16_t inputThrottleNorm )
+void updateTriggerFilter()
 {
-  uint16_t outputSpeed = 0;           /* The requested output speed (duty cycle) from 0% to 100% */
-  uint32_t throttleCurveVertexSpeed;  /* The output speed when the throttle is at 50% (that is, the value of throttleCurveVertex.inputThrottle) */
-  uint16_t tmpMinSpeed;               /* Minimum speed may change when decelerating due to drag brake, so create a temporary min speed */
-
-  /* dual throttle curve: When decelerating , if dragB is higher than 100%-minSpeed, then set a lower minSpeed on the curve to allow the desired drag brake to be applied*/
-  tmpMinSpeed = g_storedVar.carParam[g_carSel].minSpeed;
-
-  /* Calculate the output speed of the throttle curve vertex
-     This is calculated as the curveSpeedDiff (from 10% to 90%) percentage of the difference between minSpeed and maxSpeed */
-  throttleCurveVertexSpeed = tmpMinSpeed + (((uint32_t)g_storedVar.carParam[g_carSel].maxSpeed - (uint32_t)tmpMinSpeed) * ((uint32_t)g_storedVar.carParam[g_carSel].throttleCurveVertex.curveSpeedDiff) / 100);
+  static uint16_t prevTrigFilter = UINT16_MAX;  /* Keep track if the filter has changed */
 
-  if (inputThrottleNorm == 0)   /* If input throttle is 0 --> output speed is 0% */
+  if (g_storedVar.carParam[g_carSel].trigFilter != prevTrigFilter)
   {
-    outputSpeed = 0;
-  } 
-  else if (inputThrottleNorm <= g_storedVar.carParam[g_carSel].throttleCurveVertex.inputThrottle) /* If the input throttle is less than the vertex point (fixed at 50%), than map the output speed from 0 to the throttleCurveVertexSpeed */
-  {
-    outputSpeed = map(inputThrottleNorm, 0, g_storedVar.carParam[g_carSel].throttleCurveVertex.inputThrottle, tmpMinSpeed, throttleCurveVertexSpeed);
-  } 
-  else  /* If the input throttle is more than the vertex point (fixed at 50%), than map the output speed from throttleCurveVertexSpeed to the maxSpeed*/
-  {
-    outputSpeed = map(inputThrottleNorm, g_storedVar.carParam[g_carSel].throttleCurveVertex.inputThrottle, THROTTLE_NORMALIZED, throttleCurveVertexSpeed, g_storedVar.carParam[g_carSel].maxSpeed);
+    prevTrigFilter = g_storedVar.carParam[g_carSel].trigFilter;
+    HAL_SetTriggerFilter(prevTrigFilter);
   }
-
-  return outputSpeed;
 }
 
+
 /**
  * Call this when calibrating the throttle.
  * Check if the parameter adcRaw is bigger/smaller than the stored max/min values, and updates them accordingly.
@@ -886,10 +1441,8 @@ MenuState_enum rotary_onButtonClick(MenuState_enum currMenuState)
       g_rotaryEncoder.setAcceleration(SEL_ACCELERATION); /* Set higher encoder acceleration so it doesn't require too many turns to make a big value change */
       
       
-      g_encoderSelectedValuePtr = (uint16_t *)g_mainMenu.item[g_encoderMainSelector - 1].value;   /* Update the g_encoderSelectedValuePtr to point to the value of the selected item.
-                                                                                                     value is a generic pointer to void, so cast to uint16_t pointer */
-      selectedParamMaxValue = g_mainMenu.item[g_encoderMainSelector - 1].maxValue;                /* Set Max and Min boundaries according to the selected items max and min value */
-      selectedParamMinValue = g_mainMenu.item[g_encoderMainSelector - 1].minValue;
+      g_encoderSelectedValuePtr = (uint16_t *)menuItemValue(&g_mainMenu.item[g_encoderMainSelector - 1]);   /* Update the g_encoderSelectedValuePtr to point to the value of the selected item, in the selected car */
+      menuItemBounds(&g_mainMenu.item[g_encoderMainSelector - 1], &selectedParamMinValue, &selectedParamMaxValue);  /* Set Max and Min boundaries according to the selected item, they may depend on other parameters */
       g_rotaryEncoder.setBoundaries(selectedParamMinValue, selectedParamMaxValue, false);
       g_rotaryEncoder.reset(*g_encoderSelectedValuePtr);  /* Reset the encoder to the current value of the selected item */
       g_escVar.encoderPos = *g_encoderSelectedValuePtr;   /* Set the encoderPos global variable to the current value of the selected item */
@@ -909,7 +1462,7 @@ MenuState_enum rotary_onButtonClick(MenuState_enum currMenuState)
     g_rotaryEncoder.reset(g_encoderMainSelector);               /* Reset the encoder value to g_encoderMainSelector, so that it doesn't change the selected item */
     g_escVar.encoderPos = g_encoderMainSelector;
     
-    saveEEPROM(g_storedVar);  /* Save modified values to EEPROM */
+    saveEEPROM();  /* Save modified values to EEPROM */
     return ITEM_SELECTION;    /* Return the ITEM_SELECTION state */   
   }
 }
@@ -930,6 +1483,7 @@ void showCarSelection() {
 
   /* Clear screen */
   obdFill(&g_obd, OBD_WHITE, 1);
+  Screen_Invalidate();
 
   /* Set encoder to car selection parameter */
   g_rotaryEncoder.setAcceleration(MENU_ACCELERATION);
@@ -939,6 +1493,7 @@ void showCarSelection() {
   /* Exit car selection when encoder is clicked */
   while (!g_rotaryEncoder.isEncoderButtonClicked()) 
   {
+    waitUiEvent();
     /* Get encoder value if changed */
     g_storedVar.selectedCarNumber = g_rotaryEncoder.encoderChanged() ? g_rotaryEncoder.readEncoder() : g_storedVar.selectedCarNumber;
     
@@ -948,26 +1503,24 @@ void showCarSelection() {
       frameLower = g_storedVar.selectedCarNumber;
       frameUpper = frameLower - g_carMenu.lines + 1;
       obdFill(&g_obd, OBD_WHITE, 1);
+      Screen_Invalidate();
     } 
     else if (g_storedVar.selectedCarNumber < frameUpper) 
     {
       frameUpper = g_storedVar.selectedCarNumber;
       frameLower = frameUpper + g_carMenu.lines - 1;
       obdFill(&g_obd, OBD_WHITE, 1);
+      Screen_Invalidate();
     }
 
     /* Print car menu */
     for (uint8_t i = 0; i < g_carMenu.lines; i++) 
     {
       /* Print the item (car) name */
-      obdWriteString(&g_obd, 0, 0, i * HEIGHT12x16, g_carMenu.item[frameUpper + i].name, FONT_12x16, (g_storedVar.selectedCarNumber - frameUpper == i) ? OBD_WHITE : OBD_BLACK, 1);
-      if (g_carMenu.item[frameUpper + i].value != ITEM_NO_VALUE) 
-      {
-        /* value is a generic pointer to void, so first cast to uint16_t pointer, then take the pointed value */
-        sprintf(msgStr, "%2d", *(uint16_t *)(g_carMenu.item[frameUpper + i].value));
-        /* Print the item value (car number) */
-        obdWriteString(&g_obd, 0, OLED_WIDTH - 24, i * HEIGHT12x16, msgStr, FONT_12x16, OBD_BLACK, 1);
-      }
+      obdWriteString(&g_obd, 0, 0, i * HEIGHT12x16, g_storedVar.carParam[frameUpper + i].carName, FONT_12x16, (g_storedVar.selectedCarNumber - frameUpper == i) ? OBD_WHITE : OBD_BLACK, 1);
+      sprintf(msgStr, "%2d", g_storedVar.carParam[frameUpper + i].carNumber);
+      /* Print the item value (car number) */
+      obdWriteString(&g_obd, 0, OLED_WIDTH - 24, i * HEIGHT12x16, msgStr, FONT_12x16, OBD_BLACK, 1);
     }
 
     /* Print "-SELECT THE CAR-" on the bottom of the screen */
@@ -991,6 +1544,7 @@ void showSelectRenameCar() {
   uint16_t selectedOption = 0;
   /* Clear screen */
   obdFill(&g_obd, OBD_WHITE, 1);
+  Screen_Invalidate();
 
   /* Set encoder to selection parameter */
   g_rotaryEncoder.setAcceleration(MENU_ACCELERATION);
@@ -1003,6 +1557,7 @@ void showSelectRenameCar() {
   /* Exit car selection when encoder is clicked */
   while (!g_rotaryEncoder.isEncoderButtonClicked())
   {
+    waitUiEvent();
     /* Get encoder value if changed */
     selectedOption = g_rotaryEncoder.encoderChanged() ? g_rotaryEncoder.readEncoder() : selectedOption;
     /* Print the two options */
@@ -1014,13 +1569,13 @@ void showSelectRenameCar() {
   if (selectedOption == CAR_OPTION_RENAME) 
   {
     showRenameCar();
-    saveEEPROM(g_storedVar);
+    saveEEPROM();
   }
   /* If SELECT option was selected, go to showCarSelection routine */
   else if (selectedOption == CAR_OPTION_SELECT) 
   {
     showCarSelection();
-    saveEEPROM(g_storedVar);
+    saveEEPROM();
   }
 
   /* Reset encoder */
@@ -1030,6 +1585,7 @@ void showSelectRenameCar() {
   g_escVar.encoderPos = g_encoderMainSelector;
   /* Clear screen */
   obdFill(&g_obd, OBD_WHITE, 1);
+  Screen_Invalidate();
 
   return;
 }
@@ -1051,6 +1607,7 @@ void showRenameCar() {
 
   /* Clear screen */
   obdFill(&g_obd, OBD_WHITE, 1);
+  Screen_Invalidate();
 
   /* Set encoder to selection parameter */
   g_rotaryEncoder.setAcceleration(MENU_ACCELERATION);
@@ -1073,6 +1630,7 @@ void showRenameCar() {
   /* Exit car renaming when encoder is clicked AND CONFIRM is selected */
   while (1) 
   {
+    waitUiEvent();
     /* Get encoder value if changed */
     /* Change selectedOption if in RENAME_CAR_SELECT_OPTION_MODE */
     if (mode == RENAME_CAR_SELECT_OPTION_MODE) 
@@ -1163,6 +1721,7 @@ void showCurveSelection()
     y_pixel = (50 - (y_speed / 2)); */
   /* Clear screen and draw x and y axis */
   obdFill(&g_obd, OBD_WHITE, 1);
+  Screen_Invalidate();
   obdDrawLine(&g_obd, 25, 0, 25, 50, OBD_BLACK, 1);
   obdDrawLine(&g_obd, 25, 50, 125, 50, OBD_BLACK, 1);
   /* Write the 100%, 0%, 50% and MIN and MAXpoints labels */
@@ -1206,6 +1765,7 @@ void showCurveSelection()
   /* Exit curve function when encoder is clicked */
   while (!g_rotaryEncoder.isEncoderButtonClicked())
   {
+    waitUiEvent();
     /* Write the trigger value only if it changed */
     if (g_escVar.outputSpeed_pct != prevTrigger)
     {
@@ -1230,15 +1790,12 @@ void showCurveSelection()
       throttleCurveVertexSpeed = g_storedVar.carParam[g_carSel].minSpeed + ((uint32_t)g_storedVar.carParam[g_carSel].maxSpeed - (uint32_t)g_storedVar.carParam[g_carSel].minSpeed) * ((uint32_t)g_storedVar.carParam[g_carSel].throttleCurveVertex.curveSpeedDiff) / 100;
       obdWriteString(&g_obd, 0, OLED_WIDTH - 48, 34, msgStr, FONT_12x16, OBD_BLACK, 1);
       
+      updateControlParams();      /* Apply the new curve to the motor straight away */
+
       /* Draw the new lines */
       obdDrawLine(&g_obd, 25, 50 - (g_storedVar.carParam[g_carSel].minSpeed / 2), 25 + inputThrottle, map(throttleCurveVertexSpeed, 0, 100, 50, 0), OBD_BLACK, 1);
       obdDrawLine(&g_obd, 25 + inputThrottle, map(throttleCurveVertexSpeed, 0, 100, 50, 0), 125, map(g_storedVar.carParam[g_carSel].maxSpeed, 0, 100, 50, 0), OBD_BLACK, 1);
     }
-    else
-    {
-      /* Service the watchdog, to prevent CPU reset */
-      vTaskDelay(10);
-    }
   }
 
   /* Reset encoder */
@@ -1246,50 +1803,14 @@ void showCurveSelection()
   g_rotaryEncoder.setBoundaries(1, MENU_ITEMS_COUNT, false);
   g_rotaryEncoder.reset(g_encoderMainSelector);
   g_escVar.encoderPos = g_encoderMainSelector;
-  saveEEPROM(g_storedVar);          /* Save modified values to EEPROM */
+  saveEEPROM();          /* Save modified values to EEPROM */
   obdFill(&g_obd, OBD_WHITE, 1);    /* Clear screen */
+  Screen_Invalidate();
 
   return;
 }
 
 
-/**
- * Take an ADC raw value where the max and min has been recorded and returns the value scaled
- * 
- * @param raw The raw ADC value
- * @param minIn The lowest reading of the ADC
- * @param maxIn The highest reading of the ADC
- * @param normalizedMax The new max value of the scale
- * @param isReversed Whether the throttle is reversed or not
- * @return The raw ADC value scaled from 0 to normalizedMax
- */
-uint16_t normalizeAndClamp(uint16_t raw, uint16_t minIn, uint16_t maxIn, uint16_t normalizedMax, bool isReversed)
-{
-  uint16_t retVal = 0;  /* From 0 to normalizedMax */
-
-  if (maxIn == minIn)  /* If maxIn == minIn avoid division by 0 */
-  {
-    retVal = 0;
-  }
-  else
-  {
-    raw = constrain(raw, minIn, maxIn); /* Make sure the raw value is constrained between minIn and maxIn */
-
-    if (isReversed == true)  /* If throttle is reversed (it goes to low values when pressed) */
-    {
-      raw = abs(maxIn - raw);
-    }
-    else
-    {
-      raw = abs(raw - minIn);
-    }
-
-    retVal = ((uint32_t)raw * normalizedMax) / (maxIn - minIn); /* Scale the raw reading */
-  }
-
-  return retVal;
-}
-
 /**
  * Saturate an input value between a upper and lower bound
  * 
@@ -1314,8 +1835,10 @@ uint16_t saturateParamValue(uint16_t paramValue, uint16_t minValue, uint16_t max
 }
 
 
-void saveEEPROM(StoredVar_type toSave) {
-  g_pref.begin("stored_var", false);                      /* Open the "stored" namespace in read/write mode */
-  g_pref.putBytes("user_param", &toSave, sizeof(toSave)); /* Put the value of the stored user_param */
-  g_pref.end();                                           /* Close the namespace */
+/**
+ * Save the stored variables that changed.
+ * Only the NVS keys of what changed are written, and not immediately: Storage_Service() writes them STORAGE_QUIET_MS after the last change.
+ */
+void saveEEPROM() {
+  Storage_Save();
 }
\ No newline at end of file
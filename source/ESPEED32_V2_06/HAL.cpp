@@ -4,6 +4,18 @@
 #include "HAL.h"
 #include "slot_ESC.h"
 #include <math.h>
+#include <driver/ledc.h>
+#include <soc/ledc_struct.h>
+#include <soc/ledc_reg.h>
+#include <hal/ledc_ll.h>
+#include <hal/timer_ll.h>
+#include <soc/timer_group_struct.h>
+#include <esp_intr_alloc.h>
+#include <driver/gptimer.h>
+#include "bemf.h"
+#include "trigfilter.h"
+#include "hb_mcpwm.h"
+#include "pwmquant.h"
 
 #ifdef AS5600_MAG
   #include "AS5600.h"
@@ -20,14 +32,187 @@
 #elif defined (TLE493D_MAG)
   //#define ADDRESS 0x35              // for the A0 derivate
   #define ADDRESS 0x5D    // for the TLE493 P3B6
+  #include "fixmath.h"
+  #define TLE_RAW_OFFSET        570     /* Raw trigger scale is 570 * (angle[rad] + 1): kept, so stored calibrations stay valid */
+  #define TLE_RAW_PER_DEG10_Q15 32599   /* 570 * PI / 1800 in Q15: raw counts per tenth of degree */
   #include <Wire.h>                 // default I�C library
 
 #endif
 
+/*********************************************************************************************************************/
+/*-------------------------------------------------Private variables-------------------------------------------------*/
+/*********************************************************************************************************************/
+static ControlTickFunction_type s_controlTick = NULL;  /* Control tick, called by the control timer ISR */
+static gptimer_handle_t s_controlTimer = NULL;       /* Control timer, taken from the gptimer driver */
+#if !defined (CONFIG_GPTIMER_ISR_IRAM_SAFE)
+static intr_handle_t s_controlIntr = NULL;
+#endif
+
+static uint32_t s_pwmDuty[2] = { 0, 0 };        /* Requested duties [Q16, PWM_DUTY_MAX is 100%] of THR_IN_PWM_CHAN and THR_INH_PWM_CHAN */
+#if defined (PWM_DITHER)
+static uint32_t s_pwmDitherErr[2] = { 0, 0 };   /* Quantization error carried to the next write [1/PWM_DUTY_MAX counts] */
+#endif
+static uint32_t s_pwmPeriodCounts = 0;          /* Counts in a motor PWM period: 2^LEDC resolution, or MCPWM ticks */
+static uint32_t s_pwmCounts[2] = { UINT32_MAX, UINT32_MAX };  /* Counts last written to the output stage, same counts are not rewritten */
+static PwmWriteStats_type s_pwmWriteStats;      /* Duty register writes done and skipped */
+static portMUX_TYPE s_pwmMux = portMUX_INITIALIZER_UNLOCKED;
+
+#if !defined (HB_OUT_MCPWM)
+static intr_handle_t s_pwmOvfIntr = NULL;   /* Motor PWM timer overflow interrupt, enabled only while a frequency change is pending */
+static uint32_t s_pwmDivider = 0;           /* Motor PWM timer divider, to be applied at the next overflow */
+static uint8_t  s_pwmResBits = 0;           /* Motor PWM timer resolution, to be applied with s_pwmDivider */
+#endif
+
+static hw_timer_t  *s_triggerTimer = NULL;  /* HW timer that paces the trigger acquisition */
+static TaskHandle_t s_triggerTask = NULL;   /* Trigger acquisition task */
+
+/* Trigger samples double buffer: the acquisition task writes the buffer not pointed by s_trigLatest, then publishes it.
+   The reader only copies a few bytes, so the writer never gets around to the buffer being read */
+static TriggerSample_type s_trigSample[2];
+static uint8_t s_trigLatest = 0;
+static TriggerAcqStats_type s_trigAcqStats;
+
+static TrigFilter_type s_trigFilter;        /* Trigger filter, owned by the acquisition task */
+static uint8_t s_trigFilterReq = TRIG_FILTER_AVG2;  /* Filter requested by HAL_SetTriggerFilter(), applied by the acquisition task */
+
+static int16_t s_motorCurrent_mA = 0;       /* Averaged motor current, written by the acquisition task */
+static int16_t s_motorOnCurrent_mA = 0;     /* Motor current in the on-phase (through the high side switch), written by the acquisition task */
+static uint16_t s_motorBemf_mV = 0;         /* Filtered motor back EMF, written by the acquisition task */
+
 /*********************************************************************************************************************/
 /*---------------------------------------------Function Implementations----------------------------------------------*/
 /*********************************************************************************************************************/
 
+/*
+  dutyToCounts: quantize the requested duty of a motor PWM channel to counts of the PWM period. Call it with s_pwmMux taken.
+  With PWM_DITHER the duty bits below one count are carried to the next write (PwmQuant_Dither): over a few writes the average output
+  is the requested Q16 duty, also where a count is a big step (low duty, high PWM_F). 0 and PWM_DUTY_MAX are never dithered, and
+  at 16 bits (PWM_F up to 1kHz) a count is finer than a Q16 step: rounded, nothing dithered.
+  @param:chan THR_IN_PWM_CHAN or THR_INH_PWM_CHAN
+*/
+static inline uint32_t IRAM_ATTR dutyToCounts(uint8_t chan)
+{
+#if defined (PWM_DITHER)
+  return PwmQuant_Dither(s_pwmDuty[chan], s_pwmPeriodCounts, &s_pwmDitherErr[chan]);
+#else
+  return PwmQuant_Round(s_pwmDuty[chan], s_pwmPeriodCounts);
+#endif
+}
+
+
+/*
+  pwmCountsChanged: write coalescing. Tells if the counts of a channel differ from the ones in the output stage, and takes note of them.
+  With PWM_DITHER a steady duty still changes counts when it has bits below the PWM resolution: those writes are the dither, kept.
+  Call it with s_pwmMux taken.
+  @param:chan THR_IN_PWM_CHAN or THR_INH_PWM_CHAN
+  @param:counts counts about to be written
+  @returns: true if the register must be written
+*/
+static inline bool IRAM_ATTR pwmCountsChanged(uint8_t chan, uint32_t counts)
+{
+  if (counts == s_pwmCounts[chan])
+  {
+    s_pwmWriteStats.skipCount++;
+    return false;
+  }
+
+  s_pwmCounts[chan] = counts;
+  s_pwmWriteStats.writeCount++;
+  return true;
+}
+
+
+#if defined (HB_OUT_MCPWM)
+/*
+  writeMcpwmDuty: write the duties of IN and INH to the MCPWM, both loaded at the start of the same period.
+  Nothing is written if neither changed. Call it with s_pwmMux taken.
+*/
+static void IRAM_ATTR writeMcpwmDuty()
+{
+  uint32_t inCounts = dutyToCounts(THR_IN_PWM_CHAN);
+  uint32_t inhCounts = dutyToCounts(THR_INH_PWM_CHAN);
+  bool inChanged = pwmCountsChanged(THR_IN_PWM_CHAN, inCounts);
+  bool inhChanged = pwmCountsChanged(THR_INH_PWM_CHAN, inhCounts);
+
+  if (inChanged || inhChanged)
+  {
+    HbMcpwm_SetDuty(inCounts, inhCounts);
+  }
+}
+#else
+/*
+  ledcResolutionBits: highest LEDC resolution for a PWM frequency, the timer divider can not go below 1
+  @param:freq_Hz [Hz] PWM frequency
+*/
+static uint8_t ledcResolutionBits(uint32_t freq_Hz)
+{
+  uint8_t bits = PWM_RES_MAX_BIT;
+
+  while ((bits > 1) && (((uint64_t)freq_Hz << bits) > APB_CLK_FREQ))
+  {
+    bits--;
+  }
+
+  return bits;
+}
+
+
+/*
+  writeLedcDuty: write the duty of a motor PWM channel, loaded at the next PWM period. Call it with s_pwmMux taken.
+  Also called while the flash cache is disabled: the LEDC registers are written directly
+  (same sequence as ledc_set_duty() + ledc_update_duty(), the ll functions are inline), ledcWrite() lives in flash.
+  Nothing is written if the counts did not change: the register already holds them (or they are pending for the next period).
+*/
+static void IRAM_ATTR writeLedcDuty(uint8_t chan)
+{
+  uint32_t counts = dutyToCounts(chan);
+
+  if (!pwmCountsChanged(chan, counts))
+  {
+    return;
+  }
+
+  ledc_ll_set_duty_int_part(&LEDC, LEDC_HIGH_SPEED_MODE, (ledc_channel_t)chan, counts);
+  ledc_ll_set_duty_direction(&LEDC, LEDC_HIGH_SPEED_MODE, (ledc_channel_t)chan, LEDC_DUTY_DIR_INCREASE);
+  ledc_ll_set_duty_num(&LEDC, LEDC_HIGH_SPEED_MODE, (ledc_channel_t)chan, 1);
+  ledc_ll_set_duty_cycle(&LEDC, LEDC_HIGH_SPEED_MODE, (ledc_channel_t)chan, 1);
+  ledc_ll_set_duty_scale(&LEDC, LEDC_HIGH_SPEED_MODE, (ledc_channel_t)chan, 0);
+  ledc_ll_set_duty_start(&LEDC, LEDC_HIGH_SPEED_MODE, (ledc_channel_t)chan, true);
+}
+
+
+/*
+  pwmTimerOvfISR: motor PWM timer overflow (period boundary), enabled while a frequency change is pending.
+  Divider and resolution take effect as soon as they are written, the duties only at the next overflow. So with a new resolution the
+  duties are first rewritten in counts of the new period, and divider and resolution follow at the overflow that loads them:
+  only the interrupt latency, at the start of that period, runs with the old timer setup. Then the interrupt disables itself.
+*/
+static void IRAM_ATTR pwmTimerOvfISR(void *arg)
+{
+  if ((LEDC.int_st.val & LEDC_HSTIMER0_OVF_INT_ST) == 0)
+  {
+    return;
+  }
+
+  portENTER_CRITICAL_ISR(&s_pwmMux);
+  LEDC.int_clr.val = LEDC_HSTIMER0_OVF_INT_CLR;
+  if (s_pwmPeriodCounts != (1UL << s_pwmResBits))
+  {
+    s_pwmPeriodCounts = 1UL << s_pwmResBits;
+    writeLedcDuty(THR_IN_PWM_CHAN);
+    writeLedcDuty(THR_INH_PWM_CHAN);
+  }
+  else
+  {
+    ledc_ll_set_clock_divider(&LEDC, LEDC_HIGH_SPEED_MODE, LEDC_TIMER_0, s_pwmDivider);
+    ledc_ll_set_duty_resolution(&LEDC, LEDC_HIGH_SPEED_MODE, LEDC_TIMER_0, s_pwmResBits);
+    LEDC.int_ena.val &= ~LEDC_HSTIMER0_OVF_INT_ENA;
+  }
+  portEXIT_CRITICAL_ISR(&s_pwmMux);
+}
+#endif
+
+
 void HAL_InitHW()
 {
   /* Setup fo the parameters for serial(debug) communication */ 
@@ -41,8 +226,20 @@ void HAL_InitHW()
   Wire1.endTransmission();
 
   /* configure motor control PWM functionalitites and attach the channel to the GPIO to be controlled */
-  ledcAttachChannel(HB_IN_PIN, PWM_FREQ_DEFAULT*1000, THR_PWM_RES_BIT, THR_IN_PWM_CHAN);
-  ledcAttachChannel(HB_INH_PIN, PWM_FREQ_DEFAULT*1000, THR_PWM_RES_BIT, THR_INH_PWM_CHAN);
+#if defined (HB_OUT_MCPWM)
+  if (!HbMcpwm_Init(HB_IN_PIN, HB_INH_PIN, PWM_FREQ_DEFAULT*100))
+  {
+    Serial.println("MCPWM init failed");
+  }
+  s_pwmPeriodCounts = HbMcpwm_GetPeriod();
+#else
+  s_pwmResBits = ledcResolutionBits(PWM_FREQ_DEFAULT*100);
+  s_pwmPeriodCounts = 1UL << s_pwmResBits;
+  ledcAttachChannel(HB_IN_PIN, PWM_FREQ_DEFAULT*100, s_pwmResBits, THR_IN_PWM_CHAN);
+  ledcAttachChannel(HB_INH_PIN, PWM_FREQ_DEFAULT*100, s_pwmResBits, THR_INH_PWM_CHAN);
+  /* Frequency changes are applied at the timer overflow (see HAL_SetPwmFreq). If the interrupt can not be allocated they are applied immediately */
+  esp_intr_alloc(ETS_LEDC_INTR_SOURCE, ESP_INTR_FLAG_IRAM, pwmTimerOvfISR, NULL, &s_pwmOvfIntr);
+#endif
 
 /* LEDC Chan to Group/Channel/Timer Mapping
 ** ledc: 0  => Group: 0, Channel: 0, Timer: 0
@@ -64,45 +261,91 @@ void HAL_InitHW()
 */
 }
 
-void HALanalogWrite (const int PWMchan, int value)
+/*
+  HALanalogWrite: set the duty of a motor PWM channel, from the next PWM period.
+  Called by the control tick, also while the flash cache is disabled.
+  @param:PWMchan THR_IN_PWM_CHAN or THR_INH_PWM_CHAN, other channels are ignored
+  @param:value [Q16] duty, from 0 to PWM_DUTY_MAX (100%)
+*/
+void IRAM_ATTR HALanalogWrite (const int PWMchan, int value)
 {
-  /* Adapted to new 3.0.0 ESP32 library --> ledcWrite takes input PIN, not CHANNEL */
-  switch (PWMchan)
+  if ((PWMchan != THR_IN_PWM_CHAN) && (PWMchan != THR_INH_PWM_CHAN))
   {
-    case THR_IN_PWM_CHAN:
-      ledcWrite(HB_IN_PIN, (uint32_t)value);
-      break;
-
-    case THR_INH_PWM_CHAN:
-      ledcWrite(HB_INH_PIN, (uint32_t)value);
-      break;
-    
-    default:
-      break;
+    return;
   }
+
+  portENTER_CRITICAL_SAFE(&s_pwmMux);
+  s_pwmDuty[PWMchan] = constrain(value, 0, PWM_DUTY_MAX);
+#if defined (HB_OUT_MCPWM)
+  writeMcpwmDuty();
+#else
+  writeLedcDuty(PWMchan);
+#endif
+  portEXIT_CRITICAL_SAFE(&s_pwmMux);
 }
 
 
-int16_t HAL_ReadTriggerRaw()
+/*
+  HAL_SetHalfBridgePwm: set the duties of the half bridge IN and INH together.
+  With HB_OUT_MCPWM both are loaded at the start of the same PWM period. With the LEDC the two channels latch their duty
+  independently at the timer overflow: an overflow between the two writes gives one period with the new IN and the old INH.
+  @param:inDuty [Q16] IN duty, from 0 to PWM_DUTY_MAX (100%)
+  @param:inhDuty [Q16] INH duty, from 0 to PWM_DUTY_MAX (100%)
+*/
+void IRAM_ATTR HAL_SetHalfBridgePwm(uint32_t inDuty, uint32_t inhDuty)
 {
-  uint16_t retVal = 0;
+  portENTER_CRITICAL_SAFE(&s_pwmMux);
+  s_pwmDuty[THR_IN_PWM_CHAN] = (inDuty > PWM_DUTY_MAX) ? PWM_DUTY_MAX : inDuty;
+  s_pwmDuty[THR_INH_PWM_CHAN] = (inhDuty > PWM_DUTY_MAX) ? PWM_DUTY_MAX : inhDuty;
+#if defined (HB_OUT_MCPWM)
+  writeMcpwmDuty();
+#else
+  writeLedcDuty(THR_IN_PWM_CHAN);
+  writeLedcDuty(THR_INH_PWM_CHAN);
+#endif
+  portEXIT_CRITICAL_SAFE(&s_pwmMux);
+}
 
+
+/*
+  readTriggerRaw: blocking read of the trigger sensor
+  @param:raw [out] raw trigger value, only written if the read succeeded
+  @returns: true if the read succeeded, false on I2C error or short read (error counters are updated)
+*/
+static bool readTriggerRaw(int16_t *raw)
+{
   #if defined (AS5600_MAG) || defined (AS5600L)
-    retVal = as5600.readAngle();
+    *raw = as5600.readAngle();
 
   #elif defined (MT6701_MAG)
-    retVal = mt6701.getAngleDegrees();
+    *raw = mt6701.getAngleDegrees();
 
   #elif defined (ANALOG_TRIG)
-    retVal = analogRead(AN_THROT_PIN);  // keep an analog pin aslso as backup, if I2C magnetic is not going
+    *raw = analogRead(AN_THROT_PIN);  // keep an analog pin aslso as backup, if I2C magnetic is not going
 
   #elif defined (TLE493D_MAG)
     int16_t angle10degXY=-1;// angle in tenth of degree
-    int16_t angle10degYZ=-1;// angle in tenth of degree
-    int16_t zSign,xSign;
-    uint8_t buf[7];
-
-    Wire1.requestFrom(ADDRESS, 4);
+    int16_t xSign;
+    uint8_t buf[4];
+    uint8_t received;
+
+    received = Wire1.requestFrom(ADDRESS, 4);  /* The driver completes the transfer in its ISR: the task sleeps meanwhile */
+    if (received != 4)
+    {
+      if (received == 0)
+      {
+        s_trigAcqStats.busErrorCount++;
+      }
+      else
+      {
+        s_trigAcqStats.shortReadCount++;
+      }
+      while (Wire1.available())  /* Drop partial data */
+      {
+        Wire1.read();
+      }
+      return false;
+    }
 
   for (uint8_t i = 0; i < 4; i++) {
     buf[i] = Wire1.read();
@@ -113,14 +356,549 @@ int16_t HAL_ReadTriggerRaw()
   int16_t Y = (int16_t)((buf[2] << 8) | ((buf[3] & 0x3F) << 2)) >> 2;
   
   xSign = X < 0 ? -1 : 1;
-  angle10degXY=570*(atan2(Y*xSign,X)+1);
-  retVal = angle10degXY;
+  angle10degXY = FixMath_Atan2Deg10(Y * xSign, X);  /* Integer atan2, no floating point in the acquisition */
+  *raw = TLE_RAW_OFFSET + ((angle10degXY * TLE_RAW_PER_DEG10_Q15 + (1L << 14)) >> 15);
   #endif
 
+  return true;
+}
+
+
+/*
+  HAL_ReadTriggerRaw: blocking read of the trigger sensor.
+  The control loop uses the samples of the acquisition task instead (HAL_GetTriggerSample).
+  @returns: raw trigger value, 0 if the read failed
+*/
+int16_t HAL_ReadTriggerRaw()
+{
+  int16_t retVal = 0;
+
+  readTriggerRaw(&retVal);
+
   return retVal;
 }
 
 
+/*
+  triggerTimerISR: HW timer alarm, wakes up the trigger acquisition task
+*/
+static void ARDUINO_ISR_ATTR triggerTimerISR()
+{
+  BaseType_t higherPrioTaskWoken = pdFALSE;
+
+  vTaskNotifyGiveFromISR(s_triggerTask, &higherPrioTaskWoken);
+  portYIELD_FROM_ISR(higherPrioTaskWoken);
+}
+
+
+/*
+  pwmCounter: position in the period of the motor PWM, in counts (0 to pwmPeriodCounts() - 1). LEDC channels 0 and 1 run on timer 0
+*/
+static inline uint32_t pwmCounter()
+{
+#if defined (HB_OUT_MCPWM)
+  return HbMcpwm_GetCounter();
+#else
+  return LEDC.timer_group[LEDC_HIGH_SPEED_MODE].timer[LEDC_TIMER_0].value.timer_cnt;
+#endif
+}
+
+
+/*
+  pwmDuty: duty of a motor PWM channel, in counts (0 to pwmPeriodCounts())
+  @param:PWMchan THR_IN_PWM_CHAN or THR_INH_PWM_CHAN
+*/
+static inline uint32_t pwmDuty(uint8_t PWMchan)
+{
+#if defined (HB_OUT_MCPWM)
+  return HbMcpwm_GetDuty(PWMchan);
+#else
+  return ledc_get_duty(LEDC_HIGH_SPEED_MODE, (ledc_channel_t)PWMchan);
+#endif
+}
+
+
+/*
+  pwmPeriodCounts: counts in a period of the motor PWM
+*/
+static inline uint32_t pwmPeriodCounts()
+{
+  return __atomic_load_n(&s_pwmPeriodCounts, __ATOMIC_RELAXED);
+}
+
+
+/*
+  pwmFreq: motor PWM frequency [Hz]
+*/
+static inline uint32_t pwmFreq()
+{
+#if defined (HB_OUT_MCPWM)
+  return HbMcpwm_GetFreq();
+#else
+  return ledc_get_freq(LEDC_HIGH_SPEED_MODE, LEDC_TIMER_0);
+#endif
+}
+
+
+/*
+  usToPwmCounts: convert a time to counts of the motor PWM
+  @param:time_us [uS] time to be converted
+  @param:freq [Hz] PWM frequency
+  @param:period counts in a PWM period
+*/
+static inline uint32_t usToPwmCounts(uint32_t time_us, uint32_t freq, uint32_t period)
+{
+  return ((uint64_t)time_us * freq * period) / 1000000;
+}
+
+
+/*
+  sampleMotorCurrent: sample the motor current during the on-phase of the PWM and update the average.
+  The current sense output only carries the load current while the high side is on, elsewhere it is 0 or ripple:
+  the LEDC counter of the motor PWM tells where we are in the period (the output is on from counter 0 to the duty),
+  and the ADC is read only if the whole sampling falls in the on-phase, after the sense settled.
+  Called at every acquisition period, that is not commensurate with the PWM period (TRIG_SAMPLE_PERIOD_US), so the samples sweep the on-phase.
+  The average is over the last CURR_AVG_SAMPLES of these sparse samples (~1.5ms at high duty), not over a PWM period.
+  It is dropped when the output goes off, and when no sample fits the on-phase for CURR_AGE_PERIODS PWM periods (duty too short):
+  until CURR_AVG_SAMPLES fresh samples are taken the current is published as CURR_INVALID_MA, never as an old current.
+  The continuous (DMA) ADC mode is not usable here: on the ESP32 it only works on ADC1, HB_AN_PIN is on ADC2.
+*/
+static void sampleMotorCurrent()
+{
+  static uint32_t onPhase_mV[CURR_AVG_SAMPLES];  /* Last on-phase samples */
+  static uint32_t sum_mV = 0;                    /* Sum of onPhase_mV */
+  static uint8_t  idx = 0;
+  static uint8_t  fresh = 0;                     /* Samples in onPhase_mV since it was last dropped, up to CURR_AVG_SAMPLES */
+  static uint32_t lastSample_uS = 0;
+  uint32_t duty, cnt, freq, period, settleCounts, adcCounts, onPhase_mA, current_mA;
+  uint32_t now_uS = micros();
+  bool drop;
+
+  duty = pwmDuty(THR_IN_PWM_CHAN);   /* On-phase length, in counts */
+  freq = pwmFreq();
+  period = pwmPeriodCounts();
+  drop = (duty == 0);
+
+  if (duty > 0)
+  {
+    cnt = pwmCounter();
+    settleCounts = usToPwmCounts(CURR_SETTLE_US, freq, period);
+    adcCounts = usToPwmCounts(CURR_ADC_TIME_US, freq, period);
+
+    if ((cnt >= settleCounts) && (cnt + adcCounts < duty))
+    {
+      sum_mV -= onPhase_mV[idx];
+      onPhase_mV[idx] = analogReadMilliVolts(HB_AN_PIN);
+      sum_mV += onPhase_mV[idx];
+      idx = (idx + 1) % CURR_AVG_SAMPLES;
+      fresh += (fresh < CURR_AVG_SAMPLES);
+      lastSample_uS = now_uS;
+    }
+    else
+    {
+      drop = (fresh > 0) && ((uint64_t)(now_uS - lastSample_uS) * freq > CURR_AGE_PERIODS * 1000000ULL);
+    }
+  }
+
+  if (drop)
+  {
+    for (idx = 0; idx < CURR_AVG_SAMPLES; idx++)
+    {
+      onPhase_mV[idx] = 0;
+    }
+    sum_mV = 0;
+    idx = 0;
+    fresh = 0;
+  }
+
+  if (duty == 0)
+  {
+    __atomic_store_n(&s_motorCurrent_mA, 0, __ATOMIC_RELAXED);   /* Output off: no current */
+    __atomic_store_n(&s_motorOnCurrent_mA, 0, __ATOMIC_RELAXED);
+    return;
+  }
+  if (fresh < CURR_AVG_SAMPLES)
+  {
+    __atomic_store_n(&s_motorCurrent_mA, CURR_INVALID_MA, __ATOMIC_RELAXED);
+    __atomic_store_n(&s_motorOnCurrent_mA, CURR_INVALID_MA, __ATOMIC_RELAXED);
+    return;
+  }
+
+  /* Load current = DK * sense current. The sense is the on-phase current, the average over the period is scaled by the duty */
+  onPhase_mA = (sum_mV / CURR_AVG_SAMPLES) * CURR_SENSE_DK / CURR_SENSE_R_OHM;
+  current_mA = ((uint64_t)onPhase_mA * duty) / period;
+  __atomic_store_n(&s_motorCurrent_mA, (int16_t)((current_mA > INT16_MAX) ? INT16_MAX : current_mA), __ATOMIC_RELAXED);
+  __atomic_store_n(&s_motorOnCurrent_mA, (int16_t)((onPhase_mA > INT16_MAX) ? INT16_MAX : onPhase_mA), __ATOMIC_RELAXED);
+}
+
+
+/*
+  sampleBackEmf: sample the motor back EMF while the half bridge output floats, and update the filtered value.
+  The output is driven while INH is high (high side on, then low side for the drag brake), from counter 0 to the INH duty:
+  after that, once the recirculation current has died out, the motor terminal shows the back EMF.
+  With a high current it can still recirculate after BEMF_SETTLE_US: those samples are dropped (Bemf_IsFreewheeling).
+  Without a floating window (full throttle, or full drag brake) the last value is kept.
+*/
+static void sampleBackEmf()
+{
+  static BemfFilter_type filter = { 0, false };
+  uint32_t inhDuty, cnt, freq, period, sample_mV;
+
+  inhDuty = pwmDuty(THR_INH_PWM_CHAN);
+  cnt = pwmCounter();
+  freq = pwmFreq();
+  period = pwmPeriodCounts();
+
+  if ((cnt >= inhDuty + usToPwmCounts(BEMF_SETTLE_US, freq, period)) && (cnt + usToPwmCounts(CURR_ADC_TIME_US, freq, period) < period))
+  {
+    sample_mV = (analogReadMilliVolts(AN_MOT_BEMF) * (RBEMFL + RBEMFH)) / RBEMFL;  /* Voltage at the motor, before the divider */
+    if (!Bemf_IsFreewheeling(sample_mV, s_motorOnCurrent_mA))  /* Same task as sampleMotorCurrent(), no atomic needed */
+    {
+      __atomic_store_n(&s_motorBemf_mV, Bemf_Update(&filter, sample_mV), __ATOMIC_RELAXED);
+    }
+  }
+}
+
+
+/*
+  triggerSamplerTask: acquisition task. At every timer alarm it reads the trigger sensor, filters it and publishes the sample in the
+  double buffer, then samples the motor current and back EMF.
+  The filter runs here and not in the control tick, so it sees every sample (the tick runs at about half the acquisition rate).
+  While the I2C transfer is on the bus the task is blocked on the driver, so the CPU is free for the other tasks.
+  The time of every sensor read is accounted in s_trigAcqStats: it is the share of TRIG_SAMPLE_PERIOD_US the sensor takes.
+*/
+static void triggerSamplerTask(void *pvParameters)
+{
+  int16_t raw;
+  uint32_t seq = 0, readStart_uS, read_uS;
+  uint8_t next, filterReq;
+  bool readOk;
+
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    filterReq = __atomic_load_n(&s_trigFilterReq, __ATOMIC_RELAXED);
+    if (filterReq != s_trigFilter.type)  /* Other filter selected: restart from the next sample */
+    {
+      TrigFilter_Init(&s_trigFilter, filterReq, s_trigFilter.samplePeriod_uS);
+    }
+
+    readStart_uS = micros();
+    readOk = readTriggerRaw(&raw);
+    read_uS = micros() - readStart_uS;
+    s_trigAcqStats.readCount++;
+    s_trigAcqStats.readSum_uS += read_uS;
+    if (read_uS > s_trigAcqStats.readMax_uS)
+    {
+      s_trigAcqStats.readMax_uS = read_uS;
+    }
+
+    if (readOk)
+    {
+      next = s_trigLatest ^ 1;
+      s_trigSample[next].raw = raw;
+      s_trigSample[next].filtered = TrigFilter_Update(&s_trigFilter, raw);
+      s_trigSample[next].timestamp_uS = micros();
+      s_trigSample[next].seq = ++seq;
+      __atomic_store_n(&s_trigLatest, next, __ATOMIC_RELEASE);
+    }
+
+    sampleMotorCurrent();
+    sampleBackEmf();
+  }
+}
+
+
+/*
+  HAL_StartTriggerSampler: start the trigger acquisition task and its HW timer, on the core calling this function
+  @param:period_us acquisition period in [uS]
+*/
+void HAL_StartTriggerSampler(uint32_t period_us)
+{
+  TrigFilter_Init(&s_trigFilter, s_trigFilterReq, period_us);
+  xTaskCreatePinnedToCore(triggerSamplerTask, "TrigAcq", TRIG_SAMPLE_TASK_STACK, NULL, TRIG_SAMPLE_TASK_PRIO, &s_triggerTask, xPortGetCoreID());
+
+  s_triggerTimer = timerBegin(TIMER_FREQ);
+  timerAttachInterrupt(s_triggerTimer, &triggerTimerISR);
+  timerAlarm(s_triggerTimer, period_us, true, 0);
+}
+
+
+/*
+  HAL_GetTriggerSample: get the newest trigger sample, without waiting for the sensor
+  @param:sample [out] newest sample (seq is 0 if no sample was acquired yet)
+*/
+void IRAM_ATTR HAL_GetTriggerSample(TriggerSample_type *sample)
+{
+  *sample = s_trigSample[__atomic_load_n(&s_trigLatest, __ATOMIC_ACQUIRE)];
+}
+
+
+/*
+  HAL_SetTriggerFilter: select the trigger filter, applied by the acquisition task from its next sample
+  @param:type TrigFilter_enum
+*/
+void HAL_SetTriggerFilter(uint8_t type)
+{
+  __atomic_store_n(&s_trigFilterReq, (type < TRIG_FILTER_COUNT) ? type : (uint8_t)TRIG_FILTER_AVG2, __ATOMIC_RELAXED);
+}
+
+
+/*
+  HAL_GetTriggerFilterDelay_uS: group delay of the trigger filter in use, for the diagnostics
+  @returns: [uS] group delay now (it changes with the trigger speed for the One-Euro filter)
+*/
+uint32_t HAL_GetTriggerFilterDelay_uS()
+{
+  return TrigFilter_GroupDelay_uS(&s_trigFilter);
+}
+
+
+/*
+  HAL_GetTriggerAcqStats: get the trigger acquisition error counters and read time.
+  Copied while the acquisition task may be updating them: a read may be half updated, acceptable for diagnostics
+*/
+void HAL_GetTriggerAcqStats(TriggerAcqStats_type *stats)
+{
+  *stats = s_trigAcqStats;
+}
+
+
+/*
+  HAL_GetMotorCurrent_mA: averaged motor current, updated by the acquisition task. Only reads a variable, no ADC access
+  The on-phase current of the last CURR_AVG_SAMPLES sparse samples (~1.5ms), scaled by the duty (see sampleMotorCurrent())
+  @returns: [mA] motor current, 0 with the output off, CURR_INVALID_MA until CURR_AVG_SAMPLES fresh samples are taken
+*/
+int16_t IRAM_ATTR HAL_GetMotorCurrent_mA()
+{
+  return __atomic_load_n(&s_motorCurrent_mA, __ATOMIC_RELAXED);
+}
+
+
+/*
+  HAL_GetMotorOnCurrent_mA: motor current during the PWM on-phase, the current the half bridge high side carries.
+  Same on-phase samples (and average) as HAL_GetMotorCurrent_mA(), not scaled by the duty. Only reads a variable, no ADC access
+  @returns: [mA] on-phase motor current, 0 with the output off, CURR_INVALID_MA until CURR_AVG_SAMPLES fresh samples are taken
+*/
+int16_t IRAM_ATTR HAL_GetMotorOnCurrent_mA()
+{
+  return __atomic_load_n(&s_motorOnCurrent_mA, __ATOMIC_RELAXED);
+}
+
+
+/*
+  HAL_GetMotorBemf_mV: filtered motor back EMF, updated by the acquisition task. Only reads a variable, no ADC access
+  @returns: [mV] motor back EMF
+*/
+uint16_t IRAM_ATTR HAL_GetMotorBemf_mV()
+{
+  return __atomic_load_n(&s_motorBemf_mV, __ATOMIC_RELAXED);
+}
+
+
+/*
+  HAL_GetPwmWriteStats: get the motor PWM duty write counters (see pwmCountsChanged())
+  @param:stats [out] duty writes done and skipped since startup
+*/
+void HAL_GetPwmWriteStats(PwmWriteStats_type *stats)
+{
+  portENTER_CRITICAL(&s_pwmMux);
+  *stats = s_pwmWriteStats;
+  portEXIT_CRITICAL(&s_pwmMux);
+}
+
+
+/*
+  HAL_SetPwmFreq: change the motor PWM frequency, without detaching the pins.
+  The LEDC timer shared by THR_IN_PWM_CHAN and THR_INH_PWM_CHAN gets the highest resolution the frequency allows (see ledcResolutionBits()),
+  and is reprogrammed at the timer overflows (see pwmTimerOvfISR()), so no period is cut or mixed between the two channels.
+  The duties are rewritten in counts of the new period: the duty ratio and so the average motor voltage stay the same across the change.
+  With HB_OUT_MCPWM the MCPWM timer period is changed instead (see HbMcpwm_SetFreq()).
+  @param:freq_Hz [Hz] new frequency
+  @returns: false if the frequency is out of the divider range (nothing changed)
+*/
+bool HAL_SetPwmFreq(uint32_t freq_Hz)
+{
+#if defined (HB_OUT_MCPWM)
+  bool ok;
+
+  portENTER_CRITICAL(&s_pwmMux);
+  ok = HbMcpwm_SetFreq(freq_Hz);
+  if (ok)   /* The new compare values are loaded with the new period */
+  {
+    s_pwmPeriodCounts = HbMcpwm_GetPeriod();
+    writeMcpwmDuty();
+  }
+  portEXIT_CRITICAL(&s_pwmMux);
+
+  return ok;
+#else
+  uint32_t divider;
+  uint8_t resBits;
+
+  if (freq_Hz == 0)
+  {
+    return false;
+  }
+  resBits = ledcResolutionBits(freq_Hz);
+  divider = ((uint64_t)APB_CLK_FREQ << LEDC_DIV_FRAC_BITS) / ((uint64_t)freq_Hz << resBits);  /* 10.8 fixed point */
+  if ((divider < (1UL << LEDC_DIV_FRAC_BITS)) || (divider > LEDC_DIV_NUM_HSTIMER0_V))
+  {
+    return false;
+  }
+
+  portENTER_CRITICAL(&s_pwmMux);
+  s_pwmDivider = divider;
+  s_pwmResBits = resBits;
+  if (s_pwmOvfIntr != NULL)
+  {
+    LEDC.int_clr.val = LEDC_HSTIMER0_OVF_INT_CLR;
+    LEDC.int_ena.val |= LEDC_HSTIMER0_OVF_INT_ENA;
+  }
+  else
+  {
+    ledc_ll_set_clock_divider(&LEDC, LEDC_HIGH_SPEED_MODE, LEDC_TIMER_0, divider);
+    ledc_ll_set_duty_resolution(&LEDC, LEDC_HIGH_SPEED_MODE, LEDC_TIMER_0, resBits);
+    s_pwmPeriodCounts = 1UL << resBits;
+    writeLedcDuty(THR_IN_PWM_CHAN);
+    writeLedcDuty(THR_INH_PWM_CHAN);
+  }
+  portEXIT_CRITICAL(&s_pwmMux);
+
+  return true;
+#endif
+}
+
+
+#if defined (CONFIG_GPTIMER_ISR_IRAM_SAFE)
+/*
+  controlTimerAlarm: control timer alarm callback, runs the control tick.
+  With CONFIG_GPTIMER_ISR_IRAM_SAFE the gptimer interrupt is IRAM: it keeps running while the flash cache is disabled (NVS writes),
+  when no task can run. The driver re-arms the auto reload alarm.
+*/
+static bool IRAM_ATTR controlTimerAlarm(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *userCtx)
+{
+  s_controlTick();
+
+  return false;   /* No task woken */
+}
+#else
+/*
+  controlTimerISR: HW timer alarm, runs the control tick.
+  Allocated with ESP_INTR_FLAG_IRAM: it keeps running while the flash cache is disabled (NVS writes), when no task can run.
+*/
+static void IRAM_ATTR controlTimerISR(void *arg)
+{
+  timer_ll_clear_intr_status(&TIMERG1, TIMER_LL_EVENT_ALARM(CONTROL_TIMER_NUM));
+  timer_ll_enable_alarm(&TIMERG1, CONTROL_TIMER_NUM, true);   /* The alarm disables itself when it fires */
+
+  s_controlTick();
+}
+
+
+/*
+  reserveControlTimer: take timer group 1, timer CONTROL_TIMER_NUM from the gptimer driver, so that no later gptimer_new_timer()
+  (timerBegin() included) hands it out while it is driven at register level.
+  The driver does not take a timer id: timers are taken from it until the one it gives is found to be this one
+  (its count shows up in the counter of this timer), the others are given back.
+  @returns: driver handle of the timer, NULL if the driver already gave it to someone else
+*/
+static gptimer_handle_t reserveControlTimer()
+{
+  gptimer_handle_t taken[SOC_TIMER_GROUP_TOTAL_TIMERS];
+  gptimer_handle_t reserved = NULL;
+  gptimer_config_t config = {};
+  uint8_t n = 0;
+
+  config.clk_src = GPTIMER_CLK_SRC_DEFAULT;
+  config.direction = GPTIMER_COUNT_UP;
+  config.resolution_hz = TIMER_FREQ;
+
+  while ((reserved == NULL) && (n < SOC_TIMER_GROUP_TOTAL_TIMERS) && (gptimer_new_timer(&config, &taken[n]) == ESP_OK))
+  {
+    gptimer_set_raw_count(taken[n], CONTROL_TIMER_PROBE_COUNT);
+    timer_ll_trigger_soft_capture(&TIMERG1, CONTROL_TIMER_NUM);
+    if (timer_ll_get_counter_value(&TIMERG1, CONTROL_TIMER_NUM) == CONTROL_TIMER_PROBE_COUNT)
+    {
+      reserved = taken[n];
+    }
+    else
+    {
+      n++;
+    }
+  }
+  while (n > 0)
+  {
+    gptimer_del_timer(taken[--n]);
+  }
+
+  return reserved;
+}
+#endif
+
+
+/*
+  HAL_StartControlTimer: start a HW timer that calls the control tick every period_us, from an IRAM interrupt.
+  The timer is allocated from the gptimer driver. With CONFIG_GPTIMER_ISR_IRAM_SAFE the driver runs it, otherwise (the Arduino
+  core default) the driver interrupt is not IRAM safe: the timer is reserved in the driver and driven at register level
+  (timer group 1, timer CONTROL_TIMER_NUM), with an IRAM interrupt of its own.
+  The interrupt is allocated on the core calling this function.
+  @param:period_us control period in [uS]
+  @param:tick control tick. It runs in the ISR: it must be IRAM_ATTR, use only DRAM data and call only IRAM functions
+*/
+void HAL_StartControlTimer(uint32_t period_us, ControlTickFunction_type tick)
+{
+  s_controlTick = tick;
+
+#if defined (CONFIG_GPTIMER_ISR_IRAM_SAFE)
+  gptimer_config_t config = {};
+  gptimer_alarm_config_t alarm = {};
+  gptimer_event_callbacks_t callbacks = {};
+
+  config.clk_src = GPTIMER_CLK_SRC_DEFAULT;
+  config.direction = GPTIMER_COUNT_UP;
+  config.resolution_hz = TIMER_FREQ;    /* 1 tick = 1uS */
+  alarm.alarm_count = period_us;
+  alarm.reload_count = 0;
+  alarm.flags.auto_reload_on_alarm = true;
+  callbacks.on_alarm = controlTimerAlarm;
+
+  if ((gptimer_new_timer(&config, &s_controlTimer) != ESP_OK) ||
+      (gptimer_set_alarm_action(s_controlTimer, &alarm) != ESP_OK) ||
+      (gptimer_register_event_callbacks(s_controlTimer, &callbacks, NULL) != ESP_OK) ||
+      (gptimer_enable(s_controlTimer) != ESP_OK) ||
+      (gptimer_start(s_controlTimer) != ESP_OK))
+  {
+    Serial.println("Control timer init failed");
+  }
+#else
+  s_controlTimer = reserveControlTimer();
+  if (s_controlTimer == NULL)
+  {
+    Serial.println("Control timer already taken");
+    return;
+  }
+
+  timer_ll_enable_counter(&TIMERG1, CONTROL_TIMER_NUM, false);
+  timer_ll_set_clock_source(&TIMERG1, CONTROL_TIMER_NUM, GPTIMER_CLK_SRC_APB);
+  timer_ll_set_clock_prescale(&TIMERG1, CONTROL_TIMER_NUM, APB_CLK_FREQ / TIMER_FREQ);   /* Timer counts at TIMER_FREQ (1 tick = 1uS) */
+  timer_ll_set_count_direction(&TIMERG1, CONTROL_TIMER_NUM, GPTIMER_COUNT_UP);
+  timer_ll_set_reload_value(&TIMERG1, CONTROL_TIMER_NUM, 0);
+  timer_ll_trigger_soft_reload(&TIMERG1, CONTROL_TIMER_NUM);
+  timer_ll_set_alarm_value(&TIMERG1, CONTROL_TIMER_NUM, period_us);
+  timer_ll_enable_auto_reload(&TIMERG1, CONTROL_TIMER_NUM, true);
+  timer_ll_clear_intr_status(&TIMERG1, TIMER_LL_EVENT_ALARM(CONTROL_TIMER_NUM));
+  timer_ll_enable_intr(&TIMERG1, TIMER_LL_EVENT_ALARM(CONTROL_TIMER_NUM), true);
+
+  esp_intr_alloc(CONTROL_TIMER_INTR_SOURCE, ESP_INTR_FLAG_IRAM, controlTimerISR, NULL, &s_controlIntr);
+
+  timer_ll_enable_alarm(&TIMERG1, CONTROL_TIMER_NUM, true);
+  timer_ll_enable_counter(&TIMERG1, CONTROL_TIMER_NUM, true);
+#endif
+}
+
+
 void HAL_PinSetup()
 {
   pinMode(BUZZ_PIN, OUTPUT);     // Set BUZZ_PIN pin as an output
@@ -25,9 +25,9 @@
 /********** ADC **********/
 #define THROTTLE_NORMALIZED         256
 #define THROTTLE_DEADBAND_PERC      3  /* [%]percent of throtthe that is considered 100% or 0%, when the wiper is close to the travel edges */
-#define THROTTLE_DEADBAND_NORM      ((THROTTLE_DEADBAND_PERC*THROTTLE_NORMALIZED)/100)
-#define THROTTLE_NOISE_PERC         2
-#define THROTTLE_NOISE_NORM         ((THROTTLE_NOISE_PERC*THROTTLE_NORMALIZED)/100)
+#define THROTTLE_DEADBAND_Q16       ((THROTTLE_DEADBAND_PERC*65535UL)/100)  /* [Q16] deadband, trigger position from 0 to 65535 */
+#define THROTTLE_NOISE_PERC         2  /* [%] trigger moves smaller than this, after a change of direction, are taken as noise */
+#define THROTTLE_NOISE_Q16          ((THROTTLE_NOISE_PERC*65535UL)/100)  /* [Q16] noise gate, trigger position from 0 to 65535 */
 #define ACD_RESOLUTION_STEPS 4095
 
 #define VIN_CAL_SET 1200
@@ -42,7 +42,12 @@
 #define THR_INH_PWM_CHAN  1     /* ESP32 has 16 channels which can generate 16 independent waveforms */
 #define BUZZ_CHAN         6     /* PWM channel used to generate tone on buzzer */ 
 //#define THR_PWM_FREQ      5     /* kHz Recall that Arduino Uno is ~490 Hz. Official ESP32 example uses 5,000Hz */
-#define THR_PWM_RES_BIT   8     /* We'll use same resolution as Uno (8 bits, 0-255) but ESP32 can go up to 16 bits */ 
+#define PWM_RES_MAX_BIT   16    /* Max LEDC resolution: the one used is the highest the PWM frequency allows (16 bits at 1kHz, 13 at 5kHz) */
+#define PWM_DUTY_MAX      65535 /* Motor PWM duties are Q16, PWM_DUTY_MAX is 100% (output always on) */
+#define PWM_DITHER              /* Sigma-delta dithering of the duty bits the PWM resolution can not show, comment out to round instead */
+#define LEDC_DIV_FRAC_BITS 8    /* The LEDC timer divider is a 10.8 fixed point number */
+//#define HB_OUT_MCPWM            /* define HB_OUT_MCPWM to drive IN and INH with the MCPWM (see hb_mcpwm.h) instead of two LEDC channels:
+//                                   both duties are loaded in the same period, optional dead time, PWM event for the ADC sampling */
 
 /******** TRIGGER ********/
 //#define AS5600_MAG  // DEFAULT WORKING
@@ -51,6 +56,35 @@
 //#define ANALOG_TRIG  // define ANALOG_TRIG in case you are using potentiometer , or magnetic with simple analog output as trigger
 //#define MT6701_MAG  // define MT6701_MAG if you are using a MT6701 magnetic sensor
 
+#define TRIG_SAMPLE_PERIOD_US   247   /* [uS] Acquisition period, runs faster than the control tick (ESC_PERIOD_US).
+                                         Not a round number on purpose: the current and back EMF samples must sweep the whole PWM period,
+                                         with 250uS they would hit only 4 points of it at 3kHz (and similar at every PWM_F step) */
+#define TRIG_SAMPLE_TASK_PRIO   3     /* Acquisition task priority, above Task2: it only runs to start/complete a transfer */
+#define TRIG_SAMPLE_TASK_STACK  3000
+
+/**** CONTROL TIMER ******/
+/* Without CONFIG_GPTIMER_ISR_IRAM_SAFE: timer group 1, last timer, reserved in the gptimer driver and driven at register level.
+   The driver (and timerBegin, used for the trigger acquisition) hands out timers from group 0 first */
+#define CONTROL_TIMER_NUM         1
+#define CONTROL_TIMER_INTR_SOURCE ETS_TG1_T1_LEVEL_INTR_SOURCE
+#define CONTROL_TIMER_PROBE_COUNT 0x5EED32ULL   /* Count written through the driver to find which timer it gave */
+
+/**** MOTOR CURRENT ******/
+/* Sampled on HB_AN_PIN by the acquisition task, only during the on-phase of the PWM (see sampleMotorCurrent() in HAL.cpp) */
+#define CURR_SENSE_R_OHM    2000    /* [Ohm] current sense resistor, same as hw_conf in half_bridge.cpp */
+#define CURR_SENSE_DK       50000   /* Differential current sense ratio of the BTN99x0, same as set_dk() in half_bridge.cpp */
+#define CURR_AVG_SAMPLES    6       /* Number of on-phase samples averaged (~1.5ms): longer is steadier, but delays the spin detection */
+#define CURR_SETTLE_US      5       /* [uS] current sense output settling time after the high side switches on */
+#define CURR_ADC_TIME_US    15      /* [uS] from the on-phase check to the end of the ADC sampling (analogReadMilliVolts) */
+#define CURR_AGE_PERIODS    16      /* PWM periods without an on-phase sample (duty too short to sample) after which the average is
+                                       dropped: 3.2ms at 5kHz, longer than the gap between samples at a duty that can just be sampled */
+
+/**** MOTOR BACK EMF *****/
+/* Sampled on AN_MOT_BEMF by the acquisition task, only while the half bridge output floats (see sampleBackEmf() in HAL.cpp) */
+#define RBEMFL              2200UL  /* [Ohm] back EMF ADC resistor divider, lower resistor (same divider as Vin) */
+#define RBEMFH              10000UL /* [Ohm] back EMF ADC resistor divider, upper resistor */
+#define BEMF_SETTLE_US      30      /* [uS] after the switch off the motor current recirculates in the body diodes, the output is not the back EMF yet */
+
 #if defined (AS5600_MAG) || defined (AS5600L)
   #define THROTTLE_REV        1  /* if 1 the throttle is at full press when the ADC value is the minimum (inverted) */
 #elif defined (MT6701_MAG)
@@ -108,14 +142,57 @@
 #define BUTT_PIN   13   /* Button */
 #define BUZZ_PIN   18   /* minislotESC V2.1 /
 
+/*********************************************************************************************************************/
+/*-------------------------------------------------Data Structures---------------------------------------------------*/
+/*********************************************************************************************************************/
+
+/* TriggerSample_type: a trigger reading, as published by the acquisition task */
+typedef struct {
+  int16_t   raw;            /* [raw] trigger reading */
+  int16_t   filtered;       /* [raw] trigger reading after the trigger filter (see HAL_SetTriggerFilter) */
+  uint32_t  timestamp_uS;   /* [uS] time the reading completed */
+  uint32_t  seq;            /* Sample counter, increases by 1 every valid sample (0: no sample yet) */
+} TriggerSample_type;
+
+
+/* TriggerAcqStats_type: trigger acquisition error counters and sensor read time */
+typedef struct {
+  uint32_t  busErrorCount;  /* I2C transfers that returned no data (NACK, timeout, bus error) */
+  uint32_t  shortReadCount; /* I2C transfers that returned less bytes than requested */
+  uint32_t  readCount;      /* Sensor reads by the acquisition task, failed ones included */
+  uint64_t  readSum_uS;     /* [uS] sum of the read times (I2C transfer and decoding), used for the average */
+  uint32_t  readMax_uS;     /* [uS] longest read */
+} TriggerAcqStats_type;
+
+/* PwmWriteStats_type: motor PWM duty writes, one per channel. A write with the same counts already in the output stage is skipped */
+typedef struct {
+  uint32_t  writeCount;     /* Duty register writes */
+  uint32_t  skipCount;      /* Duty writes skipped, the counts did not change */
+} PwmWriteStats_type;
+
+/* Control tick, called by the control timer ISR */
+typedef void (*ControlTickFunction_type)(void);
+
 /*********************************************************************************************************************/
 /*------------------------------------------------Function Prototypes------------------------------------------------*/
 /*********************************************************************************************************************/
 void     HAL_InitHW();
 uint16_t HAL_ReadVoltageDivider(int AnalogInput, uint32_t rvfbl, uint32_t rvfbh);
 int16_t  HAL_ReadTriggerRaw();
+void     HAL_StartTriggerSampler(uint32_t period_us);
+void     HAL_GetTriggerSample(TriggerSample_type *sample);
+void     HAL_GetTriggerAcqStats(TriggerAcqStats_type *stats);
+void     HAL_SetTriggerFilter(uint8_t type);
+uint32_t HAL_GetTriggerFilterDelay_uS();
+int16_t  HAL_GetMotorCurrent_mA();
+int16_t  HAL_GetMotorOnCurrent_mA();
+uint16_t HAL_GetMotorBemf_mV();
 void     HALanalogWrite (int PWMchan, int value);
+void     HAL_SetHalfBridgePwm(uint32_t inDuty, uint32_t inhDuty);
+bool     HAL_SetPwmFreq(uint32_t freq_Hz);
+void     HAL_GetPwmWriteStats(PwmWriteStats_type *stats);
 void     HAL_PinSetup();
+void     HAL_StartControlTimer(uint32_t period_us, ControlTickFunction_type tick);
 uint16_t HAL_AdcRawToPct(uint16_t raw, uint16_t min, uint16_t max, bool reverse);
 
 void sound(note_t note,int ms);
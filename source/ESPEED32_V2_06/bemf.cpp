@@ -0,0 +1,88 @@
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "bemf.h"
+
+/*********************************************************************************************************************/
+/*---------------------------------------------Function Implementations----------------------------------------------*/
+/*********************************************************************************************************************/
+
+/*
+  Bemf_Reset: clear the filter, the next sample is taken as it is
+  @param:filter back EMF filter
+*/
+void Bemf_Reset(BemfFilter_type *filter)
+{
+  filter->bemfQ16 = 0;
+  filter->primed = false;
+}
+
+
+/*
+  Bemf_IsFreewheeling: tell a sample taken while the motor current still recirculates from a back EMF sample.
+  After the switch off the motor inductance keeps the current flowing through the low side body diode, the terminal is clamped
+  just below ground: with a high current and a low back EMF this lasts longer than BEMF_SETTLE_US (about L * I / (Vd + BEMF)),
+  and the sample reads ~0 at any speed. Such samples must not reach the filter, that would drag the estimate to 0 under load.
+  A real back EMF that low with that much current is a stalled motor: the last estimate is kept, and it was low already.
+  @param:sample_mV [mV] motor voltage measured in the floating window
+  @param:onCurrent_mA [mA] motor current in the PWM on-phase (0 with the output off)
+  @returns: true if the sample is the diode clamp and has to be dropped
+*/
+bool Bemf_IsFreewheeling(uint16_t sample_mV, int16_t onCurrent_mA)
+{
+  return (sample_mV < BEMF_FREEWHEEL_MV) && (onCurrent_mA > BEMF_FREEWHEEL_MA);
+}
+
+
+/*
+  Bemf_Update: add a back EMF sample to the first order low pass filter.
+  The samples come from the PWM coast window only, so they are not evenly spaced in time: the filter counts samples, not time.
+  @param:filter back EMF filter
+  @param:sample_mV [mV] motor voltage measured while the half bridge output is floating
+  @returns: [mV] filtered back EMF
+*/
+uint16_t Bemf_Update(BemfFilter_type *filter, uint16_t sample_mV)
+{
+  int32_t sampleQ16;
+
+  if (sample_mV > BEMF_MAX_MV)
+  {
+    sample_mV = BEMF_MAX_MV;
+  }
+  sampleQ16 = (int32_t)sample_mV << 16;
+
+  if (!filter->primed)
+  {
+    filter->bemfQ16 = sampleQ16;
+    filter->primed = true;
+  }
+  else
+  {
+    filter->bemfQ16 += (sampleQ16 - (int32_t)filter->bemfQ16) >> BEMF_FILTER_SHIFT;
+  }
+
+  return (filter->bemfQ16 + (1UL << 15)) >> 16;
+}
+
+
+/*
+  Bemf_SpeedPermille: motor speed estimated from the back EMF, as a fraction of the no load speed at the supply voltage.
+  The back EMF is proportional to the speed, and reaches (almost) the supply voltage at no load full throttle:
+  the ratio does not need the motor constant, that is different for every car.
+  @param:bemf_mV [mV] filtered back EMF
+  @param:vin_mV [mV] supply voltage
+  @returns: [permille] estimated speed, from 0 to 1000. 0 if the supply voltage is not known yet
+*/
+uint16_t IRAM_ATTR Bemf_SpeedPermille(uint16_t bemf_mV, uint16_t vin_mV)
+{
+  uint32_t speed;
+
+  if (vin_mV == 0)
+  {
+    return 0;
+  }
+
+  speed = ((uint32_t)bemf_mV * 1000) / vin_mV;
+
+  return (speed > 1000) ? 1000 : speed;
+}
@@ -0,0 +1,35 @@
+#ifndef BEMF_H_
+#define BEMF_H_
+
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "ctrlbase.h"
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------------Macros------------------------------------------------------*/
+/*********************************************************************************************************************/
+#define BEMF_FILTER_SHIFT   3       /* Low pass filter weight of a new sample is 1/2^BEMF_FILTER_SHIFT (8 samples time constant) */
+#define BEMF_MAX_MV         30000   /* [mV] samples are clamped to this, keeps the Q16 filter state in 32 bits */
+#define BEMF_FREEWHEEL_MV   300     /* [mV] a sample below this, with current in the on-phase, is the low side diode clamp, not the back EMF */
+#define BEMF_FREEWHEEL_MA   200     /* [mA] on-phase current above which the recirculation can outlast BEMF_SETTLE_US */
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------Data Structures---------------------------------------------------*/
+/*********************************************************************************************************************/
+
+/* BemfFilter_type: state of the back EMF low pass filter. Reset it with Bemf_Reset() */
+typedef struct {
+  uint32_t  bemfQ16;  /* [Q16 mV] filtered back EMF */
+  bool      primed;   /* false until the first sample, that initializes the filter */
+} BemfFilter_type;
+
+/*********************************************************************************************************************/
+/*------------------------------------------------Function Prototypes------------------------------------------------*/
+/*********************************************************************************************************************/
+void     Bemf_Reset(BemfFilter_type *filter);
+bool     Bemf_IsFreewheeling(uint16_t sample_mV, int16_t onCurrent_mA);
+uint16_t Bemf_Update(BemfFilter_type *filter, uint16_t sample_mV);
+uint16_t Bemf_SpeedPermille(uint16_t bemf_mV, uint16_t vin_mV);
+
+#endif
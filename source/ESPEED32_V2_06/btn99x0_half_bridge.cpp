@@ -111,12 +111,10 @@ void HalfBridge::set_pwm(uint8_t duty)
  */
 void HalfBridge::set_pwm_in_percentage(uint8_t duty_in_pct)
 {
-    uint8_t duty8bit;
     if((duty_in_pct <= 100) & (duty_in_pct >= 0))
     {
-      duty8bit = duty_in_pct*255/100;
-      HALanalogWrite(THR_IN_PWM_CHAN, duty8bit);
-      HALanalogWrite(THR_INH_PWM_CHAN, 255);
+      HALanalogWrite(THR_IN_PWM_CHAN, (uint32_t)duty_in_pct*PWM_DUTY_MAX/100);
+      HALanalogWrite(THR_INH_PWM_CHAN, PWM_DUTY_MAX);
     };
 }
 
@@ -128,12 +126,10 @@ void HalfBridge::set_pwm_in_percentage(uint8_t duty_in_pct)
  */
 void HalfBridge::set_pwm_inh_percentage(uint8_t duty_in_pct)
 {
-  uint8_t duty8bit;
   if((duty_in_pct <= 100) & (duty_in_pct >= 0))
   {
-    duty8bit = duty_in_pct*255/100;
-    HALanalogWrite(THR_IN_PWM_CHAN, 255);
-    HALanalogWrite(THR_INH_PWM_CHAN, duty8bit);
+    HALanalogWrite(THR_IN_PWM_CHAN, PWM_DUTY_MAX);
+    HALanalogWrite(THR_INH_PWM_CHAN, (uint32_t)duty_in_pct*PWM_DUTY_MAX/100);
   };
 }
 
@@ -144,26 +140,33 @@ void HalfBridge::set_pwm_inh_percentage(uint8_t duty_in_pct)
  * @details     The PWM signal is provided at the half-bridge inhibit pin, the in pin is kept high
  * @param[in]   duty_in_pct Duty cycle in percentage from 0 % to 100 %
  * @pre         None
+ * @note        IRAM: called by the control tick, that runs in an ISR also while the flash cache is disabled
  */
-void HalfBridge::set_pwm_drag(uint8_t duty_in_pct, uint8_t drag_pct)
+void IRAM_ATTR HalfBridge::set_pwm_drag(uint8_t duty_in_pct, uint8_t drag_pct)
 {
-  uint16_t drag8bit,duty8bit,inh8bit;
-  
   duty_in_pct = constrain(duty_in_pct,0,100); // limit in put parameters to 0-100[%]
   drag_pct = constrain(drag_pct,0,100);
-  
-  duty8bit = ((uint16_t)duty_in_pct*255 )/100;
 
-  drag8bit = ((uint16_t)drag_pct*255 )/100;
+  set_pwm_drag_q16(((uint32_t)duty_in_pct*PWM_DUTY_MAX)/100, ((uint32_t)drag_pct*PWM_DUTY_MAX)/100);
+}
+
 
-  inh8bit = (duty8bit + drag8bit);          //HBridge enable has to last for the high side on phase+ drag (where Low side will be activated)
-  
-  inh8bit = constrain(inh8bit,0,255);
+/**
+ * @brief       Same as set_pwm_drag(), with the full PWM resolution
+ * @param[in]   duty_q16 Duty cycle from 0 to PWM_DUTY_MAX (100 %)
+ * @param[in]   drag_q16 Drag brake from 0 to PWM_DUTY_MAX (100 %)
+ * @pre         None
+ * @note        IRAM: called by the control tick, that runs in an ISR also while the flash cache is disabled
+ */
+void IRAM_ATTR HalfBridge::set_pwm_drag_q16(uint16_t duty_q16, uint16_t drag_q16)
+{
+  uint32_t inh_q16;
 
-  HALanalogWrite(THR_IN_PWM_CHAN, duty8bit);
+  inh_q16 = (uint32_t)duty_q16 + drag_q16;  //HBridge enable has to last for the high side on phase+ drag (where Low side will be activated)
 
-  HALanalogWrite(THR_INH_PWM_CHAN, inh8bit);
+  inh_q16 = constrain(inh_q16,0,PWM_DUTY_MAX);
 
+  HAL_SetHalfBridgePwm(duty_q16, inh_q16);   // both in the same PWM period (with HB_OUT_MCPWM), drag brake relies on it
 }
 
 
@@ -0,0 +1,25 @@
+#ifndef CTRLBASE_H_
+#define CTRLBASE_H_
+
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+/*
+  Base of the control path modules (throttle, trigfilter, fixmath, bemf, telemetry, traction, currlimit, pwmquant).
+  They include only standard headers and this one: they do not depend on Arduino, so they can be built and checked on a PC (test/).
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#ifdef ARDUINO
+  #include <esp_attr.h>   /* IRAM_ATTR: the control tick runs in the control timer ISR */
+#else
+  #define IRAM_ATTR
+#endif
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------------Macros------------------------------------------------------*/
+/*********************************************************************************************************************/
+#define THROTTLE_Q16_MAX  65535       /* Full scale of the pipeline values: trigger fully pressed, 100% duty (same as PWM_DUTY_MAX) */
+#define CURR_INVALID_MA   INT16_MIN   /* [mA] motor current not measured yet (HAL_GetMotorCurrent_mA): too few fresh samples */
+
+#endif
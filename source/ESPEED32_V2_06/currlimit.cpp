@@ -0,0 +1,83 @@
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "currlimit.h"
+
+/*********************************************************************************************************************/
+/*---------------------------------------------Function Implementations----------------------------------------------*/
+/*********************************************************************************************************************/
+
+/*
+  CurrLimit_Reset: clear the current limiter, no limit until the current goes above it
+  @param:state current limiter state
+*/
+void IRAM_ATTR CurrLimit_Reset(CurrLimitState_type *state)
+{
+  state->scaleQ16 = THROTTLE_Q16_MAX;
+  state->holdoff = 0;
+  state->limiting = false;
+  state->primed = true;
+}
+
+
+/*
+  CurrLimit_Step: motor current limiter, one per control step, the last stage before the PWM.
+  The current is the on-phase one, the current the half bridge carries while it is on, not the average over the period
+  (at 20% duty the average is 1/5 of the bridge current).
+  With the current above the limit the duty is scaled by limit / current in the same step. At stall the motor current is
+  proportional to the duty, so one cut lands on the limit; with the motor turning the back EMF makes the cut larger than needed.
+  The current sense is an average over ~1.5ms, so after a cut it shows the current from before the cut for some steps:
+  there is no further cut for CURR_LIMIT_HOLDOFF_TICKS steps while the current falls. If it still rises (a fast inrush,
+  the average lags far behind), the cut was too small and the next one comes at the next step.
+  With the current below the limit the scale is given back by CURR_LIMIT_RECOVER_Q16 per step.
+  CURR_INVALID_MA (no fresh current: start of a press, duty too short to sample) is never above the limit: no cut, no event.
+  @param:state current limiter state
+  @param:limit_mA [mA] max motor current, 0 is OFF
+  @param:requestQ16 [Q16] requested duty
+  @param:current_mA [mA] motor current in the PWM on-phase (HAL_GetMotorOnCurrent_mA), or CURR_INVALID_MA
+  @returns: [Q16] duty to apply
+*/
+uint16_t IRAM_ATTR CurrLimit_Step(CurrLimitState_type *state, uint16_t limit_mA, uint16_t requestQ16, int16_t current_mA)
+{
+  bool above, rising;
+
+  if (!state->primed)
+  {
+    CurrLimit_Reset(state);
+    state->prevCurrent_mA = current_mA;
+  }
+
+  rising = (state->prevCurrent_mA != CURR_INVALID_MA) && (current_mA > state->prevCurrent_mA);
+  state->prevCurrent_mA = current_mA;
+
+  if (limit_mA == 0)  /* OFF */
+  {
+    state->scaleQ16 = THROTTLE_Q16_MAX;
+    state->limiting = false;
+    return requestQ16;
+  }
+
+  above = (current_mA != CURR_INVALID_MA) && (current_mA > (int32_t)limit_mA);
+  if (above && !state->limiting)
+  {
+    state->eventCount++;
+  }
+  state->limiting = above;
+
+  if ((state->holdoff > 0) && !rising)
+  {
+    state->holdoff--;
+  }
+  else if (above)
+  {
+    state->scaleQ16 = ((uint32_t)state->scaleQ16 * limit_mA) / (uint32_t)current_mA;  /* Max 65535 * 65535: 32 bits, hardware divide */
+    state->holdoff = CURR_LIMIT_HOLDOFF_TICKS;
+  }
+  else
+  {
+    state->holdoff = 0;
+    state->scaleQ16 = (state->scaleQ16 < THROTTLE_Q16_MAX - CURR_LIMIT_RECOVER_Q16) ? state->scaleQ16 + CURR_LIMIT_RECOVER_Q16 : THROTTLE_Q16_MAX;
+  }
+
+  return ((uint32_t)requestQ16 * state->scaleQ16) / THROTTLE_Q16_MAX;
+}
@@ -0,0 +1,36 @@
+#ifndef CURRLIMIT_H_
+#define CURRLIMIT_H_
+
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "ctrlbase.h"
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------------Macros------------------------------------------------------*/
+/*********************************************************************************************************************/
+#define CURR_LIMIT_HOLDOFF_TICKS  3       /* Ticks without a further cut after a cut, while the current falls: the current sense
+                                             average (CURR_AVG_SAMPLES on-phase samples, ~1.5ms) still shows the current before the cut */
+#define CURR_LIMIT_RECOVER_Q16    655     /* [Q16 / tick] scale recovery with the current below the limit (1%/tick) */
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------Data Structures---------------------------------------------------*/
+/*********************************************************************************************************************/
+
+/* CurrLimitState_type: state of the current limiter. Reset it with CurrLimit_Reset() */
+typedef struct {
+  uint16_t  scaleQ16;         /* [Q16] duty scale, THROTTLE_Q16_MAX is no limit */
+  int16_t   prevCurrent_mA;   /* [mA] current at the previous step */
+  uint8_t   holdoff;          /* Steps left without a further cut */
+  bool      limiting;         /* The last step found the current above the limit */
+  uint32_t  eventCount;       /* Times the current went above the limit since the start, for diagnostics */
+  bool      primed;           /* false until the first step (a zeroed state is not primed) */
+} CurrLimitState_type;
+
+/*********************************************************************************************************************/
+/*------------------------------------------------Function Prototypes------------------------------------------------*/
+/*********************************************************************************************************************/
+void     CurrLimit_Reset(CurrLimitState_type *state);
+uint16_t CurrLimit_Step(CurrLimitState_type *state, uint16_t limit_mA, uint16_t requestQ16, int16_t current_mA);
+
+#endif
@@ -0,0 +1,99 @@
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "fixmath.h"
+
+#if (FIXMATH_ATAN_LUT_BITS < 1) || (FIXMATH_ATAN_LUT_BITS > FIXMATH_ATAN_LUT_MAXBITS)
+  #error "FIXMATH_ATAN_LUT_BITS out of range"
+#endif
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------------Macros------------------------------------------------------*/
+/*********************************************************************************************************************/
+#define ATAN_RATIO_SHIFT  16                                          /* min(|x|,|y|) / max(|x|,|y|) is computed in Q16 */
+#define ATAN_LUT_STEP     (1 << (FIXMATH_ATAN_LUT_MAXBITS - FIXMATH_ATAN_LUT_BITS))  /* Stride in the stored table */
+#define ATAN_FRAC_SHIFT   (ATAN_RATIO_SHIFT - FIXMATH_ATAN_LUT_BITS)  /* Bits of the ratio used for the interpolation */
+#define ATAN_DEG10_90     (900 << FIXMATH_ATAN_SUB_SHIFT)
+#define ATAN_DEG10_180    (1800 << FIXMATH_ATAN_SUB_SHIFT)
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------Private variables-------------------------------------------------*/
+/*********************************************************************************************************************/
+
+/* atan(i / 256) for i = 0..256, in 1/64 of tenth of degree (0..45 deg) */
+static const uint16_t s_atanLut[(1 << FIXMATH_ATAN_LUT_MAXBITS) + 1] = {
+      0,   143,   286,   430,   573,   716,   859,  1002,  1146,  1289,  1432,  1575,  1718,  1861,  2003,  2146,
+   2289,  2432,  2574,  2717,  2859,  3001,  3144,  3286,  3428,  3570,  3711,  3853,  3995,  4136,  4278,  4419,
+   4560,  4701,  4842,  4982,  5123,  5263,  5404,  5544,  5684,  5823,  5963,  6102,  6242,  6381,  6519,  6658,
+   6797,  6935,  7073,  7211,  7348,  7486,  7623,  7760,  7897,  8034,  8170,  8306,  8442,  8578,  8713,  8848,
+   8983,  9118,  9252,  9387,  9520,  9654,  9788,  9921, 10054, 10186, 10318, 10451, 10582, 10714, 10845, 10976,
+  11107, 11237, 11367, 11497, 11626, 11755, 11884, 12013, 12141, 12269, 12397, 12524, 12651, 12778, 12904, 13030,
+  13156, 13281, 13406, 13531, 13656, 13780, 13903, 14027, 14150, 14273, 14395, 14517, 14639, 14761, 14882, 15002,
+  15123, 15243, 15363, 15482, 15601, 15720, 15838, 15956, 16073, 16191, 16308, 16424, 16540, 16656, 16772, 16887,
+  17002, 17116, 17230, 17344, 17457, 17570, 17683, 17795, 17907, 18018, 18130, 18240, 18351, 18461, 18571, 18680,
+  18789, 18898, 19006, 19114, 19221, 19328, 19435, 19542, 19648, 19754, 19859, 19964, 20069, 20173, 20277, 20380,
+  20483, 20586, 20689, 20791, 20893, 20994, 21095, 21196, 21296, 21396, 21495, 21595, 21694, 21792, 21890, 21988,
+  22085, 22183, 22279, 22376, 22472, 22567, 22663, 22758, 22852, 22947, 23040, 23134, 23227, 23320, 23413, 23505,
+  23597, 23688, 23779, 23870, 23961, 24051, 24141, 24230, 24319, 24408, 24496, 24585, 24672, 24760, 24847, 24934,
+  25020, 25106, 25192, 25277, 25363, 25447, 25532, 25616, 25700, 25783, 25867, 25949, 26032, 26114, 26196, 26278,
+  26359, 26440, 26521, 26601, 26681, 26761, 26840, 26919, 26998, 27077, 27155, 27233, 27310, 27387, 27464, 27541,
+  27618, 27694, 27769, 27845, 27920, 27995, 28070, 28144, 28218, 28292, 28365, 28438, 28511, 28584, 28656, 28728,
+  28800
+};
+
+/*********************************************************************************************************************/
+/*---------------------------------------------Function Implementations----------------------------------------------*/
+/*********************************************************************************************************************/
+
+/*
+  FixMath_Atan2Deg10: integer replacement of atan2(), no floating point.
+  The angle is reduced to the first octant (0..45 deg), looked up in the arctangent table with linear interpolation,
+  then moved back to its quadrant. Accuracy is set by FIXMATH_ATAN_LUT_BITS (see fixmath.h).
+  @param:y Y coordinate, |y| < 2^15
+  @param:x X coordinate, |x| < 2^15
+  @returns: [0.1 deg] angle of the (x, y) vector, from -1800 to 1800, same sign convention as atan2(y, x). 0 if x = y = 0
+*/
+int16_t FixMath_Atan2Deg10(int32_t y, int32_t x)
+{
+  uint32_t ax = (x < 0) ? -x : x;
+  uint32_t ay = (y < 0) ? -y : y;
+  uint32_t ratioQ16, idx, frac;
+  int32_t angle;
+
+  if ((ax == 0) && (ay == 0))
+  {
+    return 0;
+  }
+
+  /* First octant: ratio of the smaller on the larger coordinate, from 0 to 1 */
+  ratioQ16 = (ay <= ax) ? ((ay << ATAN_RATIO_SHIFT) / ax) : ((ax << ATAN_RATIO_SHIFT) / ay);
+
+  idx = (ratioQ16 >> ATAN_FRAC_SHIFT) * ATAN_LUT_STEP;
+  frac = ratioQ16 & ((1UL << ATAN_FRAC_SHIFT) - 1);
+  angle = s_atanLut[idx];
+  if (frac != 0)  /* ratio = 1 falls exactly on the last point, never reads past the table */
+  {
+    angle += (int32_t)(((s_atanLut[idx + ATAN_LUT_STEP] - s_atanLut[idx]) * frac) >> ATAN_FRAC_SHIFT);
+  }
+
+  /* Back to the full circle */
+  if (ay > ax)
+  {
+    angle = ATAN_DEG10_90 - angle;
+  }
+  if (x < 0)
+  {
+    angle = ATAN_DEG10_180 - angle;
+  }
+  if (y < 0)
+  {
+    angle = -angle;
+  }
+
+  /* Round to tenths of degree (symmetric for negative angles) */
+  if (angle >= 0)
+  {
+    return (angle + (1 << (FIXMATH_ATAN_SUB_SHIFT - 1))) >> FIXMATH_ATAN_SUB_SHIFT;
+  }
+  return -((-angle + (1 << (FIXMATH_ATAN_SUB_SHIFT - 1))) >> FIXMATH_ATAN_SUB_SHIFT);
+}
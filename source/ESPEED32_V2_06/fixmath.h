@@ -0,0 +1,35 @@
+#ifndef FIXMATH_H_
+#define FIXMATH_H_
+
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "ctrlbase.h"
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------------Macros------------------------------------------------------*/
+/*********************************************************************************************************************/
+
+/* Accuracy of FixMath_Atan2Deg10(): the arctangent table has 2^FIXMATH_ATAN_LUT_BITS + 1 points over 0..45 deg,
+   linear interpolation in between. Max error against atan2() (double) on the 14 bit sensor range, in tenths of degree,
+   including the final rounding to 0.1 deg (0.5 alone):
+     LUT_BITS   points   max error
+        2          5       3.4
+        3          9       1.25
+        4         17       0.71
+        5         33       0.57
+        6         65       0.54
+        8        257       0.53
+   Execution time does not depend on it: one division and one interpolation */
+#ifndef FIXMATH_ATAN_LUT_BITS   /* Can be set from the build, the host test checks every size in the table above */
+  #define FIXMATH_ATAN_LUT_BITS   5     /* From 1 to FIXMATH_ATAN_LUT_MAXBITS */
+#endif
+#define FIXMATH_ATAN_LUT_MAXBITS  8     /* Resolution of the stored table, lower FIXMATH_ATAN_LUT_BITS skip points */
+#define FIXMATH_ATAN_SUB_SHIFT    6     /* The table is in 1/64 of tenth of degree, rounded to tenths only at the end */
+
+/*********************************************************************************************************************/
+/*------------------------------------------------Function Prototypes------------------------------------------------*/
+/*********************************************************************************************************************/
+int16_t FixMath_Atan2Deg10(int32_t y, int32_t x);
+
+#endif
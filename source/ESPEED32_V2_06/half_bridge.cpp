@@ -56,12 +56,18 @@ void HalfBridge_SetupFabio()
 }
 
 
-void HalfBridge_SetPwmDrag(uint8_t duty_pct, uint8_t drag_pct)
+void IRAM_ATTR HalfBridge_SetPwmDrag(uint8_t duty_pct, uint8_t drag_pct)
 {
   half_bridge.set_pwm_drag(duty_pct, drag_pct);
 }
 
 
+void IRAM_ATTR HalfBridge_SetPwmDragQ16(uint16_t duty_q16, uint16_t drag_q16)
+{
+  half_bridge.set_pwm_drag_q16(duty_q16, drag_q16);
+}
+
+
 void HalfBridge_Enable()
 {
   half_bridge.enable();
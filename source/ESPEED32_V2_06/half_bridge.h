@@ -12,6 +12,7 @@
 void HalfBridge_Setup();
 void HalfBridge_SetupFabio();
 void HalfBridge_SetPwmDrag(uint8_t duty_pct, uint8_t drag_pct);
+void HalfBridge_SetPwmDragQ16(uint16_t duty_q16, uint16_t drag_q16);
 void HalfBridge_Enable();
 void HalfBridge_TestMotor();
 
@@ -0,0 +1,277 @@
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "hb_mcpwm.h"
+#include "HAL.h"
+#include <driver/mcpwm_prelude.h>
+#include <hal/mcpwm_ll.h>
+#include <soc/mcpwm_struct.h>
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------------Macros------------------------------------------------------*/
+/*********************************************************************************************************************/
+/* The group is only used here, so the driver hands out its first timer, operators and comparators: the duties are then
+   written with the ll functions, that are inline and can run in the control tick ISR while the flash cache is disabled */
+#define HB_OPER_ID        0       /* Operator of the IN and INH generators */
+#define HB_CMPR_IN_ID     0       /* Comparator of IN, created first on HB_OPER_ID */
+#define HB_CMPR_INH_ID    1       /* Comparator of INH, created second on HB_OPER_ID */
+#define HB_EVT_OPER_ID    1       /* Operator of the event comparator (HB_OPER_ID has only 2 comparators) */
+#define HB_EVT_CMPR_ID    0
+#define HB_TIMER_ID       0
+
+#if defined (HB_OUT_MCPWM)
+/*********************************************************************************************************************/
+/*-------------------------------------------------Private variables-------------------------------------------------*/
+/*********************************************************************************************************************/
+static mcpwm_timer_handle_t s_timer = NULL;
+static uint32_t s_freq_Hz = 0;
+static uint32_t s_periodTicks = 0;                /* MCPWM ticks in a PWM period */
+static uint32_t s_duty[2] = { 0, 0 };             /* Compare values [MCPWM ticks] of THR_IN_PWM_CHAN and THR_INH_PWM_CHAN */
+static PwmEventFunction_type s_eventCallback = NULL;
+static portMUX_TYPE s_mcpwmMux = portMUX_INITIALIZER_UNLOCKED;
+
+/*********************************************************************************************************************/
+/*---------------------------------------------Function Implementations----------------------------------------------*/
+/*********************************************************************************************************************/
+
+/*
+  writeCompares: write the compare values of the requested duties. Call it with s_mcpwmMux taken.
+  The comparators are created with update_cmp_on_tez: the new values are loaded together at the start of the next period.
+  The event is placed in the middle of the IN on-phase, where the motor current is closest to its average.
+*/
+static void IRAM_ATTR writeCompares()
+{
+  mcpwm_ll_operator_set_compare_value(&MCPWM0, HB_OPER_ID, HB_CMPR_IN_ID, s_duty[THR_IN_PWM_CHAN]);
+  mcpwm_ll_operator_set_compare_value(&MCPWM0, HB_OPER_ID, HB_CMPR_INH_ID, s_duty[THR_INH_PWM_CHAN]);
+  mcpwm_ll_operator_set_compare_value(&MCPWM0, HB_EVT_OPER_ID, HB_EVT_CMPR_ID, s_duty[THR_IN_PWM_CHAN] / 2);
+}
+
+
+/*
+  eventISR: the timer reached the event comparator
+*/
+static bool IRAM_ATTR eventISR(mcpwm_cmpr_handle_t comparator, const mcpwm_compare_event_data_t *edata, void *userCtx)
+{
+  PwmEventFunction_type callback = __atomic_load_n(&s_eventCallback, __ATOMIC_RELAXED);
+
+  if (callback != NULL)
+  {
+    callback();
+  }
+
+  return false;
+}
+
+
+/*
+  newPwmGenerator: create a generator that switches at the start of the period and at its comparator
+  @param:atStart output level set at the start of the period
+  @param:atCompare output level set when the timer reaches the comparator
+  @returns: the generator, NULL on error
+*/
+static mcpwm_gen_handle_t newPwmGenerator(mcpwm_oper_handle_t oper, mcpwm_cmpr_handle_t cmpr, int pin,
+                                          mcpwm_generator_action_t atStart, mcpwm_generator_action_t atCompare)
+{
+  mcpwm_generator_config_t genConfig = {};
+  mcpwm_gen_handle_t gen = NULL;
+
+  genConfig.gen_gpio_num = pin;
+  if ((mcpwm_new_generator(oper, &genConfig, &gen) != ESP_OK) ||
+      (mcpwm_generator_set_action_on_timer_event(gen, MCPWM_GEN_TIMER_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, MCPWM_TIMER_EVENT_EMPTY, atStart)) != ESP_OK) ||
+      (mcpwm_generator_set_action_on_compare_event(gen, MCPWM_GEN_COMPARE_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, cmpr, atCompare)) != ESP_OK))
+  {
+    return NULL;
+  }
+
+  return gen;
+}
+
+
+/*
+  HbMcpwm_Init: set up the MCPWM output stage of the half bridge and start it, with both outputs off.
+  One timer drives IN and INH from the same operator, so the two signals are always phase aligned (both rise at the start of the period)
+  and their duties change in the same period. A comparator on a second operator of the same timer gives the PWM event.
+  @param:inPin GPIO of the half bridge IN
+  @param:inhPin GPIO of the half bridge INH
+  @param:freq_Hz [Hz] PWM frequency
+  @returns: false if the MCPWM could not be set up
+*/
+bool HbMcpwm_Init(uint8_t inPin, uint8_t inhPin, uint32_t freq_Hz)
+{
+  mcpwm_timer_config_t timerConfig = {};
+  mcpwm_operator_config_t operConfig = {};
+  mcpwm_comparator_config_t cmprConfig = {};
+  mcpwm_comparator_event_callbacks_t cmprCallbacks = {};
+  mcpwm_oper_handle_t oper = NULL, evtOper = NULL;
+  mcpwm_cmpr_handle_t cmprIn = NULL, cmprInh = NULL, cmprEvt = NULL;
+  mcpwm_gen_handle_t genIn, genInh;
+
+  s_freq_Hz = freq_Hz;
+  s_periodTicks = HB_MCPWM_RESOLUTION_HZ / freq_Hz;
+
+  timerConfig.group_id = HB_MCPWM_GROUP;
+  timerConfig.clk_src = MCPWM_TIMER_CLK_SRC_DEFAULT;
+  timerConfig.resolution_hz = HB_MCPWM_RESOLUTION_HZ;
+  timerConfig.count_mode = MCPWM_TIMER_COUNT_MODE_UP;
+  timerConfig.period_ticks = s_periodTicks;
+  timerConfig.flags.update_period_on_empty = true;   /* Frequency changes are loaded at the start of a period */
+  operConfig.group_id = HB_MCPWM_GROUP;
+  cmprConfig.flags.update_cmp_on_tez = true;         /* Shadow registers: duties are loaded at the start of a period */
+
+  if ((mcpwm_new_timer(&timerConfig, &s_timer) != ESP_OK) ||
+      (mcpwm_new_operator(&operConfig, &oper) != ESP_OK) ||
+      (mcpwm_new_operator(&operConfig, &evtOper) != ESP_OK) ||
+      (mcpwm_operator_connect_timer(oper, s_timer) != ESP_OK) ||
+      (mcpwm_operator_connect_timer(evtOper, s_timer) != ESP_OK) ||
+      (mcpwm_new_comparator(oper, &cmprConfig, &cmprIn) != ESP_OK) ||
+      (mcpwm_new_comparator(oper, &cmprConfig, &cmprInh) != ESP_OK) ||
+      (mcpwm_new_comparator(evtOper, &cmprConfig, &cmprEvt) != ESP_OK))
+  {
+    return false;
+  }
+
+  genIn = newPwmGenerator(oper, cmprIn, inPin, MCPWM_GEN_ACTION_HIGH, MCPWM_GEN_ACTION_LOW);
+  genInh = newPwmGenerator(oper, cmprInh, inhPin, MCPWM_GEN_ACTION_HIGH, MCPWM_GEN_ACTION_LOW);
+  if ((genIn == NULL) || (genInh == NULL))
+  {
+    return false;
+  }
+
+  if (HB_MCPWM_DEAD_TIME_NS > 0)
+  {
+    mcpwm_dead_time_config_t deadTime = {};
+    deadTime.posedge_delay_ticks = ((uint64_t)HB_MCPWM_DEAD_TIME_NS * HB_MCPWM_RESOLUTION_HZ) / 1000000000ULL;
+    mcpwm_generator_set_dead_time(genIn, genIn, &deadTime);
+  }
+
+  if (HB_MCPWM_EVENT_PIN >= 0)   /* Rising edge at the event: to trigger a scope or an external ADC */
+  {
+    newPwmGenerator(evtOper, cmprEvt, HB_MCPWM_EVENT_PIN, MCPWM_GEN_ACTION_LOW, MCPWM_GEN_ACTION_HIGH);
+  }
+
+  cmprCallbacks.on_reach = eventISR;
+  mcpwm_comparator_register_event_callbacks(cmprEvt, &cmprCallbacks, NULL);
+
+  portENTER_CRITICAL(&s_mcpwmMux);
+  writeCompares();
+  portEXIT_CRITICAL(&s_mcpwmMux);
+
+  return (mcpwm_timer_enable(s_timer) == ESP_OK) && (mcpwm_timer_start_stop(s_timer, MCPWM_TIMER_START_NO_STOP) == ESP_OK);
+}
+
+
+/*
+  HbMcpwm_SetDuty: set the duties of IN and INH, both applied from the start of the same PWM period
+  @param:inDuty [MCPWM ticks] IN duty, from 0 to HbMcpwm_GetPeriod()
+  @param:inhDuty [MCPWM ticks] INH duty, from 0 to HbMcpwm_GetPeriod()
+*/
+void IRAM_ATTR HbMcpwm_SetDuty(uint32_t inDuty, uint32_t inhDuty)
+{
+  portENTER_CRITICAL_SAFE(&s_mcpwmMux);
+  s_duty[THR_IN_PWM_CHAN] = inDuty;
+  s_duty[THR_INH_PWM_CHAN] = inhDuty;
+  writeCompares();
+  portEXIT_CRITICAL_SAFE(&s_mcpwmMux);
+}
+
+
+/*
+  HbMcpwm_SetChannelDuty: set the duty of IN or INH only, the other one is kept
+  @param:chan THR_IN_PWM_CHAN or THR_INH_PWM_CHAN, other channels are ignored
+  @param:duty [MCPWM ticks] from 0 to HbMcpwm_GetPeriod()
+*/
+void IRAM_ATTR HbMcpwm_SetChannelDuty(uint8_t chan, uint32_t duty)
+{
+  if ((chan != THR_IN_PWM_CHAN) && (chan != THR_INH_PWM_CHAN))
+  {
+    return;
+  }
+
+  portENTER_CRITICAL_SAFE(&s_mcpwmMux);
+  s_duty[chan] = duty;
+  writeCompares();
+  portEXIT_CRITICAL_SAFE(&s_mcpwmMux);
+}
+
+
+/*
+  HbMcpwm_SetFreq: change the PWM frequency, the new period is loaded at the start of the next period.
+  The duties are in ticks: write them rescaled to the new HbMcpwm_GetPeriod() straight after, they are loaded at the same time
+  @param:freq_Hz [Hz] new frequency
+  @returns: false if the period does not fit the 16 bit timer (nothing changed)
+*/
+bool HbMcpwm_SetFreq(uint32_t freq_Hz)
+{
+  uint32_t periodTicks;
+
+  if (freq_Hz == 0)
+  {
+    return false;
+  }
+  periodTicks = HB_MCPWM_RESOLUTION_HZ / freq_Hz;
+  if ((periodTicks < 2) || (periodTicks > UINT16_MAX))
+  {
+    return false;
+  }
+
+  portENTER_CRITICAL(&s_mcpwmMux);
+  mcpwm_ll_timer_set_peak(&MCPWM0, HB_TIMER_ID, periodTicks, false);   /* Same as mcpwm_timer_set_period(), without leaving the critical section */
+  s_freq_Hz = freq_Hz;
+  s_periodTicks = periodTicks;
+  portEXIT_CRITICAL(&s_mcpwmMux);
+
+  return true;
+}
+
+
+/*
+  HbMcpwm_GetFreq: PWM frequency
+  @returns: [Hz]
+*/
+uint32_t HbMcpwm_GetFreq()
+{
+  return s_freq_Hz;
+}
+
+
+/*
+  HbMcpwm_GetPeriod: PWM period
+  @returns: [MCPWM ticks]
+*/
+uint32_t HbMcpwm_GetPeriod()
+{
+  return s_periodTicks;
+}
+
+
+/*
+  HbMcpwm_GetDuty: duty of IN or INH
+  @param:chan THR_IN_PWM_CHAN or THR_INH_PWM_CHAN
+  @returns: [MCPWM ticks] duty, from 0 to HbMcpwm_GetPeriod()
+*/
+uint32_t HbMcpwm_GetDuty(uint8_t chan)
+{
+  return (chan == THR_INH_PWM_CHAN) ? s_duty[THR_INH_PWM_CHAN] : s_duty[THR_IN_PWM_CHAN];
+}
+
+
+/*
+  HbMcpwm_GetCounter: position in the PWM period
+  @returns: [MCPWM ticks] from 0 to HbMcpwm_GetPeriod() - 1
+*/
+uint32_t HbMcpwm_GetCounter()
+{
+  return mcpwm_ll_timer_get_count_value(&MCPWM0, HB_TIMER_ID);
+}
+
+
+/*
+  HbMcpwm_SetEventCallback: set the function called at every PWM event (middle of the IN on-phase), e.g. to start an ADC sample.
+  It runs in the MCPWM ISR: keep it short. The ISR only runs while the flash cache is disabled if CONFIG_MCPWM_ISR_IRAM_SAFE is set.
+  @param:callback NULL to stop the calls
+*/
+void HbMcpwm_SetEventCallback(PwmEventFunction_type callback)
+{
+  __atomic_store_n(&s_eventCallback, callback, __ATOMIC_RELAXED);
+}
+#endif
@@ -0,0 +1,36 @@
+#ifndef HB_MCPWM_H_
+#define HB_MCPWM_H_
+
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include <Arduino.h>
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------------Macros------------------------------------------------------*/
+/*********************************************************************************************************************/
+#define HB_MCPWM_GROUP          0         /* MCPWM unit used for the half bridge */
+#define HB_MCPWM_RESOLUTION_HZ  10000000  /* [Hz] MCPWM timer tick: 2000 ticks per period at 5kHz, 10000 at 1kHz (16 bit period) */
+#define HB_MCPWM_DEAD_TIME_NS   0         /* [nS] delay of the IN rising edge (high side on after low side/float). 0: only the
+                                             BTN99x0 internal cross conduction protection */
+#define HB_MCPWM_EVENT_PIN      -1        /* GPIO showing the PWM event (high from the event to the end of the period), -1: not used */
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------Data Structures---------------------------------------------------*/
+/*********************************************************************************************************************/
+typedef void (*PwmEventFunction_type)(void);  /* Called from the MCPWM ISR at the PWM event (see HbMcpwm_SetEventCallback) */
+
+/*********************************************************************************************************************/
+/*------------------------------------------------Function Prototypes------------------------------------------------*/
+/*********************************************************************************************************************/
+bool     HbMcpwm_Init(uint8_t inPin, uint8_t inhPin, uint32_t freq_Hz);
+void     HbMcpwm_SetDuty(uint32_t inDuty, uint32_t inhDuty);
+void     HbMcpwm_SetChannelDuty(uint8_t chan, uint32_t duty);
+bool     HbMcpwm_SetFreq(uint32_t freq_Hz);
+uint32_t HbMcpwm_GetFreq();
+uint32_t HbMcpwm_GetPeriod();
+uint32_t HbMcpwm_GetDuty(uint8_t chan);
+uint32_t HbMcpwm_GetCounter();
+void     HbMcpwm_SetEventCallback(PwmEventFunction_type callback);
+
+#endif
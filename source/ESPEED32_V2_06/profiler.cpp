@@ -0,0 +1,168 @@
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "profiler.h"
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------Private variables-------------------------------------------------*/
+/*********************************************************************************************************************/
+
+/* Fixed RAM block with the statistics of every stage. Written only by the control tick, read by the UI task.
+   A read from the UI may see a stage half updated: acceptable for diagnostics */
+static ProfStage_type g_profStage[PROF_STAGE_COUNT];
+
+static volatile bool s_resetRequest = true;   /* Reset is done by the control tick, so the UI never writes the stats */
+
+static const char *const s_stageName[PROF_STAGE_COUNT] = { "TRG", "NRM", "DBD", "CRV", "ASP", "PWM", "TCK" };
+
+/*********************************************************************************************************************/
+/*---------------------------------------------Function Implementations----------------------------------------------*/
+/*********************************************************************************************************************/
+
+/*
+  cyclesToBin: log-linear histogram bin of a cycle count.
+  Values below 2^PROF_HIST_SUB_BITS have their own bin, then every power of two is split in 2^PROF_HIST_SUB_BITS bins.
+*/
+static inline uint32_t IRAM_ATTR cyclesToBin(uint32_t cycles)
+{
+  uint32_t msb, bin;
+
+  if (cycles < (1UL << PROF_HIST_SUB_BITS))
+  {
+    return cycles;
+  }
+
+  msb = 31 - __builtin_clz(cycles);
+  bin = ((msb - PROF_HIST_SUB_BITS + 1) << PROF_HIST_SUB_BITS) + ((cycles >> (msb - PROF_HIST_SUB_BITS)) & ((1UL << PROF_HIST_SUB_BITS) - 1));
+
+  return (bin < PROF_HIST_BINS) ? bin : (PROF_HIST_BINS - 1);
+}
+
+
+/*
+  binToCycles: lowest cycle count that falls in a histogram bin (inverse of cyclesToBin)
+*/
+static uint32_t binToCycles(uint32_t bin)
+{
+  uint32_t octave = bin >> PROF_HIST_SUB_BITS;
+  uint32_t sub = bin & ((1UL << PROF_HIST_SUB_BITS) - 1);
+
+  if (octave == 0)
+  {
+    return bin;
+  }
+
+  return ((1UL << PROF_HIST_SUB_BITS) + sub) << (octave - 1);
+}
+
+
+/*
+  Profiler_Record: account the cycles elapsed since startCycles to a stage. Call only from the control tick (IRAM, runs in the timer ISR).
+  @param:stage measured stage
+  @param:startCycles value of Prof_Now() taken when the stage started
+*/
+void IRAM_ATTR Profiler_Record(ProfStage_enum stage, uint32_t startCycles)
+{
+  uint32_t cycles = Prof_Now() - startCycles;
+  ProfStage_type *st = &g_profStage[stage];
+
+  st->count++;
+  st->sum += cycles;
+  if (cycles < st->min)
+  {
+    st->min = cycles;
+  }
+  if (cycles > st->max)
+  {
+    st->max = cycles;
+  }
+  st->hist[cyclesToBin(cycles)]++;
+
+  /* The whole tick is the last stage recorded, so here all stages can be cleared together */
+  if ((stage == PROF_STAGE_TICK) && s_resetRequest)
+  {
+    memset(g_profStage, 0, sizeof(g_profStage));
+    for (uint8_t i = 0; i < PROF_STAGE_COUNT; i++)
+    {
+      g_profStage[i].min = UINT32_MAX;
+    }
+    s_resetRequest = false;
+  }
+}
+
+
+/*
+  Profiler_RequestReset: clear all the statistics at the end of the next control tick
+*/
+void Profiler_RequestReset()
+{
+  s_resetRequest = true;
+}
+
+
+/*
+  Profiler_GetSummary: compute min/avg/max/p99 of a stage
+  @param:stage requested stage
+  @param:summary [out] stage summary, in CPU cycles. All 0 if the stage has no samples
+*/
+void Profiler_GetSummary(ProfStage_enum stage, ProfSummary_type *summary)
+{
+  const ProfStage_type *st = &g_profStage[stage];
+  uint32_t count = st->count;
+  uint32_t threshold, acc = 0, bin;
+
+  memset(summary, 0, sizeof(*summary));
+  if (count == 0)
+  {
+    return;
+  }
+
+  summary->count = count;
+  summary->min = st->min;
+  summary->max = st->max;
+  summary->avg = (uint32_t)(st->sum / count);
+
+  /* p99: first bin where the cumulative count reaches 99% of the samples */
+  threshold = count - count / 100;
+  for (bin = 0; bin < PROF_HIST_BINS - 1; bin++)
+  {
+    acc += st->hist[bin];
+    if (acc >= threshold)
+    {
+      break;
+    }
+  }
+  summary->p99 = (bin < PROF_HIST_BINS - 1) ? (binToCycles(bin + 1) - 1) : st->max;
+  if (summary->p99 > summary->max)
+  {
+    summary->p99 = summary->max;
+  }
+}
+
+
+/*
+  Profiler_StageName: 3 letters name of a stage, for display
+*/
+const char *Profiler_StageName(ProfStage_enum stage)
+{
+  return s_stageName[stage];
+}
+
+
+/*
+  Profiler_Dump: print the statistics of all the stages, in CPU cycles and uS
+  @param:out where to print (e.g. Serial)
+*/
+void Profiler_Dump(Print &out)
+{
+  ProfSummary_type sum;
+  uint32_t cpuMHz = getCpuFrequencyMhz();
+
+  out.printf("PROFILER (cycles @%luMHz)\n", cpuMHz);
+  out.printf("STG %10s %8s %8s %8s %8s %10s\n", "count", "min", "avg", "p99", "max", "avg[ns]");
+  for (uint8_t i = 0; i < PROF_STAGE_COUNT; i++)
+  {
+    Profiler_GetSummary((ProfStage_enum)i, &sum);
+    out.printf("%s %10lu %8lu %8lu %8lu %8lu %10lu\n", s_stageName[i], sum.count, sum.min, sum.avg, sum.p99, sum.max, (sum.avg * 1000UL) / cpuMHz);
+  }
+}
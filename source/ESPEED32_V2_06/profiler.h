@@ -0,0 +1,70 @@
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include <Arduino.h>
+#include <esp_cpu.h>
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------------Macros------------------------------------------------------*/
+/*********************************************************************************************************************/
+#define PROF_HIST_SUB_BITS  2   /* Each power of two of the cycle count is split in 2^PROF_HIST_SUB_BITS histogram bins */
+#define PROF_HIST_OCTAVES   20  /* Powers of two covered by the histogram (2^20 cycles = 4.3ms at 240MHz), above goes in the last bin */
+#define PROF_HIST_BINS      (PROF_HIST_OCTAVES << PROF_HIST_SUB_BITS)
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------Data Structures---------------------------------------------------*/
+/*********************************************************************************************************************/
+
+/* Stages of the control tick that are measured. PROF_STAGE_TICK measures the whole tick */
+typedef enum
+{
+  PROF_STAGE_GET_TRIGGER,   /* HAL_GetTriggerSample: copy of the newest sample, the sensor read is timed by the acquisition task */
+  PROF_STAGE_NORMALIZE,     /* Throttle_NormalizeQ16 */
+  PROF_STAGE_DEADBAND,      /* Throttle_DeadBandQ16 */
+  PROF_STAGE_CURVE,         /* throttleCurve2 */
+  PROF_STAGE_ANTISPIN,      /* throttleAntiSpin3 and Traction_Step */
+  PROF_STAGE_SET_PWM,       /* CurrLimit_Step and HalfBridge_SetPwmDragQ16 */
+  PROF_STAGE_TICK,          /* Whole control tick */
+  PROF_STAGE_COUNT
+} ProfStage_enum;
+
+
+/* ProfStage_type: statistics of a single stage, in CPU cycles */
+typedef struct {
+  uint32_t  count;                  /* Number of samples */
+  uint32_t  min;                    /* [cycles] Shortest execution */
+  uint32_t  max;                    /* [cycles] Longest execution */
+  uint64_t  sum;                    /* [cycles] Sum of all executions, used for the average */
+  uint32_t  hist[PROF_HIST_BINS];   /* Log-linear histogram of the executions, used for percentiles */
+} ProfStage_type;
+
+
+/* ProfSummary_type: min/avg/max/p99 of a stage, in CPU cycles */
+typedef struct {
+  uint32_t  count;
+  uint32_t  min;
+  uint32_t  avg;
+  uint32_t  max;
+  uint32_t  p99;  /* Upper bound of the histogram bin containing the 99th percentile */
+} ProfSummary_type;
+
+/*********************************************************************************************************************/
+/*------------------------------------------------Function Prototypes------------------------------------------------*/
+/*********************************************************************************************************************/
+
+/* Read the CPU cycle counter (CCOUNT), to be used as start time for Profiler_Record() */
+static inline uint32_t Prof_Now()
+{
+  return esp_cpu_get_cycle_count();
+}
+
+void        Profiler_Record(ProfStage_enum stage, uint32_t startCycles);
+void        Profiler_RequestReset();
+void        Profiler_GetSummary(ProfStage_enum stage, ProfSummary_type *summary);
+const char *Profiler_StageName(ProfStage_enum stage);
+void        Profiler_Dump(Print &out);
+
+#endif
@@ -0,0 +1,54 @@
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "pwmquant.h"
+
+/*********************************************************************************************************************/
+/*---------------------------------------------Function Implementations----------------------------------------------*/
+/*********************************************************************************************************************/
+
+/*
+  PwmQuant_Round: Q16 duty to counts of the PWM period, rounded to the nearest count
+  @param:dutyQ16 [Q16] duty, from 0 to THROTTLE_Q16_MAX (100%)
+  @param:periodCounts counts in a PWM period, at most 2^16
+  @returns: counts, from 0 to periodCounts
+*/
+uint32_t IRAM_ATTR PwmQuant_Round(uint32_t dutyQ16, uint32_t periodCounts)
+{
+  return (dutyQ16 * periodCounts + THROTTLE_Q16_MAX / 2) / THROTTLE_Q16_MAX;   /* At most THROTTLE_Q16_MAX * 2^16, fits 32 bits */
+}
+
+
+/*
+  PwmQuant_Dither: Q16 duty to counts of the PWM period, first order sigma-delta on the duty bits the period can not show.
+  The Q16 duty is taken as a fraction of 2^16 and the part of it below one count is carried to the next call: over a few calls
+  the average of the counts is the requested duty, also where a count is a big step (low duty, short period).
+  Only the bits the resolution loses are dithered: with a 2^N counts period (LEDC) a steady duty with its low 16 - N bits at 0 gives
+  the same counts at every call, so the write coalescing in HAL.cpp skips them. From THROTTLE_Q16_MAX counts up (16 bits) a count
+  is finer than a Q16 step, there is nothing to dither: rounded as PwmQuant_Round(). 0 and THROTTLE_Q16_MAX are never dithered.
+  The host test test/test_pwm_quant.cpp checks all of it on the LEDC and MCPWM periods.
+  @param:dutyQ16 [Q16] duty, from 0 to THROTTLE_Q16_MAX (100%)
+  @param:periodCounts counts in a PWM period, at most 2^16
+  @param:err carried error [1/2^16 counts], one per PWM output, start it at 0
+  @returns: counts, from 0 to periodCounts
+*/
+uint32_t IRAM_ATTR PwmQuant_Dither(uint32_t dutyQ16, uint32_t periodCounts, uint32_t *err)
+{
+  uint32_t total;
+
+  if (periodCounts >= THROTTLE_Q16_MAX)
+  {
+    *err = 0;
+    return PwmQuant_Round(dutyQ16, periodCounts);
+  }
+  if (dutyQ16 >= THROTTLE_Q16_MAX)
+  {
+    *err = 0;
+    return periodCounts;
+  }
+
+  total = dutyQ16 * periodCounts + *err;   /* [1/2^16 counts] at most (2^16 - 2) * (2^16 - 2) + 2^16 - 1, fits 32 bits */
+  *err = total & 0xFFFF;
+
+  return total >> 16;
+}
@@ -0,0 +1,15 @@
+#ifndef PWMQUANT_H_
+#define PWMQUANT_H_
+
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "ctrlbase.h"
+
+/*********************************************************************************************************************/
+/*------------------------------------------------Function Prototypes------------------------------------------------*/
+/*********************************************************************************************************************/
+uint32_t PwmQuant_Round(uint32_t dutyQ16, uint32_t periodCounts);
+uint32_t PwmQuant_Dither(uint32_t dutyQ16, uint32_t periodCounts, uint32_t *err);
+
+#endif
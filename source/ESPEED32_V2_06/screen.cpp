@@ -0,0 +1,108 @@
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "screen.h"
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------Private variables-------------------------------------------------*/
+/*********************************************************************************************************************/
+static OBDISP  *s_obd = NULL;
+static uint8_t *s_backBuffer = NULL;                         /* What the screen should show (drawn with SCREEN_RENDER) */
+static uint8_t  s_shadow[SCREEN_PAGES * OLED_WIDTH];         /* What the display RAM contains, as far as we know */
+static bool     s_shadowInvalid = false;                     /* The display was written directly: s_shadow is not known, send everything */
+static uint32_t s_lastFlush_ms = 0;
+static ScreenStats_type s_stats;
+
+/*********************************************************************************************************************/
+/*---------------------------------------------Function Implementations----------------------------------------------*/
+/*********************************************************************************************************************/
+
+/*
+  Screen_Init: start tracking the display. Call it after the back buffer was set and the display cleared.
+  @param:obd display instance
+  @param:backBuffer back buffer of the display, NULL if there is none (Screen_Flush() does nothing)
+*/
+void Screen_Init(OBDISP *obd, uint8_t *backBuffer)
+{
+  s_obd = obd;
+  s_backBuffer = backBuffer;
+  if (s_backBuffer != NULL)
+  {
+    memcpy(s_shadow, s_backBuffer, sizeof(s_shadow));
+  }
+}
+
+
+/*
+  Screen_Flush: send to the display only the parts of the back buffer that changed since the last flush.
+  For every page the changed column span is found comparing the back buffer with the shadow copy of the display RAM,
+  and only that span is sent. Calls closer than SCREEN_FRAME_MS are skipped, the changes are sent by a later call.
+  After Screen_Invalidate() the whole back buffer is sent once.
+*/
+void Screen_Flush()
+{
+  uint8_t *src, *shadow;
+  int16_t first, last;
+  uint8_t pagesSent = 0;
+
+  if ((s_backBuffer == NULL) || (millis() - s_lastFlush_ms < SCREEN_FRAME_MS))
+  {
+    return;
+  }
+  s_lastFlush_ms = millis();
+
+  for (uint8_t page = 0; page < SCREEN_PAGES; page++)
+  {
+    src = &s_backBuffer[page * OLED_WIDTH];
+    shadow = &s_shadow[page * OLED_WIDTH];
+
+    if (s_shadowInvalid)
+    {
+      first = 0;
+      last = OLED_WIDTH - 1;
+    }
+    else
+    {
+      for (first = 0; (first < OLED_WIDTH) && (src[first] == shadow[first]); first++);
+      if (first == OLED_WIDTH)
+      {
+        continue; /* Page not changed */
+      }
+      for (last = OLED_WIDTH - 1; src[last] == shadow[last]; last--);
+    }
+
+    obdDumpWindow(s_obd, s_obd, first, page * 8, first, page * 8, last - first + 1, 8);  /* Source is the back buffer of the display itself */
+    memcpy(&shadow[first], &src[first], last - first + 1);
+
+    pagesSent++;
+    s_stats.byteCount += last - first + 1;
+  }
+
+  s_shadowInvalid = false;
+
+  if (pagesSent > 0)
+  {
+    s_stats.flushCount++;
+    s_stats.pageCount += pagesSent;
+  }
+}
+
+
+/*
+  Screen_Invalidate: forget what the display RAM contains, the next Screen_Flush() sends the whole back buffer.
+  Call it after drawing straight to the display (bRender = 1, e.g. obdFill(obd, OBD_WHITE, 1) or the sub menus):
+  those writes do not update the shadow, and a back buffer equal to the stale shadow would never be sent.
+*/
+void Screen_Invalidate()
+{
+  s_shadowInvalid = true;
+}
+
+
+/*
+  Screen_GetStats: get the OLED traffic counters
+*/
+void Screen_GetStats(ScreenStats_type *stats)
+{
+  *stats = s_stats;
+}
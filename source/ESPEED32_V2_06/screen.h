@@ -0,0 +1,43 @@
+#ifndef SCREEN_H_
+#define SCREEN_H_
+
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include <OneBitDisplay.h>
+#include "HAL.h"
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------------Macros------------------------------------------------------*/
+/*********************************************************************************************************************/
+#define SCREEN_PAGES      (OLED_HEIGHT / 8)  /* The SSD1306 RAM is organized in pages of 8 pixel rows */
+#define SCREEN_FRAME_MS   40                 /* [ms] min time between two flushes (max 25 frames per second) */
+
+/* bRender argument of the obd drawing functions for the screens that are flushed by Screen_Flush():
+   draw only in the back buffer. Without back buffer there is nothing to flush, so draw straight to the display */
+#ifdef USE_BACKBUFFER
+  #define SCREEN_RENDER   0
+#else
+  #define SCREEN_RENDER   1
+#endif
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------Data Structures---------------------------------------------------*/
+/*********************************************************************************************************************/
+
+/* ScreenStats_type: OLED traffic counters */
+typedef struct {
+  uint32_t  flushCount;   /* Flushes that found something to send */
+  uint32_t  pageCount;    /* Pages sent */
+  uint32_t  byteCount;    /* Display RAM bytes sent */
+} ScreenStats_type;
+
+/*********************************************************************************************************************/
+/*------------------------------------------------Function Prototypes------------------------------------------------*/
+/*********************************************************************************************************************/
+void Screen_Init(OBDISP *obd, uint8_t *backBuffer);
+void Screen_Flush();
+void Screen_Invalidate();
+void Screen_GetStats(ScreenStats_type *stats);
+
+#endif
@@ -10,18 +10,30 @@
 
 #include "half_bridge.h"
 #include "HAL.h"
+#include "profiler.h"
+#include "throttle.h"
+#include "telemetry.h"
+#include "bemf.h"
+#include "trigfilter.h"
+#include "traction.h"
+#include "currlimit.h"
+#include "screen.h"
+#include "storage.h"
 #include <Preferences.h>
+#include <freertos/timers.h>
+#include <esp_timer.h>
+#include <esp_private/cache_utils.h>
 
 /*********************************************************************************************************************/
 /*-------------------------------------------------------Macros------------------------------------------------------*/
 /*********************************************************************************************************************/
 
-#define MENU_ITEMS_COUNT    7   /* Number of items in the main menu, if you add a item(E.G.parameter) in the main menu, add +1 here*/
+#define MENU_ITEMS_COUNT    11  /* Number of items in the main menu, if you add a item(E.G.parameter) in the main menu, add +1 here*/
 #define MENU_ACCELERATION   0   /* Encoder acceleration when in the main menu */
 #define SEL_ACCELERATION    100 /* Encoder acceleration when selecting parameter value */
 #define ITEM_NO_CALLBACK    0   /* For when a item has no callback */
-#define ITEM_NO_VALUE       0   /* For when an item has no value to be displayed */
-#define MAX_ITEMS           10  /* Max Item on a menu, it will be used on all menus (including car selections) */
+#define ITEM_NO_VALUE       UINT16_MAX  /* For when an item has no value to be displayed (valueOffset) */
+#define ITEM_NO_BOUNDS      0   /* For when an item has fixed min and max values */
 
 #define MIN_SPEED_DEFAULT         20  /* [%]  minSpeed (SENSI) default value. */               
 #define BRAKE_DEFAULT             95  /* [%]  brake (BRAKE) default value. */
@@ -31,6 +43,10 @@
 #define THROTTLE_CURVE_INPUT_THROTTLE_DEFAULT   THROTTLE_NORMALIZED/2 /* X coordinate (input throttle [norm]) of the throttle curve vertex point */
 #define THROTTLE_CURVE_SPEED_DIFF_DEFAULT       50                    /* Y coordinate (output speed [%]) of the throttle curve vertex point */
 #define PWM_FREQ_DEFAULT          30  /* [100*Hz] Output PWM frequency (PWM_F) default value. */
+#define TRIG_FILTER_DEFAULT       TRIG_FILTER_AVG2  /* Trigger filter (FILT) default value. */
+#define TRIG_LEAD_DEFAULT         10  /* [0.1ms] Trigger lead (LEAD) default value: 2 control ticks */
+#define TRACTION_DEFAULT          0   /* Traction control (TRAC) default value: OFF */
+#define CURR_LIMIT_DEFAULT        0   /* [0.1A] Motor current limit (ILIM) default value: OFF */
 
 /* Max and Min user parameter values. If Min is not specified, then it's 0 */
 #define MIN_SPEED_MAX_VALUE 90    /* [%]  minSpeed (SENSI) max value. */
@@ -41,6 +57,8 @@
 #define THROTTLE_CURVE_SPEED_DIFF_MIN_VALUE  10 /* [%]  minSpeed (SENSI) default value. */
 #define ANTISPIN_MAX_VALUE  255   /* [ms] antispin (ANTIS) max value. */
 #define FREQ_MIN_VALUE      1000   /* [%]  Output PWM frequency (PWM_F) min value. */
+#define TRIG_LEAD_MAX_VALUE 30    /* [0.1ms] Trigger lead (LEAD) max value. */
+#define CURR_LIMIT_MAX_VALUE 250  /* [0.1A] Motor current limit (ILIM) max value, the current sense reads up to 32A */
 #define MAX_UINT16          32767 /* Max 16-bit value. */  
 
 #define HEIGHT12x16 16  /* height of 12x16 characters */
@@ -51,6 +69,10 @@
 #define LOOPTIME_MAX_CHECK  100     /* TODO: not used, verify */
 #define TIMER_FREQ          1000000 /* frequency of the timer interrupt in Hz (1MHz)*/
 #define ESC_PERIOD_US       500     /* Period of the ESC alarm in microseconds */
+#define TICK_JITTER_BIN_US  2       /* [uS] width of one bin of the control tick jitter histogram */
+#define TICK_JITTER_BINS    14      /* Number of bins of the jitter histogram, last bin collects everything above */
+#define TICK_STALL_US       100     /* [uS] a tick later than this is counted as a stall */
+#define WELCOME_SCREEN_MS   1500    /* [ms] welcome screen time, the motor is already driven meanwhile */
 
 #define CAR_MAX_COUNT       10 /* How many different car model setting can be stored */
 #define CAR_NAME_MAX_SIZE   5 /* 4 char + terminator \0 */
@@ -67,8 +89,19 @@
 #define DRAG_BRAKE_T_FULL     0
 #define DRAG_BRAKE_T_DEC      1
 
-#define TRIG_AVG_TIME_ms 25
-#define TRIG_AVG_COUNT (TRIG_AVG_TIME_ms * 1000 / (ESC_PERIOD_US))
+#define DIAG_LONG_PRESS_MS  2000  /* [ms] Encoder button hold time (in the main menu) to open the hidden diagnostics page */
+#define DIAG_PAGE_COUNT     3     /* Number of pages of the diagnostics screen */
+#define DIAG_PAGE_PROFILER  0
+#define DIAG_PAGE_TICK      1
+#define DIAG_PAGE_PWM       2
+
+#define UI_PERIOD_MS        20        /* [ms] Task1 periodic wake up (display refresh, serial port), between events it sleeps */
+#define UI_EVT_ENCODER      (1 << 0)  /* Task1 event bits (task notification value): encoder rotated */
+#define UI_EVT_TIMER        (1 << 1)  /* UI_PERIOD_MS elapsed */
+#define UI_EVT_TELEMETRY    (1 << 2)  /* Telemetry ring is half full */
+#define UI_EVT_BUTTON       (1 << 3)  /* Encoder button pressed or released, or held for DIAG_LONG_PRESS_MS */
+
+#define TELEMETRY_STREAM_DECIMATION 8 /* Serial telemetry stream sends 1 sample every 8 ticks (250Hz): the full 2kHz does not fit in 115200 baud */
 /*********************************************************************************************************************/
 /*-------------------------------------------------Data Structures---------------------------------------------------*/
 /*********************************************************************************************************************/
@@ -134,6 +167,10 @@ typedef struct {
   char     carName[CAR_NAME_MAX_SIZE]; /* Name of the CAR, size include terminator character  */
   uint16_t carNumber;   /* Simply to identify the position in the array, not to be changed    */
   uint16_t freqPWM;     /* [100*Hz] PWM_F, motor PWM frequency, from 2 to 50                  */
+  uint16_t trigFilter;  /* FILT, trigger filter (TrigFilter_enum)                              */
+  uint16_t trigLead;    /* [0.1ms] LEAD, brake/throttle feedforward on trigger snaps, 0 is OFF  */
+  uint16_t tracLevel;   /* TRAC, traction control sensitivity, from 0 (OFF) to 10              */
+  uint16_t currLimit;   /* [0.1A] ILIM, on-phase (bridge) current limit, from 0 (OFF) to 25.0A  */
 }CarParam_type;
 
 
@@ -148,34 +185,83 @@ typedef struct {
 
 /* ESC_type: struct that contains all the charger variables */
 typedef struct {
-  uint16_t  outputSpeed_pct;  /* [%] Output speed (duty cycle) obtained after the throttle -> speed pipeline */
+  uint16_t  outputSpeed_pct;  /* [%] Output speed (duty cycle), rounded from outputSpeed_q16 for the display */
+  uint16_t  outputSpeed_q16;  /* [Q16] Output speed (duty cycle) obtained after the throttle -> speed pipeline, 65535 is 100% */
   int16_t   trigger_raw;      /* [raw] trigger reading */
-  uint16_t  trigger_norm;     /* Trigger value, normalized between 0 and THROTTLE_NORMALIZED, to increase granularity */
+  uint16_t  trigger_q16;      /* [Q16] Trigger position, from 0 (released) to 65535 (fully pressed) */
+  int16_t   triggerVel_q16;   /* [Q16 / tick] Trigger velocity estimated by the alpha-beta estimator, positive while pressing */
+  uint16_t  tractionTrim_q16; /* [Q16] Duty scale applied by the traction control, 65535 is no trim */
+  uint16_t  currLimit_q16;    /* [Q16] Duty scale applied by the current limiter, 65535 is no limit */
+  bool      currLimited;      /* The on-phase motor current is above ILIM */
   uint16_t  encoderPos;       /* Current encoder value */
   uint16_t  Vin_mV;           /* [mV] Voltage */
+  uint16_t  motorBemf_mV;     /* [mV] Motor back EMF, filtered */
+  uint16_t  motorSpeed_pml;   /* [permille] Motor speed estimated from the back EMF, of the no load speed at Vin */
   bool      dualCurve;        /* dragBrake set higher than 100%-minSpeed so deceleration curve is diferent from accel*/
 } ESC_type;
 
 
+/* ControlParam_type: snapshot of everything the control tick needs from the user settings (selected car and trigger calibration),
+   built by Task1 (UI core). The control tick takes it once per tick, so it never sees a half written set nor another car's values */
+typedef struct {
+  uint16_t          brakeQ16;                           /* [Q16] BRAKE of the selected car */
+  uint16_t          triggerLeadQ8;                      /* [ticks, Q8] LEAD of the selected car, 0 is OFF */
+  uint16_t          tractionDropQ16;                    /* [Q16 / tick] current drop taken as wheel spin, from TRAC of the selected car, 0 is OFF */
+  uint16_t          currentLimit_mA;                    /* [mA] ILIM of the selected car, 0 is OFF */
+  int16_t           minTrigger_raw;                     /* Min trigger raw value, calibration parameter */
+  int16_t           maxTrigger_raw;                     /* Max trigger raw value, calibration parameter */
+  AntiSpinCoef_type antiSpin;                           /* antispin ramp coefficients */
+  uint16_t          curveLut[THROTTLE_NORMALIZED + 1];  /* [Q16] throttle curve look up table, one entry per normalized trigger step */
+} ControlParam_type;
+
+
+/* TickStats_type: timing statistics of the control tick (control timer ISR), kept on the device for diagnostics.
+   Jitter is the absolute difference between the measured tick period and ESC_PERIOD_US */
+typedef struct {
+  uint32_t  tickCount;                        /* Number of control ticks executed */
+  uint32_t  missedCount;                      /* Number of timer alarms that were not served before the next one (overrun) */
+  uint32_t  maxJitter_uS;                     /* [uS] Worst jitter seen */
+  uint32_t  stallCount;                       /* Ticks later than TICK_STALL_US */
+  uint32_t  flashOpTickCount;                 /* Ticks executed while the flash cache was disabled (NVS writes) */
+  uint32_t  staleTriggerCount;                /* Ticks that found no new trigger sample since the previous tick */
+  uint32_t  jitterHist[TICK_JITTER_BINS];     /* Jitter histogram, bin i counts jitter in [i, i+1) * TICK_JITTER_BIN_US */
+} TickStats_type;
+
+
+/* BootStats_type: boot milestones, [uS] from the start of the application. 0 if not reached */
+typedef struct {
+  uint32_t  paramsLoaded_uS;                  /* Calibration and selected car read from NVS */
+  uint32_t  motorReady_uS;                    /* Control parameters built, the control tick is allowed to drive the motor */
+  uint32_t  firstPwm_uS;                      /* First control tick that wrote the motor PWM */
+  uint32_t  uiReady_uS;                       /* All the cars read, display and encoder initialized, ON sound played */
+} BootStats_type;
+
+
 /* Define a pointer to a void function that takes no arguments */
 typedef void (*FunctionPointer_type)(void);
 
 
-/* MenuItem_type: struct that defines an item of the menu */
+/* Pointer to a function that narrows the min and max values of an item, when they depend on other parameters of the car */
+typedef void (*ItemBoundsFunction_type)(const CarParam_type *car, uint16_t *minValue, uint16_t *maxValue);
+
+
+/* MenuItem_type: struct that defines an item of the menu. The items are constant tables (in flash):
+   the value is not a pointer but the position of the parameter in CarParam_type, resolved on the selected car when used */
 typedef struct {
-  char name[10];                  /* Name of the item that is displayed in the menu */
-  void *value;                    /* Pointer to the variable that contains the value of the item. When assign, must cast to (void *). It's a generic void pointer so that it can be used to print any type of value specified by the type field */
-  ItemValueType_enum type;      /* What kind of variable is value pointing to. Only applies if value is not ITEM_NO_VALUE. STRING type of value must be 5 letters, for INTEGER type of values can be up to 4 digits, for DECIMAL type of values can be up to 3 digits */
+  const char *name;               /* Name of the item that is displayed in the menu */
+  uint16_t valueOffset;           /* offsetof() the value of the item in CarParam_type, ITEM_NO_VALUE if the item has no value */
+  ItemValueType_enum type;        /* What kind of variable is the value. Only applies if valueOffset is not ITEM_NO_VALUE. STRING type of value must be 5 letters, for INTEGER type of values can be up to 4 digits, for DECIMAL type of values can be up to 3 digits */
   uint16_t maxValue;              /* Maximum possible value fo the item. Only applies if  type is VALUE_TYPE_INTEGER or VALUE_TYPE_DECIMAL */
   uint16_t minValue;              /* Minimum possible value fo the item. Only applies if  type is VALUE_TYPE_INTEGER or VALUE_TYPE_DECIMAL */
   char unit;                      /* Measurement unit of the item, that's gonna be displayed next to the value. Must be one character */
   uint8_t decimalPoint;           /* Indicates where is placed the decimal point. Only applies if  type is VALUE_TYPE_DECIMAL. Possible values are 1, and 2. */
-  FunctionPointer_type callback; /* Pointer to a callback that is called when the item is clicked in the menu. If no callback, then set to ITEM_NO_CALLBACK */
+  FunctionPointer_type callback;  /* Pointer to a callback that is called when the item is clicked in the menu. If no callback, then set to ITEM_NO_CALLBACK */
+  ItemBoundsFunction_type bounds; /* Computes min and max values that depend on other parameters, when the item is selected. ITEM_NO_BOUNDS if fixed */
 } MenuItem_type;
 
 
 typedef struct {
-  MenuItem_type item[MAX_ITEMS];      /* Array of pointers to menu_item_type */
+  const MenuItem_type *item;          /* Items of the menu, NULL for the car menu (its items are the cars) */
   uint16_t lines;                     /* How many lines displayed at a time */
 } Menu_type;
 
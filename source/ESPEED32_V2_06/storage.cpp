@@ -0,0 +1,201 @@
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "storage.h"
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------Private variables-------------------------------------------------*/
+/*********************************************************************************************************************/
+static Preferences s_pref;
+static const StorageRecord_type *s_records = NULL;
+static uint8_t  s_recordCount = 0;
+static uint8_t  s_shadow[STORAGE_SHADOW_BYTES];   /* What the flash contains for each record, as far as we know */
+static uint16_t s_shadowOffset[STORAGE_MAX_RECORDS];
+static uint32_t s_dirty = 0;                      /* Bit i set: record i changed since it was written */
+static uint32_t s_readMask = 0;                   /* Bit i set: record i was read by Storage_LoadRecord() */
+static uint32_t s_loadedMask = 0;                 /* Bit i set: record i was found in the flash, complete */
+static uint32_t s_lastChange_ms = 0;
+static StorageStats_type s_stats;
+
+/*********************************************************************************************************************/
+/*---------------------------------------------Function Implementations----------------------------------------------*/
+/*********************************************************************************************************************/
+
+/*
+  markChanged: set the dirty bit of the records that differ from the flash content
+*/
+static void markChanged()
+{
+  for (uint8_t i = 0; i < s_recordCount; i++)
+  {
+    if (memcmp(&s_shadow[s_shadowOffset[i]], s_records[i].data, s_records[i].size) != 0)
+    {
+      s_dirty |= 1UL << i;
+    }
+  }
+}
+
+
+/*
+  Storage_Begin: open the NVS namespace and set the records saved in it. Only Task1 is allowed to use the storage.
+  @param:nameSpace NVS namespace
+  @param:records records table, must stay valid (static)
+  @param:count number of records
+  @return:false if the records do not fit STORAGE_MAX_RECORDS or STORAGE_SHADOW_BYTES, or the namespace can not be opened
+*/
+bool Storage_Begin(const char *nameSpace, const StorageRecord_type *records, uint8_t count)
+{
+  uint16_t offset = 0;
+
+  if (count > STORAGE_MAX_RECORDS)
+  {
+    return false;
+  }
+  for (uint8_t i = 0; i < count; i++)
+  {
+    s_shadowOffset[i] = offset;
+    offset += records[i].size;
+  }
+  if (offset > STORAGE_SHADOW_BYTES)
+  {
+    return false;
+  }
+
+  s_records = records;
+  s_recordCount = count;
+  s_dirty = 0;
+  s_readMask = 0;
+  s_loadedMask = 0;
+  return s_pref.begin(nameSpace, false);
+}
+
+
+/*
+  Storage_LoadRecord: read one record from the flash (e.g. at boot, only what the motor control needs first).
+  A record stored shorter than its variable (fields added at its end by a newer SW) is loaded in the first part of the variable,
+  the rest keeps the value it had before the call (set the defaults first). It is then rewritten at the next save.
+  A record missing, or longer than the variable, keeps the value it had before the call and is written at the next save.
+  @param:index record index in the records table
+  @return:true if the record was found complete
+*/
+bool Storage_LoadRecord(uint8_t index)
+{
+  const StorageRecord_type *record = &s_records[index];
+  size_t len;
+
+  len = s_pref.isKey(record->key) ? s_pref.getBytesLength(record->key) : 0;
+  if ((len > 0) && (len <= record->size))
+  {
+    s_pref.getBytes(record->key, record->data, len);
+  }
+
+  memcpy(&s_shadow[s_shadowOffset[index]], record->data, record->size);
+  s_readMask |= 1UL << index;
+  if (len == record->size)
+  {
+    s_loadedMask |= 1UL << index;
+    return true;
+  }
+
+  s_dirty |= 1UL << index;
+  return false;
+}
+
+
+/*
+  Storage_Load: read from the flash all the records not read yet (see Storage_LoadRecord())
+  @return:bitmap of the records found complete (bit i for record i)
+*/
+uint32_t Storage_Load()
+{
+  for (uint8_t i = 0; i < s_recordCount; i++)
+  {
+    if ((s_readMask & (1UL << i)) == 0)
+    {
+      Storage_LoadRecord(i);
+    }
+  }
+
+  return s_loadedMask;
+}
+
+
+/*
+  Storage_Invalidate: forget what the flash contains (e.g. after the namespace was cleared), all the records are written at the next save
+*/
+void Storage_Invalidate()
+{
+  s_dirty = (s_recordCount < 32) ? ((1UL << s_recordCount) - 1) : UINT32_MAX;
+}
+
+
+/*
+  Storage_Save: schedule the write of the records that changed since they were last written.
+  Nothing is written here: Storage_Service() writes them once no change happened for STORAGE_QUIET_MS.
+*/
+void Storage_Save()
+{
+  s_stats.saveCount++;
+  markChanged();
+
+  if (s_dirty == 0)
+  {
+    s_stats.unchangedCount++;
+  }
+  else
+  {
+    s_lastChange_ms = millis();
+  }
+}
+
+
+/*
+  Storage_Service: write the changed records, once no change was saved for STORAGE_QUIET_MS. Call it periodically from Task1.
+*/
+void Storage_Service()
+{
+  if ((s_dirty != 0) && (millis() - s_lastChange_ms >= STORAGE_QUIET_MS))
+  {
+    Storage_Flush();
+  }
+}
+
+
+/*
+  Storage_Flush: write the changed records now (e.g. calibration, that must not be lost if the controller is unplugged right after)
+*/
+void Storage_Flush()
+{
+  markChanged();
+
+  for (uint8_t i = 0; i < s_recordCount; i++)
+  {
+    if ((s_dirty & (1UL << i)) == 0)
+    {
+      continue;
+    }
+
+    if (s_pref.putBytes(s_records[i].key, s_records[i].data, s_records[i].size) == s_records[i].size)
+    {
+      memcpy(&s_shadow[s_shadowOffset[i]], s_records[i].data, s_records[i].size);
+      s_dirty &= ~(1UL << i);
+      s_stats.writeCount++;
+      s_stats.byteCount += s_records[i].size;
+      s_stats.recordWriteCount[i]++;
+    }
+    else
+    {
+      s_stats.errorCount++;   /* Still dirty, Storage_Service() tries again after STORAGE_QUIET_MS */
+      s_lastChange_ms = millis();
+    }
+  }
+}
+
+
+/*
+  Storage_GetStats: get the flash write counters
+*/
+void Storage_GetStats(StorageStats_type *stats)
+{
+  *stats = s_stats;
+}
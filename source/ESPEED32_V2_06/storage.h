@@ -0,0 +1,52 @@
+#ifndef STORAGE_H_
+#define STORAGE_H_
+
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include <Arduino.h>
+#include <Preferences.h>
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------------Macros------------------------------------------------------*/
+/*********************************************************************************************************************/
+#define STORAGE_MAX_RECORDS   16    /* Max records in a namespace (one bit each in the dirty bitmap) */
+#define STORAGE_SHADOW_BYTES  512   /* Copy of what is in the flash, for all the records */
+#define STORAGE_QUIET_MS      1500  /* [ms] changes are written after this time without new changes, so that a burst
+                                       of changes (e.g. scrolling the cars or editing many parameters) is a single write */
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------Data Structures---------------------------------------------------*/
+/*********************************************************************************************************************/
+
+/* StorageRecord_type: a block of RAM saved in its own NVS key */
+typedef struct {
+  const char *key;          /* NVS key, max 15 chars */
+  void       *data;         /* The variable saved */
+  uint16_t    size;         /* Size of the variable [bytes] */
+} StorageRecord_type;
+
+
+/* StorageStats_type: flash write counters, to keep an eye on flash wear */
+typedef struct {
+  uint32_t  saveCount;                          /* Storage_Save() calls */
+  uint32_t  unchangedCount;                     /* Storage_Save() calls that found nothing to write */
+  uint32_t  writeCount;                         /* Records written */
+  uint32_t  byteCount;                          /* Bytes written */
+  uint32_t  errorCount;                         /* Failed writes (retried after STORAGE_QUIET_MS) */
+  uint32_t  recordWriteCount[STORAGE_MAX_RECORDS]; /* Writes of each record */
+} StorageStats_type;
+
+/*********************************************************************************************************************/
+/*------------------------------------------------Function Prototypes------------------------------------------------*/
+/*********************************************************************************************************************/
+bool     Storage_Begin(const char *nameSpace, const StorageRecord_type *records, uint8_t count);
+bool     Storage_LoadRecord(uint8_t index);
+uint32_t Storage_Load();
+void     Storage_Invalidate();
+void     Storage_Save();
+void     Storage_Service();
+void     Storage_Flush();
+void     Storage_GetStats(StorageStats_type *stats);
+
+#endif
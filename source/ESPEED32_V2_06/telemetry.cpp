@@ -0,0 +1,80 @@
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "telemetry.h"
+
+#if (TELEMETRY_RING_SIZE & (TELEMETRY_RING_SIZE - 1)) != 0
+  #error "TELEMETRY_RING_SIZE must be a power of 2"
+#endif
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------Private variables-------------------------------------------------*/
+/*********************************************************************************************************************/
+
+/* The indexes run freely and are masked on access: head - tail is the number of samples in the ring */
+static TelemetrySample_type s_ring[TELEMETRY_RING_SIZE];
+static uint32_t s_head = 0;       /* Next slot to be written, only written by the producer */
+static uint32_t s_tail = 0;       /* Next slot to be read, only written by the consumer */
+static uint32_t s_dropCount = 0;  /* Samples lost because the ring was full, only written by the producer */
+
+/*********************************************************************************************************************/
+/*---------------------------------------------Function Implementations----------------------------------------------*/
+/*********************************************************************************************************************/
+
+/*
+  Telemetry_Push: add a sample to the ring. Call only from the control tick.
+  If the consumer is late and the ring is full the sample is dropped (and counted), the producer never waits.
+  @param:sample sample to be copied in the ring
+*/
+void IRAM_ATTR Telemetry_Push(const TelemetrySample_type *sample)
+{
+  uint32_t head = s_head;
+
+  if (head - __atomic_load_n(&s_tail, __ATOMIC_ACQUIRE) >= TELEMETRY_RING_SIZE)
+  {
+    s_dropCount++;
+    return;
+  }
+
+  s_ring[head & (TELEMETRY_RING_SIZE - 1)] = *sample;
+  __atomic_store_n(&s_head, head + 1, __ATOMIC_RELEASE);  /* Publish the slot only once it is written */
+}
+
+
+/*
+  Telemetry_Pop: take the oldest sample from the ring. Call only from the UI task.
+  @param:sample [out] oldest sample
+  @returns: false if the ring is empty
+*/
+bool Telemetry_Pop(TelemetrySample_type *sample)
+{
+  uint32_t tail = s_tail;
+
+  if (tail == __atomic_load_n(&s_head, __ATOMIC_ACQUIRE))
+  {
+    return false;
+  }
+
+  *sample = s_ring[tail & (TELEMETRY_RING_SIZE - 1)];
+  __atomic_store_n(&s_tail, tail + 1, __ATOMIC_RELEASE);  /* Give the slot back only once it is read */
+
+  return true;
+}
+
+
+/*
+  Telemetry_GetDropCount: number of samples dropped because the ring was full
+*/
+uint32_t Telemetry_GetDropCount()
+{
+  return __atomic_load_n(&s_dropCount, __ATOMIC_RELAXED);
+}
+
+
+/*
+  Telemetry_Pending: number of samples in the ring, waiting to be read
+*/
+uint32_t IRAM_ATTR Telemetry_Pending()
+{
+  return __atomic_load_n(&s_head, __ATOMIC_RELAXED) - __atomic_load_n(&s_tail, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,43 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "ctrlbase.h"
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------------Macros------------------------------------------------------*/
+/*********************************************************************************************************************/
+#define TELEMETRY_RING_SIZE   256     /* Samples in the ring, must be a power of 2. 256 samples = 128ms of control ticks */
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------Data Structures---------------------------------------------------*/
+/*********************************************************************************************************************/
+
+/* TelemetrySample_type: state of the controller at one control tick */
+typedef struct {
+  uint32_t  timestamp_uS;     /* [uS] time of the tick */
+  int16_t   trigger_raw;      /* [raw] trigger reading */
+  uint16_t  trigger_q16;      /* [Q16] Trigger position, from 0 to 65535 */
+  int16_t   triggerVel_q16;   /* [Q16 / tick] Trigger velocity */
+  uint16_t  tractionTrim_q16; /* [Q16] Duty scale applied by the traction control, 65535 is no trim */
+  uint16_t  currLimit_q16;    /* [Q16] Duty scale applied by the current limiter, 65535 is no limit */
+  bool      currLimited;      /* Current limit event: the on-phase motor current is above ILIM */
+  uint16_t  outputSpeed_q16;  /* [Q16] Output speed (duty cycle), 65535 is 100% */
+  uint16_t  Vin_mV;           /* [mV] Supply voltage */
+  int16_t   motorCurrent_mA;  /* [mA] Motor current, averaged over the PWM period */
+  uint16_t  motorBemf_mV;     /* [mV] Motor back EMF, filtered */
+} TelemetrySample_type;
+
+/*********************************************************************************************************************/
+/*------------------------------------------------Function Prototypes------------------------------------------------*/
+/*********************************************************************************************************************/
+
+/* Single producer (control tick) / single consumer (UI task) ring, no locks: each side only writes its own index */
+void     Telemetry_Push(const TelemetrySample_type *sample);
+bool     Telemetry_Pop(TelemetrySample_type *sample);
+uint32_t Telemetry_GetDropCount();
+uint32_t Telemetry_Pending();
+
+#endif
@@ -0,0 +1,395 @@
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "throttle.h"
+
+/*********************************************************************************************************************/
+/*---------------------------------------------Function Implementations----------------------------------------------*/
+/*********************************************************************************************************************/
+
+/*
+  mapLong: same as the Arduino (ESP32 core) map(), copied here so that results stay bit exact without depending on Arduino.h
+*/
+static long mapLong(long x, long in_min, long in_max, long out_min, long out_max)
+{
+  const long run = in_max - in_min;
+
+  if (run == 0)
+  {
+    return -1;  /* Arduino map() returns -1 on an invalid input range */
+  }
+
+  return ((x - in_min) * (out_max - out_min)) / run + out_min;
+}
+
+
+/*
+  Throttle_NormalizeQ16: scale the raw trigger reading between the calibrated min and max to Q16
+  @param:raw raw trigger reading
+  @param:minRaw lowest raw reading (calibration)
+  @param:maxRaw highest raw reading (calibration)
+  @param:isReversed the raw reading goes down when the trigger is pressed
+  @returns: [Q16] trigger position, from 0 (released) to THROTTLE_Q16_MAX (fully pressed). 0 if not calibrated (maxRaw <= minRaw)
+*/
+uint16_t IRAM_ATTR Throttle_NormalizeQ16(int16_t raw, int16_t minRaw, int16_t maxRaw, bool isReversed)
+{
+  uint32_t pos;
+
+  if (maxRaw <= minRaw)
+  {
+    return 0;
+  }
+
+  if (raw < minRaw)
+  {
+    raw = minRaw;
+  }
+  else if (raw > maxRaw)
+  {
+    raw = maxRaw;
+  }
+  pos = isReversed ? (uint32_t)(maxRaw - raw) : (uint32_t)(raw - minRaw);
+
+  return (pos * THROTTLE_Q16_MAX) / (uint32_t)(maxRaw - minRaw);  /* The raw span is at most 16 bits, fits 32 bits */
+}
+
+
+/*
+  Throttle_DeadBandQ16: remove a deadband at both ends of the trigger travel, and scale what is left to the full Q16 range.
+  Continuous at both edges: the output is 0 up to the deadband, then grows from 0, and reaches THROTTLE_Q16_MAX at the other deadband.
+  @param:inputQ16 [Q16] trigger position
+  @param:deadBandQ16 [Q16] deadband at each end of the travel, below THROTTLE_Q16_MAX / 2
+  @returns: [Q16] trigger position without the deadbands
+*/
+uint16_t IRAM_ATTR Throttle_DeadBandQ16(uint16_t inputQ16, uint16_t deadBandQ16)
+{
+  if (inputQ16 <= deadBandQ16)
+  {
+    return 0;
+  }
+  if (inputQ16 >= THROTTLE_Q16_MAX - deadBandQ16)
+  {
+    return THROTTLE_Q16_MAX;
+  }
+
+  return ((uint32_t)(inputQ16 - deadBandQ16) * THROTTLE_Q16_MAX) / (THROTTLE_Q16_MAX - 2 * (uint32_t)deadBandQ16);
+}
+
+
+/*
+  Throttle_NoiseGateQ16: hysteresis on the trigger position. The output moves only once the input is more than the gate away from it,
+  then it trails the input by the gate: noise smaller than the gate around a still trigger never reaches the output (nor the PWM),
+  a real move goes through, after a change of direction only once it is larger than the gate.
+  0 and THROTTLE_Q16_MAX (the deadband ends) go through immediately, so brake and full throttle are not delayed.
+  @param:heldQ16 [in/out] gate state, the output of the previous step
+  @param:inputQ16 [Q16] trigger position
+  @param:gateQ16 [Q16] noise gate width
+  @returns: [Q16] trigger position without the noise
+*/
+uint16_t IRAM_ATTR Throttle_NoiseGateQ16(uint16_t *heldQ16, uint16_t inputQ16, uint16_t gateQ16)
+{
+  if ((inputQ16 == 0) || (inputQ16 == THROTTLE_Q16_MAX))
+  {
+    *heldQ16 = inputQ16;
+  }
+  else if ((uint32_t)inputQ16 > (uint32_t)*heldQ16 + gateQ16)
+  {
+    *heldQ16 = inputQ16 - gateQ16;
+  }
+  else if ((uint32_t)inputQ16 + gateQ16 < *heldQ16)
+  {
+    *heldQ16 = inputQ16 + gateQ16;
+  }
+
+  return *heldQ16;
+}
+
+
+/*
+  Throttle_CurveCalc: map trigger position (throttle) to speed (duty) on a broken line curve, with midpoint set by the vertex.
+  This is the reference calculation, the control loop interpolates the table built by Throttle_BuildCurveLut().
+  The curve starts at minSpeed also at 0: a released trigger (brake) is handled by the caller.
+  @param:inputThrottleNorm input trigger, normalized between 0 and throttleNormMax
+  @param:throttleNormMax full scale of the normalized trigger (THROTTLE_NORMALIZED)
+  @param:minSpeed [%] SENSI, speed as soon as the trigger is pressed
+  @param:maxSpeed [%] LIMIT, speed at full trigger
+  @param:vertexInputThrottle X coordinate of the vertex, normalized between 0 and throttleNormMax
+  @param:curveSpeedDiff [%] Y coordinate of the vertex, as percentage of the difference between minSpeed and maxSpeed
+  @returns: [Q16] duty cycle to be applied at that trigger position
+*/
+uint16_t Throttle_CurveCalc(uint16_t inputThrottleNorm, uint16_t throttleNormMax, uint16_t minSpeed, uint16_t maxSpeed, uint16_t vertexInputThrottle, uint16_t curveSpeedDiff)
+{
+  int32_t minSpeedQ16 = THROTTLE_PCT_TO_Q16(minSpeed);
+  int32_t maxSpeedQ16 = THROTTLE_PCT_TO_Q16(maxSpeed);
+  int32_t vertexSpeedQ16;   /* The output speed when the throttle is at the vertex */
+
+  /* Calculate the output speed of the throttle curve vertex
+     This is calculated as the curveSpeedDiff (from 10% to 90%) percentage of the difference between minSpeed and maxSpeed */
+  vertexSpeedQ16 = minSpeedQ16 + ((maxSpeedQ16 - minSpeedQ16) * (int32_t)curveSpeedDiff) / 100;
+
+  if (inputThrottleNorm > throttleNormMax)
+  {
+    inputThrottleNorm = throttleNormMax;
+  }
+
+  if ((vertexInputThrottle > 0) && (inputThrottleNorm <= vertexInputThrottle)) /* Below the vertex map the output speed from minSpeed to the vertex speed */
+  {
+    return mapLong(inputThrottleNorm, 0, vertexInputThrottle, minSpeedQ16, vertexSpeedQ16);
+  }
+  if (throttleNormMax > vertexInputThrottle)  /* Above the vertex map the output speed from the vertex speed to the maxSpeed */
+  {
+    return mapLong(inputThrottleNorm, vertexInputThrottle, throttleNormMax, vertexSpeedQ16, maxSpeedQ16);
+  }
+
+  return maxSpeedQ16;
+}
+
+
+/*
+  Throttle_BuildCurveLut: fill the throttle curve look up table, one entry per normalized trigger step.
+  Parameters are the same as Throttle_CurveCalc().
+  @param:lut [out] table of throttleNormMax + 1 entries, lut[i] = Throttle_CurveCalc(i, ...)
+*/
+void Throttle_BuildCurveLut(uint16_t *lut, uint16_t throttleNormMax, uint16_t minSpeed, uint16_t maxSpeed, uint16_t vertexInputThrottle, uint16_t curveSpeedDiff)
+{
+  for (uint32_t i = 0; i <= throttleNormMax; i++)
+  {
+    lut[i] = Throttle_CurveCalc(i, throttleNormMax, minSpeed, maxSpeed, vertexInputThrottle, curveSpeedDiff);
+  }
+}
+
+
+/*
+  Throttle_CurveLookup: read the throttle curve at a Q16 trigger position, interpolating linearly between the table entries.
+  The curve is a broken line, so the interpolation is exact except around the vertex, and the output moves with every trigger LSB.
+  Only 32 bit operations (no 64 bit division, it is not in IRAM).
+  @param:lut table built by Throttle_BuildCurveLut()
+  @param:throttleNormMax table size - 1, the same passed to Throttle_BuildCurveLut()
+  @param:inputQ16 [Q16] trigger position
+  @returns: [Q16] duty cycle
+*/
+uint16_t IRAM_ATTR Throttle_CurveLookup(const uint16_t *lut, uint16_t throttleNormMax, uint16_t inputQ16)
+{
+  uint32_t pos = (uint32_t)inputQ16 * throttleNormMax;  /* Position in table steps, times THROTTLE_Q16_MAX */
+  uint32_t idx = pos / THROTTLE_Q16_MAX;
+  uint32_t rem = pos - idx * THROTTLE_Q16_MAX;
+  uint32_t lo, hi;
+
+  if (idx >= throttleNormMax)
+  {
+    return lut[throttleNormMax];
+  }
+
+  lo = lut[idx];
+  hi = lut[idx + 1];
+  if (hi >= lo)
+  {
+    return lo + ((hi - lo) * rem) / THROTTLE_Q16_MAX;
+  }
+
+  return lo - ((lo - hi) * rem) / THROTTLE_Q16_MAX;
+}
+
+
+/*
+  Throttle_AntiSpinSetup: precompute the antispin coefficients. Call it whenever ANTIS, SENSI or LIMIT change, not in the control loop:
+  it contains the only divisions of the antispin.
+  The level at which the antispin starts to be effective varies with ANTIS: a high ANTIS (powerful motor or slippery track)
+  starts the ramp from a low requested speed (ANTIS_SPEED_START_MIN), a low ANTIS from a high one (ANTIS_SPEED_START_MAX).
+  @param:coef [out] antispin coefficients
+  @param:antiSpin_ms [ms] ANTIS, time taken by the output to go from SENSI to LIMIT. 0 is OFF
+  @param:antiSpinMax_ms [ms] max value of ANTIS
+  @param:minSpeed [%] SENSI
+  @param:maxSpeed [%] LIMIT
+*/
+void Throttle_AntiSpinSetup(AntiSpinCoef_type *coef, uint16_t antiSpin_ms, uint16_t antiSpinMax_ms, uint16_t minSpeed, uint16_t maxSpeed)
+{
+  uint16_t startPct;        /* [%] requested speed below which antispin is not applied */
+  uint16_t rampStartSpeed;  /* minSpeed could be overrided by the startPct, so keep the highest */
+
+  startPct = mapLong(antiSpin_ms, 0, antiSpinMax_ms, ANTIS_SPEED_START_MAX, ANTIS_SPEED_START_MIN);
+  coef->startQ16 = THROTTLE_PCT_TO_Q16(startPct);
+  coef->minSpeedQ16 = THROTTLE_PCT_TO_Q16(minSpeed);
+  rampStartSpeed = (minSpeed > startPct) ? minSpeed : startPct;
+
+  if ((antiSpin_ms == 0) || (maxSpeed <= rampStartSpeed))
+  {
+    coef->bypass = true;
+    coef->slopeQ32 = 0;
+  }
+  else
+  {
+    coef->bypass = false;
+    /* (LIMIT - rampStartSpeed) [Q16] / (ANTIS * 1000) [uS], scaled by 2^16: max 2^32 / 1000, fits in 32 bits */
+    coef->slopeQ32 = (uint32_t)(((uint64_t)(THROTTLE_PCT_TO_Q16(maxSpeed) - THROTTLE_PCT_TO_Q16(rampStartSpeed)) << 16) / ((uint32_t)antiSpin_ms * 1000));
+  }
+}
+
+
+/*
+  Throttle_AntiSpinReset: reset the ramp, next step starts from 0
+  @param:state antispin ramp state
+  @param:now_uS [uS] current time
+*/
+void Throttle_AntiSpinReset(AntiSpinState_type *state, uint32_t now_uS)
+{
+  state->lastOutputQ16 = 0;
+  state->prevCall_uS = now_uS;
+}
+
+
+/*
+  Throttle_AntiSpinStep: apply a ramp to the output speed to prevent the car from spinning the wheels.
+  The output follows the request, but rises at most by (LIMIT - SENSI) every ANTIS ms, starting from SENSI.
+  Requests below the start level (low motor current, no spin for sure, and quick start from stop) and decreasing requests are applied immediately.
+  Only shifts and one 32x32 multiplication: the coefficients are precomputed by Throttle_AntiSpinSetup().
+  @param:state antispin ramp state
+  @param:coef antispin coefficients
+  @param:requestQ16 [Q16] the requested speed at the end of the throttle -> speed pipeline
+  @param:now_uS [uS] current time, the ramp uses the time elapsed since the previous step
+  @returns: [Q16] the output speed closer to the requested one that respects the antispin settings
+*/
+uint16_t IRAM_ATTR Throttle_AntiSpinStep(AntiSpinState_type *state, const AntiSpinCoef_type *coef, uint16_t requestQ16, uint32_t now_uS)
+{
+  uint32_t dt_uS = now_uS - state->prevCall_uS;
+  uint32_t maxDeltaQ16, outputQ16;
+
+  state->prevCall_uS = now_uS;
+
+  if (coef->bypass)
+  {
+    state->lastOutputQ16 = coef->minSpeedQ16;  /* keep last output to minSpeed, so the ramp starts from there if antispin is turned on */
+    return requestQ16;
+  }
+
+  if ((requestQ16 < coef->startQ16) || (requestQ16 <= state->lastOutputQ16))  /* low request or decreasing (braking/slowing): apply immediately */
+  {
+    state->lastOutputQ16 = requestQ16;
+    return requestQ16;
+  }
+
+  /* Requested speed is increasing (car is RACING): apply antispin */
+  if (dt_uS > ANTIS_DT_MAX_US)
+  {
+    dt_uS = ANTIS_DT_MAX_US;
+  }
+  maxDeltaQ16 = (uint32_t)(((uint64_t)coef->slopeQ32 * dt_uS) >> 16);
+
+  if (requestQ16 - state->lastOutputQ16 > maxDeltaQ16)  /* room to increase by maxDelta only */
+  {
+    outputQ16 = state->lastOutputQ16 + maxDeltaQ16;
+  }
+  else  /* arrived at the target */
+  {
+    outputQ16 = requestQ16;
+  }
+
+  if (outputQ16 < coef->minSpeedQ16)  /* start the ramp from minSpeed (and not from 0) */
+  {
+    outputQ16 = coef->minSpeedQ16;
+  }
+
+  state->lastOutputQ16 = outputQ16;
+
+  return outputQ16;
+}
+
+
+/*
+  Throttle_EstimatorReset: clear the trigger estimator, the next measure is taken as the position, with zero velocity
+  @param:est trigger estimator
+*/
+void Throttle_EstimatorReset(TrigEstimator_type *est)
+{
+  est->posQ8 = 0;
+  est->velQ8 = 0;
+  est->primed = false;
+}
+
+
+/*
+  Throttle_EstimatorStep: alpha-beta filter step, one per control step (fixed time step, so the velocity is per step).
+  Predicts the position from the previous velocity, then corrects position and velocity with the measure residual.
+  @param:est trigger estimator
+  @param:measQ16 [Q16] measured trigger position
+*/
+void IRAM_ATTR Throttle_EstimatorStep(TrigEstimator_type *est, uint16_t measQ16)
+{
+  int32_t measQ8 = (int32_t)measQ16 << 8;
+  int32_t predQ8, residualQ8;
+
+  if (!est->primed)
+  {
+    est->posQ8 = measQ8;
+    est->velQ8 = 0;
+    est->primed = true;
+    return;
+  }
+
+  predQ8 = est->posQ8 + est->velQ8;
+  residualQ8 = measQ8 - predQ8;
+  est->posQ8 = predQ8 + (int32_t)(((int64_t)residualQ8 * TRIG_EST_ALPHA_Q8) >> 8);  /* 64 bit product, no division */
+  est->velQ8 += (int32_t)(((int64_t)residualQ8 * TRIG_EST_BETA_Q8) >> 8);
+}
+
+
+/*
+  Throttle_EstimatorVelocity: estimated trigger velocity
+  @param:est trigger estimator
+  @returns: [Q16 / step] velocity, positive while pressing, saturated to 16 bits
+*/
+int16_t IRAM_ATTR Throttle_EstimatorVelocity(const TrigEstimator_type *est)
+{
+  int32_t vel = est->velQ8 >> 8;
+
+  if (vel > INT16_MAX)
+  {
+    return INT16_MAX;
+  }
+  if (vel < INT16_MIN)
+  {
+    return INT16_MIN;
+  }
+  return vel;
+}
+
+
+/*
+  Throttle_EstimatorLead: trigger position moved ahead along the estimated velocity, so that a snap of the trigger
+  (open or release) reaches the output a few steps earlier.
+  Only the velocity above TRIG_EST_SNAP_Q16 counts: the lead grows from 0 at that speed, so it does not jump in,
+  and noise or slow moves are not amplified.
+  @param:est trigger estimator
+  @param:measQ16 [Q16] measured trigger position, the lead is added to it
+  @param:leadQ8 [steps, Q8] lead time, 0 is off
+  @returns: [Q16] trigger position to be used by the throttle -> speed pipeline, 0 (brake) to THROTTLE_Q16_MAX
+*/
+uint16_t IRAM_ATTR Throttle_EstimatorLead(const TrigEstimator_type *est, uint16_t measQ16, uint16_t leadQ8)
+{
+  int32_t vel = est->velQ8 >> 8;
+  int32_t out = measQ16;
+
+  if (leadQ8 == 0)
+  {
+    return measQ16;
+  }
+
+  if (vel > TRIG_EST_SNAP_Q16)
+  {
+    out += ((vel - TRIG_EST_SNAP_Q16) * (int32_t)leadQ8) >> 8;
+  }
+  else if (vel < -TRIG_EST_SNAP_Q16)
+  {
+    out -= ((-vel - TRIG_EST_SNAP_Q16) * (int32_t)leadQ8) >> 8;
+  }
+
+  if (out < 0)
+  {
+    return 0;
+  }
+  if (out > THROTTLE_Q16_MAX)
+  {
+    return THROTTLE_Q16_MAX;
+  }
+  return out;
+}
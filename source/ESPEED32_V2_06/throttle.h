@@ -0,0 +1,68 @@
+#ifndef THROTTLE_H_
+#define THROTTLE_H_
+
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "ctrlbase.h"
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------------Macros------------------------------------------------------*/
+/*********************************************************************************************************************/
+#define ANTIS_SPEED_START_MIN 30      /* [%] start antispin only for speed requests above this value, when ANTIS is at its max */
+#define ANTIS_SPEED_START_MAX 65      /* [%] start antispin only for speed requests above this value, when ANTIS is at 1 */
+#define ANTIS_DT_MAX_US       100000  /* [uS] longer times between calls are clamped, keeps the Q16 ramp math in 32 bits */
+
+#define THROTTLE_PCT_TO_Q16(pct)  (((uint32_t)(pct) * THROTTLE_Q16_MAX) / 100)
+#define THROTTLE_Q16_TO_PCT(q16)  (((uint32_t)(q16) * 100 + THROTTLE_Q16_MAX / 2) / THROTTLE_Q16_MAX)
+
+#define TRIG_EST_ALPHA_Q8     128     /* Alpha-beta estimator position gain (0.5) */
+#define TRIG_EST_BETA_Q8      43      /* Alpha-beta estimator velocity gain, alpha^2 / (2 - alpha): critically damped */
+#define TRIG_EST_SNAP_Q16     200     /* [Q16 / step] trigger speed below which there is no lead (full travel in ~330 steps):
+                                         the lead acts on snaps only, not on the noise or on slow trigger moves */
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------Data Structures---------------------------------------------------*/
+/*********************************************************************************************************************/
+
+/* AntiSpinCoef_type: antispin coefficients, computed by Throttle_AntiSpinSetup() only when ANTIS, SENSI or LIMIT change */
+typedef struct {
+  bool     bypass;          /* ANTIS is 0 (OFF) or the ramp has no room: output follows the request */
+  uint32_t startQ16;        /* [Q16] requested speed below which antispin is not applied */
+  uint32_t minSpeedQ16;     /* [Q16] SENSI, the ramp never starts below it */
+  uint32_t slopeQ32;        /* [Q16 / uS, scaled by 2^16] max output increase per uS: (LIMIT - max(SENSI, start)) / ANTIS */
+} AntiSpinCoef_type;
+
+
+/* AntiSpinState_type: state of the antispin ramp. Reset it with Throttle_AntiSpinReset() */
+typedef struct {
+  uint32_t lastOutputQ16;   /* [Q16] output of the previous step */
+  uint32_t prevCall_uS;     /* [uS] time of the previous step */
+} AntiSpinState_type;
+
+
+/* TrigEstimator_type: state of the trigger alpha-beta estimator. Reset it with Throttle_EstimatorReset() */
+typedef struct {
+  int32_t   posQ8;          /* [Q16 trigger, scaled by 2^8] estimated position */
+  int32_t   velQ8;          /* [Q16 trigger / step, scaled by 2^8] estimated velocity */
+  bool      primed;         /* false until the first measure, that initializes the position */
+} TrigEstimator_type;
+
+/*********************************************************************************************************************/
+/*------------------------------------------------Function Prototypes------------------------------------------------*/
+/*********************************************************************************************************************/
+uint16_t Throttle_NormalizeQ16(int16_t raw, int16_t minRaw, int16_t maxRaw, bool isReversed);
+uint16_t Throttle_DeadBandQ16(uint16_t inputQ16, uint16_t deadBandQ16);
+uint16_t Throttle_NoiseGateQ16(uint16_t *heldQ16, uint16_t inputQ16, uint16_t gateQ16);
+uint16_t Throttle_CurveCalc(uint16_t inputThrottleNorm, uint16_t throttleNormMax, uint16_t minSpeed, uint16_t maxSpeed, uint16_t vertexInputThrottle, uint16_t curveSpeedDiff);
+void     Throttle_BuildCurveLut(uint16_t *lut, uint16_t throttleNormMax, uint16_t minSpeed, uint16_t maxSpeed, uint16_t vertexInputThrottle, uint16_t curveSpeedDiff);
+uint16_t Throttle_CurveLookup(const uint16_t *lut, uint16_t throttleNormMax, uint16_t inputQ16);
+void     Throttle_AntiSpinSetup(AntiSpinCoef_type *coef, uint16_t antiSpin_ms, uint16_t antiSpinMax_ms, uint16_t minSpeed, uint16_t maxSpeed);
+void     Throttle_AntiSpinReset(AntiSpinState_type *state, uint32_t now_uS);
+uint16_t Throttle_AntiSpinStep(AntiSpinState_type *state, const AntiSpinCoef_type *coef, uint16_t requestQ16, uint32_t now_uS);
+void     Throttle_EstimatorReset(TrigEstimator_type *est);
+void     Throttle_EstimatorStep(TrigEstimator_type *est, uint16_t measQ16);
+int16_t  Throttle_EstimatorVelocity(const TrigEstimator_type *est);
+uint16_t Throttle_EstimatorLead(const TrigEstimator_type *est, uint16_t measQ16, uint16_t leadQ8);
+
+#endif
@@ -0,0 +1,118 @@
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "traction.h"
+
+/*********************************************************************************************************************/
+/*---------------------------------------------Function Implementations----------------------------------------------*/
+/*********************************************************************************************************************/
+
+/*
+  Traction_DropQ16: current drop that is taken as wheel spin, from the TRAC parameter
+  @param:level TRAC, from 0 (OFF) to TRACTION_LEVEL_MAX (most sensitive)
+  @returns: [Q16 / tick] fraction of the current lost in one step, 0 if the traction control is OFF
+*/
+uint16_t Traction_DropQ16(uint16_t level)
+{
+  if (level == 0)
+  {
+    return 0;
+  }
+  if (level > TRACTION_LEVEL_MAX)
+  {
+    level = TRACTION_LEVEL_MAX;
+  }
+
+  return TRACTION_DROP_LEVEL1_Q16 / level;
+}
+
+
+/*
+  Traction_Reset: clear the traction control, no trim and the next current is taken as it is
+  @param:state traction control state
+*/
+void IRAM_ATTR Traction_Reset(TractionState_type *state)
+{
+  state->prevCurrent_mA = 0;
+  state->diQ8 = 0;
+  state->prevDutyQ16 = 0;
+  state->trimQ16 = THROTTLE_Q16_MAX;
+  state->holdoff = 0;
+  state->primed = false;
+}
+
+
+/*
+  Traction_Step: closed loop traction control, one per control step (fixed time step, so the current difference is per step).
+  When the wheels break loose the motor speeds up with only its own inertia, and the current falls much faster than
+  while the car accelerates with grip: a fall steeper than dropQ16 (of the current, per step) with the duty not decreasing
+  is taken as wheel spin, and the duty is trimmed by TRACTION_TRIM_STEP_Q16 in the same step.
+  Without spin the trim is given back by TRACTION_RECOVER_Q16 per step.
+  After a duty decrease (trim, or lower request) the current falls because of it: TRACTION_HOLDOFF_TICKS steps are not checked.
+  CURR_INVALID_MA (no fresh current: start of a press, duty too short to sample) is not checked either, the current difference
+  starts again from the next valid current.
+  @param:state traction control state
+  @param:dropQ16 [Q16 / tick] current drop taken as spin (Traction_DropQ16), 0 is OFF
+  @param:requestQ16 [Q16] requested duty (after the curve and the antispin)
+  @param:current_mA [mA] motor current (HAL_GetMotorCurrent_mA), or CURR_INVALID_MA
+  @returns: [Q16] duty to apply
+*/
+uint16_t IRAM_ATTR Traction_Step(TractionState_type *state, uint16_t dropQ16, uint16_t requestQ16, int16_t current_mA)
+{
+  int32_t di_mA;
+  uint32_t limitQ8, outQ16;
+
+  if ((dropQ16 == 0) || (requestQ16 == 0))  /* OFF, or trigger released: start again from no trim */
+  {
+    Traction_Reset(state);
+    return requestQ16;
+  }
+
+  if (!state->primed)  /* First step (a zeroed state is not primed): no trim */
+  {
+    state->prevCurrent_mA = current_mA;
+    state->diQ8 = 0;
+    state->trimQ16 = THROTTLE_Q16_MAX;
+    state->holdoff = 0;
+    state->primed = true;
+  }
+
+  if ((current_mA == CURR_INVALID_MA) || (state->prevCurrent_mA == CURR_INVALID_MA))
+  {
+    state->diQ8 = 0;
+  }
+  else
+  {
+    di_mA = (int32_t)current_mA - state->prevCurrent_mA;
+    state->diQ8 += ((di_mA << 8) - state->diQ8) >> TRACTION_DI_SHIFT;
+  }
+  state->prevCurrent_mA = current_mA;
+
+  limitQ8 = ((uint32_t)((current_mA > 0) ? current_mA : 0) * dropQ16) >> 8;  /* [mA / tick, Q8], max 32767 * 3277: 32 bits */
+  if (limitQ8 < ((uint32_t)TRACTION_DI_NOISE_MA << 8))
+  {
+    limitQ8 = (uint32_t)TRACTION_DI_NOISE_MA << 8;
+  }
+  if (state->holdoff > 0)
+  {
+    state->holdoff--;
+  }
+  else if ((current_mA > TRACTION_MIN_CURRENT_MA) && (-state->diQ8 > (int32_t)limitQ8))   /* CURR_INVALID_MA is below the min */
+  {
+    state->trimQ16 = (state->trimQ16 > TRACTION_TRIM_MIN_Q16 + TRACTION_TRIM_STEP_Q16) ? state->trimQ16 - TRACTION_TRIM_STEP_Q16 : TRACTION_TRIM_MIN_Q16;
+    state->spinCount++;
+  }
+  else
+  {
+    state->trimQ16 = (state->trimQ16 < THROTTLE_Q16_MAX - TRACTION_RECOVER_Q16) ? state->trimQ16 + TRACTION_RECOVER_Q16 : THROTTLE_Q16_MAX;
+  }
+
+  outQ16 = ((uint32_t)requestQ16 * state->trimQ16) / THROTTLE_Q16_MAX;  /* 32 bit division: hardware, no flash helper */
+  if (outQ16 < state->prevDutyQ16)
+  {
+    state->holdoff = TRACTION_HOLDOFF_TICKS;
+  }
+  state->prevDutyQ16 = outQ16;
+
+  return outQ16;
+}
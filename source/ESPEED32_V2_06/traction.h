@@ -0,0 +1,47 @@
+#ifndef TRACTION_H_
+#define TRACTION_H_
+
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "ctrlbase.h"
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------------Macros------------------------------------------------------*/
+/*********************************************************************************************************************/
+#define TRACTION_LEVEL_MAX        10      /* TRAC max value, the most sensitive */
+#define TRACTION_DROP_LEVEL1_Q16  3277    /* [Q16 / tick] current drop (fraction of the current) that is taken as wheel spin at TRAC 1 (5%),
+                                             divided by TRAC: 0.5% at TRAC 10. A car with grip loses ~0.3%/tick at full throttle */
+#define TRACTION_DI_SHIFT         1       /* Weight of a new current difference in the di/dt low pass, 1/2^N */
+#define TRACTION_MIN_CURRENT_MA   300     /* [mA] below this the current is mostly noise: no spin detection */
+#define TRACTION_DI_NOISE_MA      40      /* [mA / tick] smallest current drop taken as spin, above the current sense noise
+                                             left by the short CURR_AVG_SAMPLES average (test/test_traction_sim.cpp) */
+#define TRACTION_HOLDOFF_TICKS    3       /* Ticks without detection after a duty decrease: the current sense average (CURR_AVG_SAMPLES
+                                             on-phase samples, ~1.5ms) still shows the drop caused by the lower duty */
+#define TRACTION_TRIM_STEP_Q16    16384   /* [Q16] duty trim on each spin detection (25%) */
+#define TRACTION_TRIM_MIN_Q16     32768   /* [Q16] duty is never trimmed below 50% of the request: deeper trims lose more drive than the spin */
+#define TRACTION_RECOVER_Q16      328     /* [Q16 / tick] trim recovery without spin (0.5%/tick: from the min to none in 50ms) */
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------Data Structures---------------------------------------------------*/
+/*********************************************************************************************************************/
+
+/* TractionState_type: state of the traction control. Reset it with Traction_Reset() */
+typedef struct {
+  int16_t   prevCurrent_mA;   /* [mA] current at the previous step */
+  int32_t   diQ8;             /* [mA / tick, Q8] current difference, low pass filtered */
+  uint16_t  prevDutyQ16;      /* [Q16] duty given at the previous step */
+  uint16_t  trimQ16;          /* [Q16] duty scale, THROTTLE_Q16_MAX is no trim */
+  uint8_t   holdoff;          /* Steps left without detection */
+  uint32_t  spinCount;        /* Spin detections since the start, for diagnostics */
+  bool      primed;           /* false until the first step, that initializes the current */
+} TractionState_type;
+
+/*********************************************************************************************************************/
+/*------------------------------------------------Function Prototypes------------------------------------------------*/
+/*********************************************************************************************************************/
+uint16_t Traction_DropQ16(uint16_t level);
+void     Traction_Reset(TractionState_type *state);
+uint16_t Traction_Step(TractionState_type *state, uint16_t dropQ16, uint16_t requestQ16, int16_t current_mA);
+
+#endif
@@ -0,0 +1,200 @@
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "trigfilter.h"
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------------Macros------------------------------------------------------*/
+/*********************************************************************************************************************/
+#define TWO_PI_Q24  105414357ULL  /* 2 * PI * 2^24 */
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------Private variables-------------------------------------------------*/
+/*********************************************************************************************************************/
+static const char *const s_filterName[TRIG_FILTER_COUNT] = { "AVG2", "IIR", "MED3", "MED5", "1EUR" };
+
+/*********************************************************************************************************************/
+/*---------------------------------------------Function Implementations----------------------------------------------*/
+/*********************************************************************************************************************/
+
+/*
+  oneEuroAlphaQ12: weight of a new sample of a first order low pass, from its cutoff: alpha = w / (1 + w), w = 2*PI*fc*T
+  @param:cutoff_dHz [0.1Hz] cutoff frequency
+  @param:kQ24 [Q24] 2*PI*sample period [s] / 10
+  @returns: [Q12] weight of a new sample, at least 1
+*/
+static uint16_t oneEuroAlphaQ12(uint32_t cutoff_dHz, uint16_t kQ24)
+{
+  uint32_t wQ12 = (cutoff_dHz * kQ24) >> 12;  /* Max 20000 * 65535, fits 32 bits */
+  uint32_t alphaQ12 = (wQ12 << 12) / ((1UL << 12) + wQ12);
+
+  return (alphaQ12 > 0) ? alphaQ12 : 1;
+}
+
+
+/*
+  medianOfLast: median of the newest samples in the history
+  @param:filter trigger filter
+  @param:count samples, odd and not more than TRIG_FILTER_MEDIAN_MAX
+  @returns: [raw] median
+*/
+static int16_t medianOfLast(const TrigFilter_type *filter, uint8_t count)
+{
+  int16_t sorted[TRIG_FILTER_MEDIAN_MAX];
+  uint8_t idx = filter->histIdx;
+  int16_t val;
+  int8_t j;
+
+  for (uint8_t i = 0; i < count; i++) /* Insertion sort, while walking the history backwards */
+  {
+    val = filter->hist[idx];
+    for (j = i - 1; (j >= 0) && (sorted[j] > val); j--)
+    {
+      sorted[j + 1] = sorted[j];
+    }
+    sorted[j + 1] = val;
+    idx = (idx == 0) ? TRIG_FILTER_MEDIAN_MAX - 1 : idx - 1;
+  }
+
+  return sorted[count / 2];
+}
+
+
+/*
+  TrigFilter_Init: select the filter and clear its state, the next sample is taken as it is
+  @param:filter trigger filter
+  @param:type TrigFilter_enum, TRIG_FILTER_AVG2 if out of range
+  @param:samplePeriod_uS [uS] time between two samples (the One-Euro cutoff is in Hz, and the delays are reported in uS)
+*/
+void TrigFilter_Init(TrigFilter_type *filter, uint8_t type, uint32_t samplePeriod_uS)
+{
+  filter->type = (type < TRIG_FILTER_COUNT) ? type : TRIG_FILTER_AVG2;
+  filter->primed = false;
+  filter->histIdx = 0;
+  filter->yQ8 = 0;
+  filter->dxQ8 = 0;
+  filter->samplePeriod_uS = samplePeriod_uS;
+  filter->kQ24 = (uint16_t)((TWO_PI_Q24 * samplePeriod_uS + 5000000) / 10000000);
+  filter->alphaQ12 = oneEuroAlphaQ12(TRIG_FILTER_1E_MIN_CUTOFF_dHz, filter->kQ24);
+}
+
+
+/*
+  TrigFilter_Update: add a trigger sample to the filter
+  @param:filter trigger filter
+  @param:raw [raw] new trigger reading
+  @returns: [raw] filtered trigger
+*/
+int16_t TrigFilter_Update(TrigFilter_type *filter, int16_t raw)
+{
+  int32_t xQ8 = (int32_t)raw << 8;
+  uint32_t speedQ8, cutoff_dHz;
+  uint8_t prevIdx = filter->histIdx;
+
+  if (!filter->primed)
+  {
+    for (uint8_t i = 0; i < TRIG_FILTER_MEDIAN_MAX; i++)
+    {
+      filter->hist[i] = raw;
+    }
+    filter->yQ8 = xQ8;
+    filter->dxQ8 = 0;
+    filter->primed = true;
+  }
+
+  filter->histIdx = (filter->histIdx + 1) % TRIG_FILTER_MEDIAN_MAX;
+  filter->hist[filter->histIdx] = raw;
+
+  switch (filter->type)
+  {
+    case TRIG_FILTER_IIR:
+      filter->yQ8 += (xQ8 - filter->yQ8) >> TRIG_FILTER_IIR_SHIFT;
+      return (filter->yQ8 + (1L << 7)) >> 8;
+
+    case TRIG_FILTER_MEDIAN3:
+      return medianOfLast(filter, 3);
+
+    case TRIG_FILTER_MEDIAN5:
+      return medianOfLast(filter, 5);
+
+    case TRIG_FILTER_ONE_EURO:
+      /* Trigger speed: distance of the new sample from the output, low pass filtered so that noise does not open the cutoff */
+      filter->dxQ8 += ((xQ8 - filter->yQ8) - filter->dxQ8) >> TRIG_FILTER_1E_D_SHIFT;
+      speedQ8 = (filter->dxQ8 >= 0) ? filter->dxQ8 : -filter->dxQ8;
+      if (speedQ8 >= (((uint32_t)(TRIG_FILTER_1E_MAX_CUTOFF_dHz - TRIG_FILTER_1E_MIN_CUTOFF_dHz) << 8) / TRIG_FILTER_1E_BETA))
+      {
+        cutoff_dHz = TRIG_FILTER_1E_MAX_CUTOFF_dHz;
+      }
+      else
+      {
+        cutoff_dHz = TRIG_FILTER_1E_MIN_CUTOFF_dHz + ((speedQ8 * TRIG_FILTER_1E_BETA) >> 8);
+      }
+      filter->alphaQ12 = oneEuroAlphaQ12(cutoff_dHz, filter->kQ24);
+      filter->yQ8 += (int32_t)(((int64_t)filter->alphaQ12 * (xQ8 - filter->yQ8)) >> 12);
+      return (filter->yQ8 + (1L << 7)) >> 8;
+
+    case TRIG_FILTER_AVG2:
+    default:
+      return ((int32_t)filter->hist[prevIdx] + raw) / 2;
+  }
+}
+
+
+/*
+  TrigFilter_GroupDelay_uS: group delay of the filter now, at low frequency.
+  Fixed for every filter but the One-Euro, whose delay drops while the trigger moves
+  @param:filter trigger filter
+  @returns: [uS] group delay
+*/
+uint32_t TrigFilter_GroupDelay_uS(const TrigFilter_type *filter)
+{
+  if (filter->type == TRIG_FILTER_ONE_EURO)  /* First order low pass: (1 - alpha) / alpha samples */
+  {
+    return (((1UL << 12) - filter->alphaQ12) * filter->samplePeriod_uS) / filter->alphaQ12;
+  }
+
+  return TrigFilter_StillDelay_uS(filter->type, filter->samplePeriod_uS);
+}
+
+
+/*
+  TrigFilter_StillDelay_uS: group delay of a filter with the trigger still, the longest for the One-Euro
+  @param:type TrigFilter_enum
+  @param:samplePeriod_uS [uS] time between two samples
+  @returns: [uS] group delay
+*/
+uint32_t TrigFilter_StillDelay_uS(uint8_t type, uint32_t samplePeriod_uS)
+{
+  uint16_t alphaQ12;
+
+  switch (type)
+  {
+    case TRIG_FILTER_IIR:         /* (1 - alpha) / alpha samples */
+      return ((1UL << TRIG_FILTER_IIR_SHIFT) - 1) * samplePeriod_uS;
+
+    case TRIG_FILTER_MEDIAN3:     /* (N - 1) / 2 samples */
+      return samplePeriod_uS;
+
+    case TRIG_FILTER_MEDIAN5:
+      return 2 * samplePeriod_uS;
+
+    case TRIG_FILTER_ONE_EURO:
+      alphaQ12 = oneEuroAlphaQ12(TRIG_FILTER_1E_MIN_CUTOFF_dHz, (uint16_t)((TWO_PI_Q24 * samplePeriod_uS + 5000000) / 10000000));
+      return (((1UL << 12) - alphaQ12) * samplePeriod_uS) / alphaQ12;
+
+    case TRIG_FILTER_AVG2:
+    default:
+      return samplePeriod_uS / 2;
+  }
+}
+
+
+/*
+  TrigFilter_Name: short name of a filter, for the display and the serial port
+  @param:type TrigFilter_enum
+  @returns: name, 4 chars
+*/
+const char *TrigFilter_Name(uint8_t type)
+{
+  return (type < TRIG_FILTER_COUNT) ? s_filterName[type] : "----";
+}
@@ -0,0 +1,58 @@
+#ifndef TRIGFILTER_H_
+#define TRIGFILTER_H_
+
+/*********************************************************************************************************************/
+/*------------------------------------------------------Includes-----------------------------------------------------*/
+/*********************************************************************************************************************/
+#include "ctrlbase.h"
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------------Macros------------------------------------------------------*/
+/*********************************************************************************************************************/
+#define TRIG_FILTER_IIR_SHIFT           2       /* IIR weight of a new sample is 1/2^TRIG_FILTER_IIR_SHIFT: group delay 2^N - 1 samples */
+#define TRIG_FILTER_MEDIAN_MAX          5       /* Longest median, samples kept in the history */
+#define TRIG_FILTER_1E_MIN_CUTOFF_dHz   50      /* [0.1Hz] One-Euro cutoff with the trigger still: smooths hard */
+#define TRIG_FILTER_1E_MAX_CUTOFF_dHz   20000   /* [0.1Hz] One-Euro cutoff clamp */
+#define TRIG_FILTER_1E_BETA             100     /* [0.1Hz per raw/sample] One-Euro cutoff increase with the trigger speed:
+                                                   a full travel in 50ms (~20 raw/sample) opens the cutoff to ~200Hz */
+#define TRIG_FILTER_1E_D_SHIFT          4       /* Weight of a new sample in the One-Euro trigger speed low pass, 1/2^N */
+
+/*********************************************************************************************************************/
+/*-------------------------------------------------Data Structures---------------------------------------------------*/
+/*********************************************************************************************************************/
+
+/* TrigFilter_enum: trigger filters. Stored in the car parameters (FILT), do not change the order */
+typedef enum
+{
+  TRIG_FILTER_AVG2,       /* Mean of the last 2 samples, the filter used before the filter bank */
+  TRIG_FILTER_IIR,        /* First order low pass */
+  TRIG_FILTER_MEDIAN3,    /* Median of the last 3 samples: removes single sample spikes */
+  TRIG_FILTER_MEDIAN5,    /* Median of the last 5 samples: removes spikes up to 2 samples long */
+  TRIG_FILTER_ONE_EURO,   /* Low pass with a cutoff that rises with the trigger speed */
+  TRIG_FILTER_COUNT
+} TrigFilter_enum;
+
+
+/* TrigFilter_type: state of the trigger filter. Set it up with TrigFilter_Init() */
+typedef struct {
+  uint8_t   type;                           /* TrigFilter_enum */
+  bool      primed;                         /* false until the first sample, that fills the whole state */
+  uint8_t   histIdx;                        /* Position of the newest sample in hist */
+  int16_t   hist[TRIG_FILTER_MEDIAN_MAX];   /* [raw] last samples */
+  int32_t   yQ8;                            /* [Q8 raw] IIR / One-Euro output */
+  int32_t   dxQ8;                           /* [Q8 raw/sample] One-Euro trigger speed, filtered */
+  uint16_t  alphaQ12;                       /* [Q12] One-Euro weight of the last sample */
+  uint16_t  kQ24;                           /* [Q24] 2*PI*sample period [s] / 10, turns a cutoff in 0.1Hz into a weight */
+  uint32_t  samplePeriod_uS;                /* [uS] time between two samples */
+} TrigFilter_type;
+
+/*********************************************************************************************************************/
+/*------------------------------------------------Function Prototypes------------------------------------------------*/
+/*********************************************************************************************************************/
+void        TrigFilter_Init(TrigFilter_type *filter, uint8_t type, uint32_t samplePeriod_uS);
+int16_t     TrigFilter_Update(TrigFilter_type *filter, int16_t raw);
+uint32_t    TrigFilter_GroupDelay_uS(const TrigFilter_type *filter);
+uint32_t    TrigFilter_StillDelay_uS(uint8_t type, uint32_t samplePeriod_uS);
+const char *TrigFilter_Name(uint8_t type);
+
+#endif
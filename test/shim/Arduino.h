@@ -0,0 +1,24 @@
+#ifndef ARDUINO_SHIM_H_
+#define ARDUINO_SHIM_H_
+
+/* Host build shim: the few Arduino (ESP32 core) functions the host tests use, with the same integer semantics.
+   ARDUINO is not defined, so the firmware modules take their PC branch (no esp_attr.h, IRAM_ATTR empty) */
+#include <stdint.h>
+#include <stdbool.h>
+
+/* map: same as the ESP32 core one, integer math truncating towards 0, -1 on an empty input range */
+static inline long map(long x, long in_min, long in_max, long out_min, long out_max)
+{
+  const long run = in_max - in_min;
+
+  if (run == 0)
+  {
+    return -1;
+  }
+
+  return ((x - in_min) * (out_max - out_min)) / run + out_min;
+}
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#endif
@@ -0,0 +1,270 @@
+/*
+  Host motor model of the back EMF speed estimate (bemf.cpp), driven by the throttle antispin (throttle.cpp) as in the control tick.
+  The loop: trigger -> Throttle_AntiSpinStep every 500us -> PWM duty (IN and INH) -> loaded DC motor with its inductance and the
+  recirculation through the low side diode -> the acquisition task every 247us: on-phase current as sampleMotorCurrent(), and the
+  motor terminal in the window sampleBackEmf() (HAL.cpp) uses, after the INH duty plus BEMF_SETTLE_US -> Bemf_Update.
+  Checked, against the true back EMF (Ke * speed) of the model:
+  - the estimate settles on it at every duty, with ADC noise, and Bemf_SpeedPermille gives the speed ratio;
+  - under load the recirculation can outlast BEMF_SETTLE_US: those samples read ~0 and are dropped (Bemf_IsFreewheeling),
+    without that the estimate reads far too low;
+  - the closed loop response: while the antispin ramps the motor up, the estimate follows within the filter time constant and
+    does not overshoot;
+  - at high duty under load no sample is the back EMF, and at 100% there is no floating window: the estimate keeps its last value;
+  - on a step down and on a release (coast), the estimate follows the falling speed.
+*/
+#include <math.h>
+#include "bemf.h"
+#include "throttle.h"
+#include "test_check.h"
+
+#define SIM_DT_S            1e-6      /* [s] model time step */
+#define SIM_PWM_HZ          3000.0    /* PWM_F default */
+#define SIM_PWM_COUNTS      16384.0   /* LEDC resolution at 3kHz (14 bits) */
+#define SIM_SAMPLE_S        247e-6    /* TRIG_SAMPLE_PERIOD_US */
+#define SIM_TICK_S          500e-6    /* ESC_PERIOD_US */
+#define SIM_CURR_AVG        6         /* CURR_AVG_SAMPLES */
+#define SIM_SETTLE_US       30.0      /* BEMF_SETTLE_US */
+#define SIM_CURR_SETTLE_US  5.0       /* CURR_SETTLE_US */
+#define SIM_ADC_US          15.0      /* CURR_ADC_TIME_US */
+#define SIM_NOISE_MV        30.0      /* [mV] ADC noise at the motor terminal, peak */
+#define SIM_DIODE_V         0.7       /* [V] low side body diode while the current free wheels */
+
+#define SIM_SENSI           20        /* [%] */
+#define SIM_LIMIT           100       /* [%] */
+#define SIM_ANTIS_MS        100       /* [ms] */
+
+/* SimMotor_type: slot car motor, SI units, with the car inertia at the shaft */
+typedef struct {
+  double vin, r, l, ke, j, fric;
+} SimMotor_type;
+
+/* SimState_type: model state and what the estimator gave */
+typedef struct {
+  double t, i, w;
+  double nextSample, nextTick;
+  uint32_t seed;
+  uint16_t dutyQ16;
+  uint16_t est_mV;
+  uint32_t samples, dropped;
+  double onPhase_A[SIM_CURR_AVG];  /* Last on-phase current samples, as sampleMotorCurrent() */
+  uint8_t onIdx;
+  int16_t onCurrent_mA;
+  BemfFilter_type filter;
+  AntiSpinState_type antiSpin;
+} SimState_type;
+
+static const SimMotor_type s_motor = { 12.0, 2.0, 0.3e-3, 0.004, 2e-7, 2e-6 };
+static AntiSpinCoef_type s_antiSpinCoef;
+
+static double trueBemf_mV(const SimState_type *st)
+{
+  return s_motor.ke * st->w * 1000.0;
+}
+
+/*
+  simStep: advance the model by one time step. The half bridge drives the output to Vin for the duty, then INH goes low:
+  the current free wheels through the low side diode until it dies out, then the terminal floats at the back EMF.
+  @returns: true if the acquisition task took a back EMF sample in this step
+*/
+static bool simStep(SimState_type *st, uint16_t requestQ16)
+{
+  double pos = fmod(st->t * SIM_PWM_HZ, 1.0);    /* Position in the PWM period */
+  double duty = st->dutyQ16 / 65535.0;
+  bool on = (pos < duty) || (st->dutyQ16 == THROTTLE_Q16_MAX);
+  bool sampled = false;
+  double v;
+
+  if (st->t >= st->nextTick)
+  {
+    st->nextTick += SIM_TICK_S;
+    st->dutyQ16 = Throttle_AntiSpinStep(&st->antiSpin, &s_antiSpinCoef, requestQ16, (uint32_t)(st->t * 1e6));
+  }
+
+  if (on)
+  {
+    v = s_motor.vin;
+  }
+  else if (st->i > 0)
+  {
+    v = -SIM_DIODE_V;
+  }
+  else
+  {
+    v = s_motor.ke * st->w;   /* Floating: the terminal shows the back EMF */
+  }
+  if (on || (st->i > 0))
+  {
+    st->i += (v - s_motor.r * st->i - s_motor.ke * st->w) / s_motor.l * SIM_DT_S;
+    if (!on && (st->i < 0))
+    {
+      st->i = 0;
+    }
+  }
+  st->w += (s_motor.ke * st->i - s_motor.fric * st->w) / s_motor.j * SIM_DT_S;
+
+  if (st->t >= st->nextSample)
+  {
+    double cnt = pos * SIM_PWM_COUNTS;
+    double inhDuty = duty * SIM_PWM_COUNTS;
+    double usToCounts = 1e-6 * SIM_PWM_HZ * SIM_PWM_COUNTS;
+    st->nextSample += SIM_SAMPLE_S;
+
+    /* sampleMotorCurrent(): on-phase samples, averaged */
+    if (st->dutyQ16 == 0)
+    {
+      st->onCurrent_mA = 0;
+    }
+    else if (((cnt >= SIM_CURR_SETTLE_US * usToCounts) && (cnt + SIM_ADC_US * usToCounts < inhDuty)) || (st->dutyQ16 == THROTTLE_Q16_MAX))
+    {
+      double sum = 0;
+      st->onPhase_A[st->onIdx] = st->i;
+      st->onIdx = (st->onIdx + 1) % SIM_CURR_AVG;
+      for (int k = 0; k < SIM_CURR_AVG; k++)
+      {
+        sum += st->onPhase_A[k];
+      }
+      st->onCurrent_mA = (int16_t)(sum / SIM_CURR_AVG * 1000);
+    }
+
+    /* sampleBackEmf(): counter after the INH duty and the settle time, room for the ADC */
+    if ((cnt >= inhDuty + SIM_SETTLE_US * usToCounts) && (cnt + SIM_ADC_US * usToCounts < SIM_PWM_COUNTS))
+    {
+      double sample_mV;
+      st->seed = st->seed * 1664525UL + 1013904223UL;
+      sample_mV = v * 1000.0 + SIM_NOISE_MV * (((st->seed >> 8) / (double)(1UL << 24)) * 2 - 1);
+      sample_mV = (sample_mV > 0) ? sample_mV : 0;  /* The ADC reads 0 below ground */
+      if (Bemf_IsFreewheeling((uint16_t)sample_mV, st->onCurrent_mA))
+      {
+        st->dropped++;
+      }
+      else
+      {
+        st->est_mV = Bemf_Update(&st->filter, (uint16_t)sample_mV);
+        st->samples++;
+        sampled = true;
+      }
+    }
+  }
+
+  st->t += SIM_DT_S;
+  return sampled;
+}
+
+/* checkSettled: run at a constant request, the estimate must settle on the true back EMF */
+static void checkSettled(SimState_type *st, uint16_t requestQ16, double duration_s, const char *name)
+{
+  double tEnd = st->t + duration_s;
+  double maxErr_mV = 0;
+
+  while (st->t < tEnd)
+  {
+    simStep(st, requestQ16);
+    if (st->t > tEnd - 0.1)
+    {
+      double err = fabs(st->est_mV - trueBemf_mV(st));
+      maxErr_mV = (err > maxErr_mV) ? err : maxErr_mV;
+    }
+  }
+
+  uint16_t speed_pml = Bemf_SpeedPermille(st->est_mV, (uint16_t)(s_motor.vin * 1000));
+  uint16_t trueSpeed_pml = (uint16_t)(trueBemf_mV(st) / s_motor.vin + 0.5);
+  printf("%-22s duty %5.1f%%  back EMF %5.0f mV  estimate %5u mV  max error %3.0f mV  speed %4u permille (true %4u)\n", name,
+         st->dutyQ16 * 100.0 / 65535.0, trueBemf_mV(st), st->est_mV, maxErr_mV, speed_pml, trueSpeed_pml);
+  CHECK(maxErr_mV < 150, "%s: settled error %.0f mV", name, maxErr_mV);
+  CHECK(abs((int)speed_pml - (int)trueSpeed_pml) <= 12, "%s: speed %u permille, true %u", name, speed_pml, trueSpeed_pml);
+}
+
+/* runRamp: from the current state, ramp to a higher request through the antispin, check the estimate follows the motor */
+static void runRamp(SimState_type *st, uint8_t toPct)
+{
+  static double true_mV[8000], est_mV[8000];  /* Every 0.1ms */
+  const double duration_s = 0.8;
+  double tStart = st->t, maxOver_mV = 0, mid_mV, tau_ms;
+  uint32_t samplesStart = st->samples;
+  int n = 0, k50True = -1, k50Est = -1;
+
+  while (st->t < tStart + duration_s)
+  {
+    simStep(st, THROTTLE_PCT_TO_Q16(toPct));
+    if ((st->t - tStart >= n * 1e-4) && (n < 8000))
+    {
+      true_mV[n] = trueBemf_mV(st);
+      est_mV[n] = st->est_mV;
+      maxOver_mV = (est_mV[n] - true_mV[n] > maxOver_mV) ? est_mV[n] - true_mV[n] : maxOver_mV;
+      n++;
+    }
+  }
+
+  mid_mV = (true_mV[0] + true_mV[n - 1]) / 2;
+  for (int k = 0; k < n; k++)
+  {
+    k50True = ((k50True < 0) && (true_mV[k] >= mid_mV)) ? k : k50True;
+    k50Est = ((k50Est < 0) && (est_mV[k] >= mid_mV)) ? k : k50Est;
+  }
+  /* The filter counts samples: its time constant is 2^BEMF_FILTER_SHIFT times the mean time between samples taken */
+  tau_ms = (duration_s * 1e3 / (st->samples - samplesStart)) * (1 << BEMF_FILTER_SHIFT);
+  printf("ramp to %u%%: back EMF %.0f -> %.0f mV, half way after %.1f ms, estimate after %.1f ms, filter time constant %.1f ms, "
+         "max overshoot %.0f mV\n", toPct, true_mV[0], true_mV[n - 1], k50True * 0.1, k50Est * 0.1, tau_ms, maxOver_mV);
+  CHECK((k50True >= 0) && (k50Est >= 0), "ramp to %u%%: half way not reached", toPct);
+  CHECK((k50Est - k50True) * 0.1 <= 2 * tau_ms, "ramp to %u%%: estimate %.1f ms behind the motor, filter time constant %.1f ms", toPct,
+        (k50Est - k50True) * 0.1, tau_ms);
+  CHECK(k50Est >= k50True - 5, "ramp to %u%%: estimate %.1f ms ahead of the motor", toPct, (k50True - k50Est) * 0.1);
+  CHECK(maxOver_mV < 150, "ramp to %u%%: estimate above the true back EMF by %.0f mV", toPct, maxOver_mV);
+}
+
+int main()
+{
+  static SimState_type st;
+  uint32_t samples, dropped;
+  uint16_t held_mV;
+  double tStart;
+
+  Throttle_AntiSpinSetup(&s_antiSpinCoef, SIM_ANTIS_MS, 255, SIM_SENSI, SIM_LIMIT);
+  Throttle_AntiSpinReset(&st.antiSpin, 0);
+  Bemf_Reset(&st.filter);
+  st.seed = 1;
+
+  /* Launch, then more throttle: the antispin ramps the duty, the motor follows with its mechanical time constant,
+     the estimate follows the motor. Under load part of the floating window is still recirculation: those samples are dropped */
+  checkSettled(&st, THROTTLE_PCT_TO_Q16(30), 0.4, "30%");
+  runRamp(&st, 60);
+  checkSettled(&st, THROTTLE_PCT_TO_Q16(60), 0.2, "60% after the ramp");
+  printf("%u samples taken, %u dropped as recirculation\n", st.samples, st.dropped);
+  CHECK(st.dropped > 0, "no recirculation sample: the model does not load the motor");
+
+  /* 85% under load: the recirculation lasts the whole floating window, no sample is the back EMF.
+     All are dropped, the estimate is held (it lags the speed, but it is not dragged to 0) */
+  held_mV = st.est_mV;
+  tStart = st.t;
+  while (st.t < tStart + 0.4)
+  {
+    simStep(&st, THROTTLE_PCT_TO_Q16(85));
+    CHECK(st.est_mV + 150 >= held_mV, "85%%: estimate dropped to %u mV from %u mV", st.est_mV, held_mV);
+  }
+  printf("85%%: back EMF %.0f mV, estimate %u mV (held from %u mV)\n", trueBemf_mV(&st), st.est_mV, held_mV);
+
+  /* Step down, then release (coast, the whole period floats) */
+  checkSettled(&st, THROTTLE_PCT_TO_Q16(50), 0.6, "step down to 50%");
+  checkSettled(&st, 0, 0.3, "released");
+
+  /* 100%: no floating window, the estimate keeps the last value */
+  Throttle_AntiSpinReset(&st.antiSpin, (uint32_t)(st.t * 1e6));
+  tStart = st.t;
+  while (st.t < tStart + 0.3)  /* Antispin ramp up to 100% */
+  {
+    simStep(&st, THROTTLE_Q16_MAX);
+  }
+  held_mV = st.est_mV;
+  samples = st.samples;
+  dropped = st.dropped;
+  tStart = st.t;
+  while (st.t < tStart + 0.1)
+  {
+    simStep(&st, THROTTLE_Q16_MAX);
+  }
+  printf("100%%: back EMF %.0f mV, estimate %u mV (held)\n", trueBemf_mV(&st), st.est_mV);
+  CHECK((st.samples == samples) && (st.dropped == dropped), "100%%: %u samples with no floating window", st.samples - samples);
+  CHECK(st.est_mV == held_mV, "100%%: estimate moved from %u to %u mV", held_mV, st.est_mV);
+
+  return CHECK_DONE();
+}
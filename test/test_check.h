@@ -0,0 +1,26 @@
+#ifndef TEST_CHECK_H_
+#define TEST_CHECK_H_
+
+/* Minimal checks for the host tests: print each failure, the test fails (exit code 1) if any check failed */
+#include <stdio.h>
+
+static int s_checkFailures = 0;
+
+#define CHECK(cond, ...)                                                  \
+  do                                                                      \
+  {                                                                       \
+    if (!(cond))                                                          \
+    {                                                                     \
+      if (s_checkFailures++ < 20)                                         \
+      {                                                                   \
+        printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #cond);            \
+        printf(__VA_ARGS__);                                              \
+        printf("\n");                                                     \
+      }                                                                   \
+    }                                                                     \
+  } while (0)
+
+#define CHECK_DONE()                                                      \
+  (printf("%s: %d failure(s)\n", (s_checkFailures ? "FAILED" : "PASSED"), s_checkFailures), (s_checkFailures ? 1 : 0))
+
+#endif
@@ -0,0 +1,123 @@
+/*
+  Host test of FixMath_Atan2Deg10 (fixmath.cpp): error sweep against atan2() in double, and a benchmark against it.
+  The sweep covers the 14 bit range of the TLE493D coordinates, every sign and octant, and reproduces the accuracy table in
+  fixmath.h: CMakeLists.txt builds this test once per FIXMATH_ATAN_LUT_BITS of the table, with the max error the table states
+  (FIXMATH_TEST_MAX_ERR_DEG10). The measured max error must match it to the digits the table gives, so a stale table fails.
+  The benchmark only prints: host times do not say much about the ESP32, they are there to compare table sizes and libm.
+*/
+#include <math.h>
+#include <chrono>
+#include "fixmath.h"
+#include "test_check.h"
+
+#ifndef FIXMATH_TEST_MAX_ERR_DEG10
+  #define FIXMATH_TEST_MAX_ERR_DEG10  0.57   /* fixmath.h table, at the default FIXMATH_ATAN_LUT_BITS */
+#endif
+
+#define SWEEP_MIN   (-8192)   /* 14 bit signed sensor range */
+#define SWEEP_MAX   8191
+
+/* errDeg10: error of the integer angle against the exact one, on the circle */
+static double errDeg10(int16_t angle, int32_t y, int32_t x)
+{
+  double exact = atan2((double)y, (double)x) * 1800.0 / M_PI;
+  double err = fabs(angle - exact);
+
+  return (err > 1800.0) ? fabs(err - 3600.0) : err;
+}
+
+int main()
+{
+  double maxErr = 0;
+  int32_t maxErrX = 0, maxErrY = 0;
+  long points = 0;
+
+  /* Full range, strided (the strides are prime, so every ratio region is hit), then all the points around the octant edges */
+  for (int32_t y = SWEEP_MIN; y <= SWEEP_MAX; y += 7)
+  {
+    for (int32_t x = SWEEP_MIN; x <= SWEEP_MAX; x += 5)
+    {
+      if ((x == 0) && (y == 0))
+      {
+        continue;
+      }
+      double err = errDeg10(FixMath_Atan2Deg10(y, x), y, x);
+      if (err > maxErr)
+      {
+        maxErr = err;
+        maxErrX = x;
+        maxErrY = y;
+      }
+      points++;
+    }
+  }
+  for (int32_t a = SWEEP_MIN; a <= SWEEP_MAX; a++)
+  {
+    for (int32_t d = -2; d <= 2; d++)
+    {
+      int32_t b = a + d;
+      if ((b < SWEEP_MIN) || (b > SWEEP_MAX) || ((a == 0) && (b == 0)))
+      {
+        continue;
+      }
+      /* Near the diagonals and the axes, all four combinations of signs */
+      int32_t pts[][2] = { { a, b }, { a, -b }, { a, 0 }, { 0, a } };
+      for (auto &p : pts)
+      {
+        if ((p[0] == 0) && (p[1] == 0))
+        {
+          continue;
+        }
+        double err = errDeg10(FixMath_Atan2Deg10(p[0], p[1]), p[0], p[1]);
+        if (err > maxErr)
+        {
+          maxErr = err;
+          maxErrX = p[1];
+          maxErrY = p[0];
+        }
+        points++;
+      }
+    }
+  }
+
+  printf("FIXMATH_ATAN_LUT_BITS %d: %ld points, max error %.3f tenths of degree at (x %d, y %d), table says %.2f\n",
+         FIXMATH_ATAN_LUT_BITS, points, maxErr, maxErrX, maxErrY, FIXMATH_TEST_MAX_ERR_DEG10);
+  CHECK(fabs(maxErr - FIXMATH_TEST_MAX_ERR_DEG10) < 0.01, "max error %.3f, fixmath.h table says %.2f", maxErr, FIXMATH_TEST_MAX_ERR_DEG10);
+
+  /* Exact points: axes and diagonals, and the zero vector */
+  CHECK(FixMath_Atan2Deg10(0, 0) == 0, "atan2(0, 0)");
+  CHECK(FixMath_Atan2Deg10(0, 100) == 0, "0 deg");
+  CHECK(FixMath_Atan2Deg10(100, 100) == 450, "45 deg");
+  CHECK(FixMath_Atan2Deg10(100, 0) == 900, "90 deg");
+  CHECK(FixMath_Atan2Deg10(0, -100) == 1800, "180 deg");
+  CHECK(FixMath_Atan2Deg10(-100, 0) == -900, "-90 deg");
+  CHECK(FixMath_Atan2Deg10(-100, -100) == -1350, "-135 deg");
+
+  /* Benchmark, printed only */
+  {
+    volatile int32_t sink = 0;
+    long calls = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int32_t y = SWEEP_MIN; y <= SWEEP_MAX; y += 3)
+    {
+      for (int32_t x = SWEEP_MIN; x <= SWEEP_MAX; x += 97)
+      {
+        sink += FixMath_Atan2Deg10(y, x);
+        calls++;
+      }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (int32_t y = SWEEP_MIN; y <= SWEEP_MAX; y += 3)
+    {
+      for (int32_t x = SWEEP_MIN; x <= SWEEP_MAX; x += 97)
+      {
+        sink += (int32_t)(atan2((double)y, (double)x) * 1800.0 / M_PI);
+      }
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    printf("benchmark: FixMath_Atan2Deg10 %.2f ns/call, atan2() double %.2f ns/call (host)\n",
+           std::chrono::duration<double, std::nano>(t1 - t0).count() / calls, std::chrono::duration<double, std::nano>(t2 - t1).count() / calls);
+  }
+
+  return CHECK_DONE();
+}
@@ -0,0 +1,122 @@
+/*
+  Host test of the motor PWM duty quantizer (pwmquant.cpp), Q16 duty to counts of the PWM period, as dutyToCounts() in HAL.cpp
+  uses it. Periods: LEDC at 13, 14 and 16 bits (5kHz, 3kHz, 1kHz), MCPWM at 2000 and 10000 ticks (5kHz, 1kHz), and a 2 count one.
+  - PwmQuant_Dither: every write is the duty (as a fraction of 2^16) rounded down or up, never above the period; the carried error
+    keeps the sum of the counts equal to the requested duty times the writes (exact, integer); 0 and 100% are exact whatever the
+    carried error, also right after a duty change.
+  - Write coalescing: at 16 bits a steady duty gives the same counts at every write (rounded, as PwmQuant_Round), and at 2^N
+    counts a steady duty with no bits below the resolution does too. The share of writes that change the counts is printed.
+  - PwmQuant_Round: nearest count.
+*/
+#include "pwmquant.h"
+#include "test_check.h"
+
+#define DUTY_STRIDE   97      /* Duties checked: every 97th Q16 step, plus the ends */
+#define WRITES        4096    /* Writes per duty, ~2s of control ticks */
+#define AVG_WRITES    8       /* Writes the average is taken over for the printed resolution (4ms of control ticks) */
+
+/* DitherStats_type: what the writes of one period did */
+typedef struct {
+  uint32_t worstAvgErr;       /* [1/2^16 counts] worst error of an AVG_WRITES average */
+  uint32_t changes, writes;   /* Writes that changed the counts, of all the writes */
+} DitherStats_type;
+
+/* checkDitherDuty: WRITES writes of a steady duty */
+static void checkDitherDuty(uint32_t period, uint32_t duty, DitherStats_type *stats)
+{
+  uint64_t exact = (duty >= THROTTLE_Q16_MAX) ? ((uint64_t)period << 16) : (uint64_t)duty * period;   /* [1/2^16 counts] */
+  uint32_t lo = exact >> 16;
+  uint32_t err = 0, prev = 0, changes = 0;
+  uint64_t sum = 0, window = 0;
+  bool rounded = (period >= THROTTLE_Q16_MAX);
+  bool lostBits = ((period & (period - 1)) != 0) || ((duty & (0xFFFF / period)) != 0);  /* Duty bits below one count of a 2^N period */
+
+  for (uint32_t k = 1; k <= WRITES; k++)
+  {
+    uint32_t counts = PwmQuant_Dither(duty, period, &err);
+
+    CHECK(counts <= period, "period %u duty %u: %u counts", period, duty, counts);
+    if (rounded)
+    {
+      CHECK(counts == PwmQuant_Round(duty, period), "period %u duty %u: %u counts, not rounded", period, duty, counts);
+    }
+    else
+    {
+      CHECK((counts == lo) || (counts == lo + 1), "period %u duty %u: %u counts, exact %.3f", period, duty, counts, exact / 65536.0);
+      CHECK(err <= 0xFFFF, "period %u duty %u: carried error %u", period, duty, err);
+      sum += counts;
+      CHECK((sum << 16) + err == k * exact, "period %u duty %u: the average drifts at write %u", period, duty, k);
+    }
+    if ((k > 1) && (counts != prev))
+    {
+      changes++;
+    }
+    prev = counts;
+
+    window += counts;
+    if (k % AVG_WRITES == 0)
+    {
+      uint64_t got = window << 16, want = AVG_WRITES * exact;
+      uint32_t avgErr = (uint32_t)(((got > want) ? got - want : want - got) / AVG_WRITES);
+      stats->worstAvgErr = (avgErr > stats->worstAvgErr) ? avgErr : stats->worstAvgErr;
+      window = 0;
+    }
+  }
+  CHECK((changes == 0) || (!rounded && lostBits), "period %u duty %u: %u rewrites of a steady duty", period, duty, changes);
+  stats->changes += changes;
+  stats->writes += WRITES - 1;
+}
+
+static void checkDither(uint32_t period)
+{
+  DitherStats_type stats = {}, aligned = {};
+
+  checkDitherDuty(period, THROTTLE_Q16_MAX, &stats);
+  for (uint32_t duty = 0; duty < THROTTLE_Q16_MAX; duty += DUTY_STRIDE)
+  {
+    checkDitherDuty(period, duty, &stats);
+  }
+  for (uint32_t duty = 0; duty < THROTTLE_Q16_MAX; duty += 0x10000 / period)   /* On whole counts of a 2^N period: no rewrites */
+  {
+    checkDitherDuty(period, duty, &aligned);
+  }
+
+  /* The ends are exact with any carried error, e.g. straight after a partial duty */
+  for (uint32_t err0 = 0; err0 <= 0xFFFF; err0 += 4369)
+  {
+    uint32_t err = err0;
+    CHECK(PwmQuant_Dither(THROTTLE_Q16_MAX, period, &err) == period, "period %u: 100%% not full with error %u", period, err0);
+    err = err0;
+    CHECK(PwmQuant_Dither(0, period, &err) == 0, "period %u: 0%% not off with error %u", period, err0);
+  }
+
+  printf("period %5u counts: one count %.4f%%, dithered average over %u writes within %.4f%%, %.1f%% of the writes of a steady duty change the counts\n",
+         period, 100.0 / period, AVG_WRITES, 100.0 * stats.worstAvgErr / 65536.0 / period, 100.0 * stats.changes / stats.writes);
+}
+
+static void checkRound(uint32_t period)
+{
+  for (uint32_t duty = 0; duty <= THROTTLE_Q16_MAX; duty++)
+  {
+    uint64_t exact = (uint64_t)duty * period;
+    uint64_t got = (uint64_t)PwmQuant_Round(duty, period) * THROTTLE_Q16_MAX;
+    uint64_t diff = (got > exact) ? got - exact : exact - got;
+
+    CHECK(diff <= THROTTLE_Q16_MAX / 2 + 1, "round, period %u duty %u: %llu counts", period, duty, (unsigned long long)(got / THROTTLE_Q16_MAX));
+  }
+  CHECK(PwmQuant_Round(THROTTLE_Q16_MAX, period) == period, "round, period %u: 100%% not full", period);
+  CHECK(PwmQuant_Round(0, period) == 0, "round, period %u: 0%% not off", period);
+}
+
+int main()
+{
+  static const uint32_t periods[] = { 1UL << 13, 1UL << 14, 1UL << 16, 2000, 10000, 2 };
+
+  for (uint32_t period : periods)
+  {
+    checkDither(period);
+    checkRound(period);
+  }
+
+  return CHECK_DONE();
+}
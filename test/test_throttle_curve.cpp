@@ -0,0 +1,102 @@
+/*
+  Host test of the throttle curve look up table (throttle.cpp).
+  The control tick reads the curve with Throttle_CurveLookup() from the table built by Throttle_BuildCurveLut().
+  The reference is the curve as the firmware computed it before the table: throttleCurve2(), the vertex broken line with
+  Arduino map() at every trigger step (0..THROTTLE_NORMALIZED), in Q16 instead of percent. Between trigger steps the reference
+  is that curve joined by straight lines, evaluated in floating point and truncated.
+  The table must match it bit for bit, for every one of the 65536 Q16 trigger positions, at the corners of the SENSI, LIMIT,
+  CURVE menu ranges and with the vertex near both ends of the travel.
+*/
+#include <math.h>
+#include <Arduino.h>
+#include "throttle.h"
+#include "test_check.h"
+
+#define THROTTLE_NORMALIZED 256   /* Same as HAL.h: size - 1 of the curve table */
+
+/*
+  refNode: throttleCurve2() at a trigger step, as it was before the table (the map() broken line), output in Q16.
+  At step 0 the old function returned 0 (brake), now the caller handles the released trigger and the curve starts at SENSI.
+*/
+static long refNode(uint16_t in, uint16_t minSpeed, uint16_t maxSpeed, uint16_t vertexInput, uint16_t curveSpeedDiff)
+{
+  long minQ16 = THROTTLE_PCT_TO_Q16(minSpeed);
+  long maxQ16 = THROTTLE_PCT_TO_Q16(maxSpeed);
+  long vertexQ16 = minQ16 + ((maxQ16 - minQ16) * curveSpeedDiff) / 100;
+
+  if (in <= vertexInput)
+  {
+    return map(in, 0, vertexInput, minQ16, vertexQ16);
+  }
+  return map(in, vertexInput, THROTTLE_NORMALIZED, vertexQ16, maxQ16);
+}
+
+/*
+  refCurve: reference curve at a Q16 trigger position, float interpolation between the map() trigger steps.
+  The fraction is kept as an exact ratio of integers, so the truncation is exact also where the line crosses an integer.
+*/
+static long refCurve(uint16_t inQ16, uint16_t minSpeed, uint16_t maxSpeed, uint16_t vertexInput, uint16_t curveSpeedDiff)
+{
+  long pos = (long)inQ16 * THROTTLE_NORMALIZED;   /* Position in trigger steps, times THROTTLE_Q16_MAX */
+  long idx = pos / THROTTLE_Q16_MAX;
+  long lo, hi;
+
+  if (idx >= THROTTLE_NORMALIZED)
+  {
+    return refNode(THROTTLE_NORMALIZED, minSpeed, maxSpeed, vertexInput, curveSpeedDiff);
+  }
+  lo = refNode(idx, minSpeed, maxSpeed, vertexInput, curveSpeedDiff);
+  hi = refNode(idx + 1, minSpeed, maxSpeed, vertexInput, curveSpeedDiff);
+
+  return (long)floor((double)lo + (double)(hi - lo) * (double)(pos - idx * THROTTLE_Q16_MAX) / (double)THROTTLE_Q16_MAX);
+}
+
+int main()
+{
+  static const uint16_t sensiValues[] = { 0, 1, 45, 89, 90 };
+  static const uint16_t limitValues[] = { 5, 6, 50, 99, 100 };
+  static const uint16_t curveValues[] = { 10, 11, 50, 89, 90 };
+  static const uint16_t vertexValues[] = { 1, THROTTLE_NORMALIZED / 2, THROTTLE_NORMALIZED - 1 };
+  uint16_t lut[THROTTLE_NORMALIZED + 1];
+  unsigned curves = 0;
+
+  for (uint16_t minSpeed : sensiValues)
+  {
+    for (uint16_t maxSpeed : limitValues)
+    {
+      if (minSpeed > maxSpeed)  /* SENSI is bounded by LIMIT in the menu */
+      {
+        continue;
+      }
+      for (uint16_t curveSpeedDiff : curveValues)
+      {
+        for (uint16_t vertexInput : vertexValues)
+        {
+          Throttle_BuildCurveLut(lut, THROTTLE_NORMALIZED, minSpeed, maxSpeed, vertexInput, curveSpeedDiff);
+          curves++;
+
+          for (uint16_t i = 0; i <= THROTTLE_NORMALIZED; i++)
+          {
+            long ref = refNode(i, minSpeed, maxSpeed, vertexInput, curveSpeedDiff);
+            CHECK(lut[i] == ref, "SENSI %u LIMIT %u CURVE %u vertex %u: lut[%u] %u, map() %ld",
+                  minSpeed, maxSpeed, curveSpeedDiff, vertexInput, i, lut[i], ref);
+          }
+
+          for (uint32_t in = 0; in <= THROTTLE_Q16_MAX; in++)
+          {
+            long ref = refCurve(in, minSpeed, maxSpeed, vertexInput, curveSpeedDiff);
+            uint16_t out = Throttle_CurveLookup(lut, THROTTLE_NORMALIZED, in);
+            CHECK(out == ref, "SENSI %u LIMIT %u CURVE %u vertex %u: input %u lookup %u, reference %ld",
+                  minSpeed, maxSpeed, curveSpeedDiff, vertexInput, in, out, ref);
+          }
+
+          CHECK(Throttle_CurveLookup(lut, THROTTLE_NORMALIZED, 0) == THROTTLE_PCT_TO_Q16(minSpeed), "curve does not start at SENSI %u", minSpeed);
+          CHECK(Throttle_CurveLookup(lut, THROTTLE_NORMALIZED, THROTTLE_Q16_MAX) == THROTTLE_PCT_TO_Q16(maxSpeed), "curve does not end at LIMIT %u", maxSpeed);
+        }
+      }
+    }
+  }
+
+  printf("%u curves, %u trigger positions each\n", curves, THROTTLE_Q16_MAX + 1);
+  return CHECK_DONE();
+}
@@ -0,0 +1,156 @@
+/*
+  Host test of the trigger deadband and noise gate (throttle.cpp), the two stages between the trigger read and the curve.
+  - Throttle_DeadBandQ16: monotonic over the whole Q16 input, 0 and full scale inside the deadbands, no jump at their edges.
+  - Throttle_NoiseGateQ16: a monotonic trigger sweep gives a monotonic output that trails it by at most the gate,
+    the ends go through at once, and an input sitting on the gate edge or moving less than the gate does not chatter.
+  - The two chained as in the control tick, from a raw trigger sweep in both orientations: monotonic.
+*/
+#include "throttle.h"
+#include "test_check.h"
+
+#define THROTTLE_DEADBAND_Q16   ((3 * 65535UL) / 100)  /* Same as HAL.h */
+#define THROTTLE_NOISE_Q16      ((2 * 65535UL) / 100)  /* Same as HAL.h */
+
+/* lcgNext: fixed pseudo random sequence, the same on every host */
+static uint32_t lcgNext(uint32_t *seed)
+{
+  *seed = *seed * 1664525UL + 1013904223UL;
+  return *seed >> 8;
+}
+
+static void testDeadBand(uint16_t deadBandQ16)
+{
+  uint16_t prev = 0;
+  uint32_t maxStep = 1 + (THROTTLE_Q16_MAX - 1) / (THROTTLE_Q16_MAX - 2 * (uint32_t)deadBandQ16);  /* Slope of the scaled part, rounded up */
+
+  for (uint32_t in = 0; in <= THROTTLE_Q16_MAX; in++)
+  {
+    uint16_t out = Throttle_DeadBandQ16(in, deadBandQ16);
+
+    if (in <= deadBandQ16)
+    {
+      CHECK(out == 0, "deadband %u: input %u gives %u inside the low deadband", deadBandQ16, in, out);
+    }
+    if (in >= (uint32_t)(THROTTLE_Q16_MAX - deadBandQ16))
+    {
+      CHECK(out == THROTTLE_Q16_MAX, "deadband %u: input %u gives %u inside the high deadband", deadBandQ16, in, out);
+    }
+    CHECK(out >= prev, "deadband %u: not monotonic at input %u (%u after %u)", deadBandQ16, in, out, prev);
+    CHECK((uint32_t)(out - prev) <= maxStep, "deadband %u: jump of %u at input %u", deadBandQ16, out - prev, in);
+    prev = out;
+  }
+}
+
+static void testGateSweep(uint16_t gateQ16)
+{
+  static const uint32_t strides[] = { 1, 7, 331 };
+  uint16_t held = 0;
+  uint16_t prev = 0;
+
+  /* Slow and fast sweeps up, then down: monotonic, never ahead of the input, at most the gate behind */
+  for (uint32_t stride : strides)
+  {
+    for (uint32_t in = 0; in < THROTTLE_Q16_MAX; in += stride)
+    {
+      uint16_t out = Throttle_NoiseGateQ16(&held, in, gateQ16);
+      CHECK(out >= prev, "gate %u: up sweep not monotonic at %u", gateQ16, in);
+      CHECK(out <= in, "gate %u: output %u ahead of the input %u", gateQ16, out, in);
+      CHECK(in - out <= gateQ16, "gate %u: output %u lags the input %u by more than the gate", gateQ16, out, in);
+      prev = out;
+    }
+    CHECK(Throttle_NoiseGateQ16(&held, THROTTLE_Q16_MAX, gateQ16) == THROTTLE_Q16_MAX, "gate %u: full throttle delayed", gateQ16);
+    prev = THROTTLE_Q16_MAX;
+
+    for (int32_t in = THROTTLE_Q16_MAX - 1; in > 0; in -= stride)
+    {
+      uint16_t out = Throttle_NoiseGateQ16(&held, in, gateQ16);
+      CHECK(out <= prev, "gate %u: down sweep not monotonic at %d", gateQ16, in);
+      CHECK(out >= in, "gate %u: output %u ahead of the input %d", gateQ16, out, in);
+      CHECK(out - in <= gateQ16, "gate %u: output %u lags the input %d by more than the gate", gateQ16, out, in);
+      prev = out;
+    }
+    CHECK(Throttle_NoiseGateQ16(&held, 0, gateQ16) == 0, "gate %u: brake delayed", gateQ16);
+    prev = 0;
+  }
+}
+
+static void testGateEdge(uint16_t gateQ16)
+{
+  const uint16_t still = 30000;
+  uint16_t held = still;
+  uint32_t seed = 1;
+  uint32_t changes = 0;
+  uint16_t prev;
+
+  /* Input sitting exactly on the gate edge, on either side, alternating: the output does not move */
+  for (int i = 0; i < 1000; i++)
+  {
+    uint16_t in = (i & 1) ? still + gateQ16 : still - gateQ16;
+    CHECK(Throttle_NoiseGateQ16(&held, in, gateQ16) == still, "gate %u: output moved with the input on the gate edge (%u)", gateQ16, in);
+  }
+
+  /* One LSB past the edge moves the output by one LSB, going back to the edge does not move it back */
+  CHECK(Throttle_NoiseGateQ16(&held, still + gateQ16 + 1, gateQ16) == still + 1, "gate %u: one LSB past the edge", gateQ16);
+  for (int i = 0; i < 1000; i++)
+  {
+    uint16_t in = (i & 1) ? still + gateQ16 + 1 : still + gateQ16;
+    CHECK(Throttle_NoiseGateQ16(&held, in, gateQ16) == still + 1, "gate %u: chatter at the gate edge (%u)", gateQ16, in);
+  }
+
+  /* Still trigger with noise up to the gate peak to peak: the output settles after the first moves and then stays */
+  held = still;
+  prev = still;
+  for (int i = 0; i < 20000; i++)
+  {
+    uint16_t in = still - gateQ16 / 2 + (uint16_t)(lcgNext(&seed) % ((uint32_t)gateQ16 + 1));
+    uint16_t out = Throttle_NoiseGateQ16(&held, in, gateQ16);
+    if (out != prev)
+    {
+      changes++;
+      CHECK(i < 100, "gate %u: output moved at step %d with a still trigger", gateQ16, i);
+    }
+    prev = out;
+  }
+  CHECK(changes <= 2, "gate %u: %u output changes with a still trigger", gateQ16, changes);
+}
+
+static void testChain(bool isReversed)
+{
+  const int16_t minRaw = 120, maxRaw = 3890;  /* Typical calibration of the 12 bit ADC trigger */
+  uint16_t held = 0;
+  uint16_t prev = 0;
+
+  for (int32_t i = 0; i <= (maxRaw - minRaw) + 40; i++)
+  {
+    int16_t raw = isReversed ? (maxRaw + 20 - i) : (minRaw - 20 + i);
+    uint16_t trig = Throttle_NormalizeQ16(raw, minRaw, maxRaw, isReversed);
+    trig = Throttle_DeadBandQ16(trig, THROTTLE_DEADBAND_Q16);
+    trig = Throttle_NoiseGateQ16(&held, trig, THROTTLE_NOISE_Q16);
+    CHECK(trig >= prev, "reversed %d: raw %d gives %u after %u", isReversed, raw, trig, prev);
+    prev = trig;
+  }
+  CHECK(prev == THROTTLE_Q16_MAX, "reversed %d: full travel gives %u", isReversed, prev);
+}
+
+int main()
+{
+  static const uint16_t deadBands[] = { 0, 1, THROTTLE_DEADBAND_Q16, THROTTLE_Q16_MAX / 4, THROTTLE_Q16_MAX / 2 - 1 };
+  static const uint16_t gates[] = { 0, 1, THROTTLE_NOISE_Q16, THROTTLE_Q16_MAX / 10 };
+
+  for (uint16_t deadBandQ16 : deadBands)
+  {
+    testDeadBand(deadBandQ16);
+  }
+  for (uint16_t gateQ16 : gates)
+  {
+    testGateSweep(gateQ16);
+    if (gateQ16 > 0)
+    {
+      testGateEdge(gateQ16);
+    }
+  }
+  testChain(false);
+  testChain(true);
+
+  return CHECK_DONE();
+}
@@ -0,0 +1,269 @@
+/*
+  Host simulation of the traction control (traction.cpp) in the loop with a car: DC motor, gear, tyre with a slip curve.
+  The current sense is modelled as the firmware has it: on-phase samples every ~250us with noise, averaged over 6,
+  CURR_INVALID_MA until 6 samples are taken, the control step every 500us. It backs the constants in traction.h: TRACTION_DI_NOISE_MA,
+  TRACTION_HOLDOFF_TICKS, TRACTION_TRIM_STEP_Q16 (25%), TRACTION_TRIM_MIN_Q16 (50%) and TRACTION_RECOVER_Q16 (0.5%/tick).
+  Every run is repeated with SIM_SEEDS noise sequences: a tuning that only passes on one of them is not taken.
+  Checked:
+  - with grip, the current falls slowly as the car speeds up: no trim, at any TRAC;
+  - losing grip (the wheels spin up, the current drops): the duty is trimmed by one step within the latency of s_gripLoss,
+    never below the min, the next trim comes only after the holdoff, and the trim comes back at the recovery rate;
+  - the trim lowers the slip and the car goes further than without it;
+  - grip back: the trim recovers fully.
+*/
+#include <math.h>
+#include "traction.h"
+#include "test_check.h"
+
+#define SIM_DT_S          10e-6     /* [s] model time step */
+#define SIM_SAMPLE_STEPS  25        /* Current sample every 250us */
+#define SIM_TICK_STEPS    50        /* Control step every 500us */
+#define SIM_CURR_AVG      6         /* Current sense moving average (CURR_AVG_SAMPLES) */
+#define SIM_NOISE_MA      50.0      /* [mA] current sense noise, peak */
+#define SIM_TRAC_LEVEL    6
+#define SIM_SEEDS         20        /* Noise sequences each run is repeated with */
+#define SIM_MAX_TICKS     3000
+
+/* SimCar_type: motor and car, SI units */
+typedef struct {
+  double vin, r, ke, l, jm, jw, gear, wheelR, mass, fric;
+} SimCar_type;
+
+/* SimRun_type: one run, the parameters and what was recorded at every control step */
+typedef struct {
+  double grip, gripSpin, tSpin, tGripBack;  /* Normal load factor before tSpin, between tSpin and tGripBack, after */
+  uint16_t level;
+  uint32_t ticks;
+  uint16_t trim[SIM_MAX_TICKS];             /* [Q16] trim at each control step */
+  uint16_t duty[SIM_MAX_TICKS];
+  double peakSlip, slipSum, dist;
+  uint32_t slipN, spins;
+  uint32_t seed;                            /* Current sense noise sequence */
+} SimRun_type;
+
+/* SimGripLoss_type: a grip loss and the latency of its first trim, in control steps, over all the noise sequences.
+   With a noiseless current sense and no average the model itself needs 2 steps on the 0.6 grip loss */
+typedef struct {
+  double gripSpin;                          /* Normal load factor after the loss (3.0 before) */
+  uint32_t maxTrimTicks;                    /* Worst case */
+  double meanTrimTicks;
+} SimGripLoss_type;
+
+static const SimCar_type s_car = { 12.0, 2.0, 0.0038, 100e-6, 2e-7, 2e-7, 3.0, 0.01, 0.1, 1e-7 };
+static const SimGripLoss_type s_gripLoss[] = {
+  { 1.0, 15, 8.0 },   /* Partial loss: the current falls slower, it takes longer to rise above the noise */
+  { 0.6,  6, 4.0 },   /* Hard spin: ~2ms */
+};
+
+/* tyreMu: friction coefficient against slip, Pacejka like */
+static double tyreMu(double slip)
+{
+  return sin(1.6 * atan(10.0 * slip));
+}
+
+/* simSetup: set the grip profile, the TRAC level and the noise sequence of a run */
+static void simSetup(SimRun_type *run, double grip, double gripSpin, double tSpin, double tGripBack, uint16_t level, uint32_t seed)
+{
+  run->grip = grip;
+  run->gripSpin = gripSpin;
+  run->tSpin = tSpin;
+  run->tGripBack = tGripBack;
+  run->level = level;
+  run->seed = seed;
+}
+
+static void simRun(SimRun_type *run, double tEnd)
+{
+  double i = 0, wm = 0, v = 0, x = 0;
+  double buf[SIM_CURR_AVG] = { 0 };
+  double acc = 0;
+  int bi = 0, fresh = 0;
+  int16_t current_mA = 0;
+  uint16_t duty = 0;
+  uint16_t dropQ16 = Traction_DropQ16(run->level);
+  TractionState_type st = {};
+  uint32_t seed = run->seed;
+
+  Traction_Reset(&st);
+  run->ticks = 0;
+  run->peakSlip = run->slipSum = 0;
+  run->slipN = 0;
+
+  for (long step = 0; step * SIM_DT_S < tEnd; step++)
+  {
+    double t = step * SIM_DT_S;
+    double grip = (t < run->tSpin) ? run->grip : ((t < run->tGripBack) ? run->gripSpin : run->grip);
+    double load = 3.0 * grip;   /* [N] tyre normal load times grip */
+
+    if (step % SIM_SAMPLE_STEPS == 0)
+    {
+      seed = seed * 1664525UL + 1013904223UL;
+      double noise = SIM_NOISE_MA * 1e-3 * (((seed >> 8) / (double)(1UL << 24)) * 2 - 1);
+      acc -= buf[bi];
+      buf[bi] = i + noise;
+      acc += buf[bi];
+      bi = (bi + 1) % SIM_CURR_AVG;
+      fresh += (fresh < SIM_CURR_AVG);
+      current_mA = (fresh < SIM_CURR_AVG) ? CURR_INVALID_MA : (int16_t)(acc / SIM_CURR_AVG * 1000);
+    }
+    if ((step % SIM_TICK_STEPS == 0) && (run->ticks < SIM_MAX_TICKS))
+    {
+      duty = Traction_Step(&st, dropQ16, THROTTLE_Q16_MAX, current_mA);  /* Full trigger */
+      run->trim[run->ticks] = st.trimQ16;
+      run->duty[run->ticks] = duty;
+      run->ticks++;
+    }
+
+    double di = ((duty / 65535.0) * s_car.vin - s_car.r * i - s_car.ke * wm) / s_car.l;
+    i += di * SIM_DT_S;
+    if (i < 0)
+    {
+      i = 0;  /* The half bridge free wheels, no reverse current */
+    }
+    double vw = (wm / s_car.gear) * s_car.wheelR;
+    double slip = (vw - v) / fmax(fmax(fabs(vw), fabs(v)), 0.05);
+    double force = tyreMu(slip) * load;
+    wm += (s_car.ke * i - force * s_car.wheelR / s_car.gear - s_car.fric * wm) / (s_car.jm + s_car.jw / (s_car.gear * s_car.gear)) * SIM_DT_S;
+    v += force / s_car.mass * SIM_DT_S;
+    x += v * SIM_DT_S;
+
+    if ((t >= run->tSpin + 0.01) && (t < run->tSpin + 0.3))
+    {
+      run->slipSum += slip;
+      run->slipN++;
+      if (slip > run->peakSlip)
+      {
+        run->peakSlip = slip;
+      }
+    }
+  }
+  run->dist = x;
+  run->spins = st.spinCount;
+}
+
+/* checkTrimTrajectory: trims are one step (or down to the min), spaced by the holdoff, with recovery in between */
+static void checkTrimTrajectory(const SimRun_type *run, const char *name)
+{
+  uint32_t lastTrimTick = 0;
+  bool trimmed = false;
+
+  for (uint32_t k = 1; k < run->ticks; k++)
+  {
+    uint16_t prev = run->trim[k - 1], cur = run->trim[k];
+
+    CHECK(cur >= TRACTION_TRIM_MIN_Q16, "%s: trim %u below the min at tick %u", name, cur, k);
+    if (cur < prev)
+    {
+      uint16_t expected = (prev > TRACTION_TRIM_MIN_Q16 + TRACTION_TRIM_STEP_Q16) ? prev - TRACTION_TRIM_STEP_Q16 : TRACTION_TRIM_MIN_Q16;
+      CHECK(cur == expected, "%s: trim from %u to %u at tick %u, not one step", name, prev, cur, k);
+      if (trimmed)
+      {
+        CHECK(k - lastTrimTick > TRACTION_HOLDOFF_TICKS, "%s: trims at ticks %u and %u, inside the holdoff", name, lastTrimTick, k);
+      }
+      trimmed = true;
+      lastTrimTick = k;
+    }
+    else if (cur > prev)
+    {
+      CHECK((cur - prev == TRACTION_RECOVER_Q16) || (cur == THROTTLE_Q16_MAX), "%s: trim from %u to %u at tick %u, not the recovery rate",
+            name, prev, cur, k);
+    }
+  }
+}
+
+/* firstTrimTick: first control step with a trim, after a given tick. SIM_MAX_TICKS if none */
+static uint32_t firstTrimTick(const SimRun_type *run, uint32_t from)
+{
+  for (uint32_t k = from; k < run->ticks; k++)
+  {
+    if (run->trim[k] < THROTTLE_Q16_MAX)
+    {
+      return k;
+    }
+  }
+  return SIM_MAX_TICKS;
+}
+
+int main()
+{
+  static SimRun_type run, off;
+  const uint32_t spinTick = 60;   /* 30ms */
+  uint32_t first;
+
+  /* Full grip launch: the current falls as the car speeds up, that is not spin */
+  for (uint32_t seed = 1; seed <= SIM_SEEDS; seed++)
+  {
+    for (uint16_t level = 1; level <= TRACTION_LEVEL_MAX; level++)
+    {
+      simSetup(&run, 3.0, 3.0, 1e9, 1e9, level, seed);
+      simRun(&run, 0.5);
+      CHECK(run.spins == 0, "full grip, TRAC %u, seed %u: %u spin detections", level, seed, run.spins);
+      CHECK(firstTrimTick(&run, 0) == SIM_MAX_TICKS, "full grip, TRAC %u, seed %u: trimmed", level, seed);
+    }
+  }
+
+  /* Grip lost at 30ms, for the rest of the run: compare with the traction control OFF */
+  for (const SimGripLoss_type &loss : s_gripLoss)
+  {
+    double gripSpin = loss.gripSpin;
+    double peakSlipOff = 0, peakSlip = 0, distOff = 0, dist = 0;
+    uint32_t trimTicks = 0, maxTrimTicks = 0, trims = 0;
+
+    for (uint32_t seed = 1; seed <= SIM_SEEDS; seed++)
+    {
+      simSetup(&off, 3.0, gripSpin, spinTick * 500e-6, 1e9, 0, seed);
+      simRun(&off, 0.5);
+      simSetup(&run, 3.0, gripSpin, spinTick * 500e-6, 1e9, SIM_TRAC_LEVEL, seed);
+      simRun(&run, 0.5);
+      first = firstTrimTick(&run, 0);
+
+      CHECK(off.spins == 0, "grip %.1f, seed %u: detections with TRAC OFF", gripSpin, seed);
+      CHECK(first >= spinTick, "grip %.1f, seed %u: trim at tick %u, before the grip loss", gripSpin, seed, first);
+      CHECK(first <= spinTick + loss.maxTrimTicks, "grip %.1f, seed %u: first trim %u ticks after the grip loss", gripSpin, seed, first - spinTick);
+      if ((first < spinTick) || (first >= SIM_MAX_TICKS))
+      {
+        continue;
+      }
+      CHECK(run.trim[first] == THROTTLE_Q16_MAX - TRACTION_TRIM_STEP_Q16, "grip %.1f, seed %u: first trim to %u", gripSpin, seed, run.trim[first]);
+      checkTrimTrajectory(&run, "grip loss");
+      CHECK(run.peakSlip < off.peakSlip, "grip %.1f, seed %u: peak slip %.2f with TRAC, %.2f without", gripSpin, seed, run.peakSlip, off.peakSlip);
+      CHECK(run.slipSum / run.slipN < off.slipSum / off.slipN, "grip %.1f, seed %u: mean slip not lower with TRAC", gripSpin, seed);
+      CHECK(run.dist > off.dist, "grip %.1f, seed %u: %.3f m with TRAC, %.3f m without", gripSpin, seed, run.dist, off.dist);
+
+      trimTicks += first - spinTick;
+      maxTrimTicks = (first - spinTick > maxTrimTicks) ? first - spinTick : maxTrimTicks;
+      trims += run.spins;
+      peakSlipOff += off.peakSlip / SIM_SEEDS;
+      peakSlip += run.peakSlip / SIM_SEEDS;
+      distOff += off.dist / SIM_SEEDS;
+      dist += run.dist / SIM_SEEDS;
+    }
+    printf("grip 3.0 -> %.1f, %u noise seeds: peak slip %.2f -> %.2f, distance at 0.5s %.3f -> %.3f m, %.1f trims, first after %.1f ticks (max %u)\n",
+           gripSpin, SIM_SEEDS, peakSlipOff, peakSlip, distOff, dist, (double)trims / SIM_SEEDS, (double)trimTicks / SIM_SEEDS, maxTrimTicks);
+    CHECK((double)trimTicks / SIM_SEEDS <= loss.meanTrimTicks, "grip %.1f: first trim after %.1f ticks on average", gripSpin, (double)trimTicks / SIM_SEEDS);
+  }
+
+  /* Grip lost at 30ms and back at 100ms: the trim recovers to none at TRACTION_RECOVER_Q16 per tick */
+  uint32_t lastTrimTick = 0;
+  for (uint32_t seed = 1; seed <= SIM_SEEDS; seed++)
+  {
+    simSetup(&run, 3.0, 0.6, spinTick * 500e-6, 0.1, SIM_TRAC_LEVEL, seed);
+    simRun(&run, 0.5);
+    checkTrimTrajectory(&run, "grip back");
+    CHECK(run.spins >= 1, "grip back, seed %u: no detection", seed);
+    for (uint32_t k = 0; k < run.ticks; k++)
+    {
+      if (run.trim[k] < THROTTLE_Q16_MAX)
+      {
+        first = k;
+      }
+    }
+    CHECK(first < 200 + (THROTTLE_Q16_MAX - TRACTION_TRIM_MIN_Q16) / TRACTION_RECOVER_Q16 + 2 * TRACTION_HOLDOFF_TICKS,
+          "grip back, seed %u: still trimmed at tick %u", seed, first);
+    CHECK(run.duty[run.ticks - 1] == THROTTLE_Q16_MAX, "grip back, seed %u: full duty not given back", seed);
+    lastTrimTick = (first > lastTrimTick) ? first : lastTrimTick;
+  }
+  printf("grip back at 100ms: last tick with a trim %u (%.1f ms) at worst\n", lastTrimTick, lastTrimTick * 0.5);
+
+  return CHECK_DONE();
+}
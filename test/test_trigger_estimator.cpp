@@ -0,0 +1,227 @@
+/*
+  Trace replay test of the trigger estimator (Throttle_EstimatorStep / Throttle_EstimatorLead in throttle.cpp), with the
+  constants of throttle.h (TRIG_EST_ALPHA_Q8 128, TRIG_EST_BETA_Q8 43, TRIG_EST_SNAP_Q16 200).
+  The traces in traces/ are SYNTHETIC (gen_trigger_traces.py): no trace recorded on a car is available yet. They are in the
+  telemetry stream format, one line per control tick, so a recording (TELEMETRY_STREAM_DECIMATION 1) can be replayed too:
+    test_trigger_estimator my_recording.csv
+  Checked on every trace, at the default and at the max LEAD:
+  - LEAD 0 (OFF) gives the measured trigger back unchanged;
+  - still trigger, slow moves and pumping slower than a snap: no lead at all, the output is the measure;
+  - snaps: the output crosses 25/50/75% of the travel never later than the measure, and at least a tick earlier on a fast snap;
+  - the lead never runs ahead of where the trigger is going by more than OVERSHOOT_TICK_Q16 per tick of LEAD;
+  - the trigger [Q16] column matches the firmware pipeline (normalize, deadband, noise gate) on the raw column.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <initializer_list>
+#include <vector>
+#include "throttle.h"
+#include "test_check.h"
+
+#define ESC_PERIOD_US           500   /* Same as slot_ESC.h */
+#define TRIG_LEAD_DEFAULT       10    /* [0.1ms] same as slot_ESC.h */
+#define TRIG_LEAD_MAX_VALUE     30    /* [0.1ms] same as slot_ESC.h */
+#define THROTTLE_DEADBAND_Q16   ((3 * 65535UL) / 100)  /* Same as HAL.h */
+#define THROTTLE_NOISE_Q16      ((2 * 65535UL) / 100)  /* Same as HAL.h */
+
+#define STILL_TICKS       16                          /* Ticks without a fast move before "no lead" is required */
+#define SNAP_MOVE_Q16     (8 * TRIG_EST_SNAP_Q16)     /* Move in 4 ticks that is a fast snap */
+#define OVERSHOOT_TICK_Q16 1000                       /* Max lead beyond where the trigger goes, per tick of LEAD (1.5%) */
+
+/* Trace_type: a trace read from a telemetry stream file */
+typedef struct {
+  std::vector<uint32_t> timestamp_uS;
+  std::vector<int16_t>  raw;
+  std::vector<uint16_t> trigger_q16;
+  bool     hasCalibration;
+  int16_t  minRaw, maxRaw;
+  bool     isReversed;
+} Trace_type;
+
+static bool readTrace(const char *path, Trace_type *trace)
+{
+  FILE *f = fopen(path, "r");
+  char line[256];
+
+  if (f == NULL)
+  {
+    return false;
+  }
+  trace->hasCalibration = false;
+  while (fgets(line, sizeof(line), f))
+  {
+    unsigned long ts;
+    int raw, rev, minRaw, maxRaw;
+    unsigned q16;
+
+    if (line[0] == '#')
+    {
+      if (sscanf(line, "# calibration %d %d %d", &minRaw, &maxRaw, &rev) == 3)
+      {
+        trace->hasCalibration = true;
+        trace->minRaw = minRaw;
+        trace->maxRaw = maxRaw;
+        trace->isReversed = (rev != 0);
+      }
+    }
+    else if (sscanf(line, "%lu,%d,%u", &ts, &raw, &q16) == 3)
+    {
+      trace->timestamp_uS.push_back(ts);
+      trace->raw.push_back(raw);
+      trace->trigger_q16.push_back(q16);
+    }
+  }
+  fclose(f);
+
+  return !trace->trigger_q16.empty();
+}
+
+/* replay: run the estimator on a trace as the control tick does, return the lead output of every tick */
+static std::vector<uint16_t> replay(const Trace_type *trace, uint16_t leadQ8, std::vector<int16_t> *vel)
+{
+  std::vector<uint16_t> out;
+  TrigEstimator_type est;
+
+  Throttle_EstimatorReset(&est);
+  for (uint16_t meas : trace->trigger_q16)
+  {
+    Throttle_EstimatorStep(&est, meas);
+    out.push_back(Throttle_EstimatorLead(&est, meas, leadQ8));
+    if (vel != NULL)
+    {
+      vel->push_back(Throttle_EstimatorVelocity(&est));
+    }
+  }
+  return out;
+}
+
+static void checkTrace(const char *path)
+{
+  Trace_type trace;
+  size_t n;
+
+  if (!readTrace(path, &trace))
+  {
+    CHECK(false, "%s: cannot read the trace", path);
+    return;
+  }
+  n = trace.trigger_q16.size();
+  const std::vector<uint16_t> &meas = trace.trigger_q16;
+
+  /* The estimator works per control tick: a decimated stream cannot be replayed */
+  for (size_t k = 1; k < n; k++)
+  {
+    uint32_t dt = trace.timestamp_uS[k] - trace.timestamp_uS[k - 1];
+    CHECK((dt > ESC_PERIOD_US - 50) && (dt < ESC_PERIOD_US + 50), "%s: %u us between lines %zu and %zu, not one control tick", path, dt, k - 1, k);
+  }
+
+  /* The trigger column is what the firmware pipeline gives on the raw column */
+  if (trace.hasCalibration)
+  {
+    uint16_t held = 0;
+    for (size_t k = 0; k < n; k++)
+    {
+      uint16_t q = Throttle_NormalizeQ16(trace.raw[k], trace.minRaw, trace.maxRaw, trace.isReversed);
+      q = Throttle_DeadBandQ16(q, THROTTLE_DEADBAND_Q16);
+      q = Throttle_NoiseGateQ16(&held, q, THROTTLE_NOISE_Q16);
+      CHECK(q == meas[k], "%s: line %zu trigger %u, the pipeline gives %u", path, k, meas[k], q);
+    }
+  }
+
+  /* LEAD OFF: unchanged */
+  std::vector<uint16_t> off = replay(&trace, 0, NULL);
+  for (size_t k = 0; k < n; k++)
+  {
+    CHECK(off[k] == meas[k], "%s: LEAD 0 changes tick %zu from %u to %u", path, k, meas[k], off[k]);
+  }
+
+  for (uint16_t lead : { (uint16_t)TRIG_LEAD_DEFAULT, (uint16_t)TRIG_LEAD_MAX_VALUE })
+  {
+    uint16_t leadQ8 = ((uint32_t)lead * 100 * 256) / ESC_PERIOD_US;  /* As updateControlParams() */
+    std::vector<int16_t> vel;
+    std::vector<uint16_t> out = replay(&trace, leadQ8, &vel);
+    uint32_t leadTicks = 0, crossings = 0, snapCrossings = 0, advanceSum = 0;
+    int32_t maxOvershoot = 0;
+
+    for (size_t k = 0; k < n; k++)
+    {
+      /* No fast move in the last STILL_TICKS: still, slow or pumping, no lead */
+      bool quiet = (k >= STILL_TICKS);
+      for (size_t j = (k >= STILL_TICKS) ? k - STILL_TICKS + 1 : 1; quiet && (j <= k); j++)
+      {
+        quiet = (abs((int32_t)meas[j] - (int32_t)meas[j - 1]) <= TRIG_EST_SNAP_Q16);
+      }
+      if (quiet)
+      {
+        CHECK(out[k] == meas[k], "%s LEAD %u: lead on a quiet trigger at tick %zu (%u, measured %u, velocity %d)", path, lead, k, out[k], meas[k], vel[k]);
+      }
+      leadTicks += (out[k] != meas[k]);
+
+      /* Overshoot: how far the lead goes beyond the range the trigger covers in the next ticks */
+      int32_t lo = meas[k], hi = meas[k];
+      for (size_t j = k; (j < n) && (j <= k + 2 * (leadQ8 >> 8) + 2); j++)
+      {
+        lo = (meas[j] < lo) ? meas[j] : lo;
+        hi = (meas[j] > hi) ? meas[j] : hi;
+      }
+      int32_t over = ((int32_t)out[k] > hi) ? (int32_t)out[k] - hi : (((int32_t)out[k] < lo) ? lo - (int32_t)out[k] : 0);
+      maxOvershoot = (over > maxOvershoot) ? over : maxOvershoot;
+
+      /* Level crossings of the measure: the output must already be past the level, earlier on a fast snap */
+      if (k == 0)
+      {
+        continue;
+      }
+      for (uint32_t level : { THROTTLE_Q16_MAX / 4, THROTTLE_Q16_MAX / 2, 3 * THROTTLE_Q16_MAX / 4 })
+      {
+        bool up = (meas[k - 1] < level) && (meas[k] >= level);
+        bool down = (meas[k - 1] > level) && (meas[k] <= level);
+        if (!up && !down)
+        {
+          continue;
+        }
+        size_t j = k;
+        while ((j > 0) && (up ? (out[j - 1] >= level) : (out[j - 1] <= level)) && (k - j < 20))
+        {
+          j--;
+        }
+        bool past = up ? (out[k] >= level) : (out[k] <= level);
+        bool snap = (k >= 4) && (abs((int32_t)meas[k] - (int32_t)meas[k - 4]) > SNAP_MOVE_Q16);
+        CHECK(past, "%s LEAD %u: output %u behind the measure %u crossing %u at tick %zu", path, lead, out[k], meas[k], level, k);
+        if (snap)
+        {
+          CHECK(k - j >= 1, "%s LEAD %u: no advance on the snap crossing %u at tick %zu", path, lead, level, k);
+          snapCrossings++;
+        }
+        advanceSum += k - j;
+        crossings++;
+      }
+    }
+    CHECK(maxOvershoot <= OVERSHOOT_TICK_Q16 * (leadQ8 >> 8), "%s LEAD %u: lead %d beyond where the trigger goes", path, lead, maxOvershoot);
+
+    printf("%-24s LEAD %.1fms: %zu ticks, lead active on %u, %u crossings (%u snaps), mean advance %.2f ticks, max overshoot %d\n",
+           path, lead / 10.0, n, leadTicks, crossings, snapCrossings, crossings ? (double)advanceSum / crossings : 0.0, maxOvershoot);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  static const char *defaultTraces[] = { "traces/snaps.csv", "traces/slow_still.csv", "traces/pumping.csv" };
+
+  if (argc > 1)
+  {
+    for (int i = 1; i < argc; i++)
+    {
+      checkTrace(argv[i]);
+    }
+  }
+  else
+  {
+    for (const char *path : defaultTraces)
+    {
+      checkTrace(path);
+    }
+  }
+
+  return CHECK_DONE();
+}
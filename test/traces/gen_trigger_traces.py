@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""Generate the synthetic trigger traces replayed by test_trigger_estimator.
+
+There are no recorded traces yet: these are made up. Each one is a trigger position profile (snaps shaped
+as a smooth S, slow presses, pumping) on a 12 bit ADC trigger with +-3 LSB noise, one line per control tick
+(ESC_PERIOD_US). The file format is the serial telemetry stream (see drainTelemetry() in the .ino), so a real
+recording can be dropped in next to them: it needs TELEMETRY_STREAM_DECIMATION 1, and the "# calibration" line
+with the trigger calibration of the car, or the replay skips the raw column check.
+
+The trigger [Q16] column is computed from the raw one the way the control tick does (normalize, deadband, noise gate,
+same integer math as throttle.cpp); the replay test recomputes it with the firmware functions and checks they agree.
+Run from this directory: python3 gen_trigger_traces.py
+"""
+import math
+import random
+
+TICK_US = 500
+Q16_MAX = 65535
+MIN_RAW, MAX_RAW = 120, 3890
+DEADBAND_Q16 = (3 * 65535) // 100
+NOISE_Q16 = (2 * 65535) // 100
+NOISE_RAW = 3
+
+
+def smooth(t):
+    """S shaped 0..1 profile of a trigger snap (raised cosine)"""
+    return 0.5 - 0.5 * math.cos(math.pi * min(max(t, 0.0), 1.0))
+
+
+def normalize(raw):
+    raw = min(max(raw, MIN_RAW), MAX_RAW)
+    return ((raw - MIN_RAW) * Q16_MAX) // (MAX_RAW - MIN_RAW)
+
+
+def dead_band(q):
+    if q <= DEADBAND_Q16:
+        return 0
+    if q >= Q16_MAX - DEADBAND_Q16:
+        return Q16_MAX
+    return ((q - DEADBAND_Q16) * Q16_MAX) // (Q16_MAX - 2 * DEADBAND_Q16)
+
+
+class Gate:
+    def __init__(self):
+        self.held = 0
+
+    def step(self, q):
+        if q == 0 or q == Q16_MAX:
+            self.held = q
+        elif q > self.held + NOISE_Q16:
+            self.held = q - NOISE_Q16
+        elif q + NOISE_Q16 < self.held:
+            self.held = q + NOISE_Q16
+        return self.held
+
+
+class Trace:
+    def __init__(self, seed):
+        self.pos = []       # trigger position, 0..1 of the travel
+        self.rng = random.Random(seed)
+
+    def hold(self, ms):
+        last = self.pos[-1] if self.pos else 0.0
+        self.pos += [last] * int(ms * 1000 / TICK_US)
+
+    def snap(self, to, ms):
+        start = self.pos[-1] if self.pos else 0.0
+        n = int(ms * 1000 / TICK_US)
+        self.pos += [start + (to - start) * smooth((i + 1) / n) for i in range(n)]
+
+    def ramp(self, to, ms):
+        start = self.pos[-1] if self.pos else 0.0
+        n = int(ms * 1000 / TICK_US)
+        self.pos += [start + (to - start) * (i + 1) / n for i in range(n)]
+
+    def sine(self, centre, amplitude, hz, ms):
+        n = int(ms * 1000 / TICK_US)
+        self.pos += [centre + amplitude * math.sin(2 * math.pi * hz * i * TICK_US * 1e-6) for i in range(n)]
+
+    def write(self, name, description):
+        gate = Gate()
+        with open(name, "w") as f:
+            f.write("# SYNTHETIC trace, not recorded on a car: %s\n" % description)
+            f.write("# Generated by gen_trigger_traces.py. Telemetry stream format, one line per control tick\n")
+            f.write("# calibration %d %d 0\n" % (MIN_RAW, MAX_RAW))
+            for i, p in enumerate(self.pos):
+                raw = int(round(MIN_RAW - 20 + p * (MAX_RAW - MIN_RAW + 40))) + self.rng.randint(-NOISE_RAW, NOISE_RAW)
+                q = gate.step(dead_band(normalize(raw)))
+                f.write("%d,%d,%d,0,12000,0,0,0,65535,65535,0\n" % (i * TICK_US, raw, q))
+
+
+def main():
+    t = Trace(1)
+    t.hold(200)
+    t.snap(1.0, 20)     # full open snap
+    t.hold(300)
+    t.snap(0.0, 10)     # release snap
+    t.hold(200)
+    t.snap(0.6, 15)     # partial snap, mid corner exit
+    t.hold(200)
+    t.snap(0.3, 15)     # partial lift
+    t.hold(200)
+    t.snap(0.0, 10)
+    t.hold(200)
+    t.write("snaps.csv", "full and partial trigger snaps, open and release")
+
+    t = Trace(2)
+    t.hold(200)
+    t.ramp(0.5, 1000)   # slow press, 50% of the travel in 1s
+    t.hold(500)         # still, only the sensor noise
+    t.ramp(0.0, 800)
+    t.hold(200)
+    t.write("slow_still.csv", "slow press and release, still trigger with sensor noise")
+
+    t = Trace(3)
+    t.hold(100)
+    t.ramp(0.6, 300)
+    t.sine(0.6, 0.2, 4, 1000)   # pumping the trigger at 4 Hz, slower than a snap
+    t.snap(1.0, 20)
+    t.hold(200)
+    t.snap(0.0, 10)
+    t.hold(200)
+    t.write("pumping.csv", "trigger pumped at 4 Hz around 60%, then a snap open and release")
+
+
+if __name__ == "__main__":
+    main()